@@ -0,0 +1,140 @@
+// This file is part of ASAP.
+// Please see LICENSE.txt for copyright and licensing information.
+
+#include "CheckFacts.h"
+#include "SCIPass.h"
+#include "utils.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/PatternMatch.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+
+#define DEBUG_TYPE "check-facts"
+
+using namespace llvm;
+using namespace llvm::PatternMatch;
+
+static cl::opt<bool> EnableFacts("check-facts",
+        cl::desc("Keep what removed checks established as assumptions and no-wrap flags"),
+        cl::init(false), cl::Hidden);
+
+// A condition made of compares of program values, which stays cheap to
+// keep alive: operands computed only for the check, such as shadow loads,
+// are not allowed, except for casts of program values
+static bool isProgramCondition(Value *V, const std::set<Instruction*> &Private, unsigned Depth = 0) {
+    if (CmpInst *Cmp = dyn_cast<CmpInst>(V)) {
+        for (Value *Op: Cmp->operands()) {
+            if (CastInst *Cast = dyn_cast<CastInst>(Op)) {
+                Op = Cast->getOperand(0);
+            }
+            Instruction *I = dyn_cast<Instruction>(Op);
+            if (I && Private.count(I)) {
+                return false;
+            }
+        }
+        return true;
+    }
+    BinaryOperator *BO = dyn_cast<BinaryOperator>(V);
+    if (BO && Depth < 4 && (BO->getOpcode() == Instruction::And || BO->getOpcode() == Instruction::Or)) {
+        return isProgramCondition(BO->getOperand(0), Private, Depth + 1) &&
+               isProgramCondition(BO->getOperand(1), Private, Depth + 1);
+    }
+    return false;
+}
+
+void CheckFacts::add(Instruction *SC, SCIPass *SCI, Use *Sub) {
+    if (!EnableFacts) {
+        return;
+    }
+    const SanityCheckInfo &Info = SCI->getCheckInfo(SC);
+    Instruction *Start = isa<BranchInst>(SC) ? SCI->getCheckBranches(SC).front() : SC;
+    if (Info.isASan()) {
+        if (!Sub && Info.Operand && Info.Operand->getType()->isPointerTy() && Info.AccessSize) {
+            Assumptions.push_back(Assumption{Start, nullptr, false, Info.Operand, Info.AccessSize});
+        }
+        return;
+    }
+    if (!isa<BranchInst>(SC)) {
+        return;
+    }
+    const std::set<Instruction*> &Private = SCI->getInstructionsBySanityCheck(SC);
+    // A fused check fails if any predicate of an or, or no predicate of an
+    // and, holds
+    if (Sub) {
+        Instruction *Op = cast<Instruction>(Sub->getUser());
+        addCondition(Start, Sub->get(), Op->getOpcode() == Instruction::Or, Private);
+        return;
+    }
+    if (SCI->getCheckBranches(SC).size() != 1) {
+        return;
+    }
+    BranchInst *BI = cast<BranchInst>(Start);
+    Value *Cond = BI->getCondition();
+    Value *Overflow = nullptr;
+    match(Cond, m_Not(m_Value(Overflow)));
+    if (ExtractValueInst *EV = dyn_cast<ExtractValueInst>(Overflow ? Overflow : Cond)) {
+        if (isa<WithOverflowInst>(EV->getAggregateOperand())) {
+            NoWrap.insert(cast<IntrinsicInst>(EV->getAggregateOperand()));
+        }
+        return;
+    }
+    unsigned RegularBranch = getRegularBranch(BI, SCI);
+    if (RegularBranch > 1) {
+        return;
+    }
+    addCondition(Start, Cond, RegularBranch == 1, Private);
+}
+
+void CheckFacts::addCondition(Instruction *InsertBefore, Value *Cond, bool Negate,
+                              const std::set<Instruction*> &Private) {
+    if (isProgramCondition(Cond, Private)) {
+        Assumptions.push_back(Assumption{InsertBefore, Cond, Negate, nullptr, 0});
+    }
+}
+
+void CheckFacts::apply() {
+    for (const Assumption &A: Assumptions) {
+        IRBuilder<> IRB(A.InsertBefore);
+        if (A.Cond) {
+            IRB.CreateAssumption(A.Negate ? IRB.CreateNot(A.Cond) : A.Cond);
+            continue;
+        }
+#if LLVM_VERSION_MAJOR >= 12
+        Value *Size = ConstantInt::get(IRB.getInt64Ty(), A.Size);
+        OperandBundleDef Bundles[] = {
+            OperandBundleDef("nonnull", std::vector<Value*>{A.Ptr}),
+            OperandBundleDef("dereferenceable", std::vector<Value*>{A.Ptr, Size})
+        };
+        IRB.CreateAssumption(IRB.getTrue(), Bundles);
+#endif
+    }
+    for (IntrinsicInst *II: NoWrap) {
+        WithOverflowInst *WO = cast<WithOverflowInst>(II);
+        IRBuilder<> IRB(WO);
+        Value *Result = IRB.CreateBinOp(WO->getBinaryOp(), WO->getLHS(), WO->getRHS());
+        if (BinaryOperator *BO = dyn_cast<BinaryOperator>(Result)) {
+            if (WO->isSigned()) {
+                BO->setHasNoSignedWrap();
+            }
+            else {
+                BO->setHasNoUnsignedWrap();
+            }
+        }
+        LLVM_DEBUG(dbgs() << "No wrap: " << *WO << " -> " << *Result << "\n");
+        std::vector<ExtractValueInst*> Results;
+        for (User *U: WO->users()) {
+            ExtractValueInst *EV = dyn_cast<ExtractValueInst>(U);
+            if (EV && EV->getNumIndices() == 1 && EV->getIndices()[0] == 0) {
+                Results.push_back(EV);
+            }
+        }
+        for (ExtractValueInst *EV: Results) {
+            EV->replaceAllUsesWith(Result);
+        }
+    }
+    Assumptions.clear();
+    NoWrap.clear();
+}
@@ -0,0 +1,59 @@
+// This file is part of ASAP.
+// Please see LICENSE.txt for copyright and licensing information.
+
+#ifndef SRPASS_CHECKFACTS_H
+#define SRPASS_CHECKFACTS_H
+
+#include <cstdint>
+#include <set>
+#include <vector>
+
+namespace llvm {
+    class Instruction;
+    class IntrinsicInst;
+    class Use;
+    class Value;
+}
+
+struct SCIPass;
+
+// With -check-facts, a removed check leaves behind what it established,
+// so that the optimizer can still use it:
+//  - an ASan check, that its pointer is nonnull and dereferenceable for
+//    the access size, as an llvm.assume operand bundle;
+//  - a UBSan overflow check, that its arithmetic does not wrap, by
+//    replacing the result of the overflow intrinsic with an nsw or nuw
+//    instruction;
+//  - other UBSan checks that compare program values, such as shift,
+//    division and bounds checks, their passing condition as an
+//    llvm.assume.
+// Facts are recorded when a check is removed, while its condition is still
+// intact, and only materialized by apply(), so that matching in the
+// reducers is not disturbed. apply() must run before removed callback
+// checks are erased.
+class CheckFacts {
+public:
+    // Records the facts of SC, or of its predicate Sub if given, before the
+    // check or predicate is folded
+    void add(llvm::Instruction *SC, SCIPass *SCI, llvm::Use *Sub = nullptr);
+
+    void apply();
+
+private:
+    struct Assumption {
+        llvm::Instruction *InsertBefore;
+        // Condition that holds, negated if Negate is set
+        llvm::Value *Cond;
+        bool Negate;
+        // Pointer that is dereferenceable for Size bytes, if Cond is null
+        llvm::Value *Ptr;
+        uint64_t Size;
+    };
+    std::vector<Assumption> Assumptions;
+    std::set<llvm::IntrinsicInst*> NoWrap;
+
+    void addCondition(llvm::Instruction *InsertBefore, llvm::Value *Cond, bool Negate,
+                      const std::set<llvm::Instruction*> &Private);
+};
+
+#endif
@@ -0,0 +1,472 @@
+// This file is part of ASAP.
+// Please see LICENSE.txt for copyright and licensing information.
+
+#include "CheckSummaries.h"
+#include "SCIPass.h"
+#include "SameLocation.h"
+#include "utils.h"
+#include "llvm/ADT/SCCIterator.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/Analysis/CallGraph.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Operator.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+
+#include <string>
+#include <vector>
+#define DEBUG_TYPE "sr-check-summaries"
+
+using namespace llvm;
+
+static cl::opt<unsigned> MaxDepth("summary-max-depth",
+        cl::desc("Maximal depth of the expressions compared across calls"),
+        cl::init(8), cl::Hidden);
+
+static cl::opt<unsigned> MaxFacts("summary-max-facts",
+        cl::desc("Maximal number of checks summarised per function"),
+        cl::init(64), cl::Hidden);
+
+// Operations that can be recomputed from their operands anywhere
+static bool isPureOperation(Instruction *I) {
+    if (isa<BinaryOperator>(I) || isa<CastInst>(I) || isa<GetElementPtrInst>(I) ||
+        isa<CmpInst>(I) || isa<SelectInst>(I) || isa<ExtractValueInst>(I)) {
+        return true;
+    }
+    IntrinsicInst *II = dyn_cast<IntrinsicInst>(I);
+    return II && !II->mayHaveSideEffects() && !II->mayReadFromMemory();
+}
+
+// Calls may free memory or poison the shadow, and ASan writes the shadow
+// of stack variables through integer addresses
+static bool mayChangeShadow(Instruction &I) {
+    if (CallBase *CB = dyn_cast<CallBase>(&I)) {
+        CallInst *CI = dyn_cast<CallInst>(CB);
+        return !CI || !(isa<IntrinsicInst>(CI) || isCallbackCheck(CI) || isAbortingCall(CI));
+    }
+    StoreInst *SI = dyn_cast<StoreInst>(&I);
+    return SI && Operator::getOpcode(SI->getPointerOperand()->stripPointerCasts()) == Instruction::IntToPtr;
+}
+
+bool CheckSummaries::runOnModule(Module &M) {
+    SCI = &getAnalysis<SCIPass>();
+    CallGraph &CG = getAnalysis<CallGraphWrapperPass>().getCallGraph();
+    unsigned NumChecks = 0, NumAfterCall = 0, NumOnEntry = 0;
+    std::set<Instruction*> Removed;
+
+    // Callees come first, so their summaries are complete unless they call
+    // back into the same SCC
+    for (scc_iterator<CallGraph*> I = scc_begin(&CG); !I.isAtEnd(); ++I) {
+        for (CallGraphNode *N: *I) {
+            Function *F = N->getFunction();
+            if (!F || F->isDeclaration()) {
+                continue;
+            }
+            DominatorTree &DT = getAnalysis<DominatorTreeWrapperPass>(*F).getDomTree();
+            summarize(*F, DT);
+            std::vector<CallInst*> Calls;
+            for (BasicBlock &BB: *F) {
+                for (Instruction &Inst: BB) {
+                    CallInst *CI = dyn_cast<CallInst>(&Inst);
+                    if (CI && ExitFacts.count(CI->getCalledFunction()) && CI->getCalledFunction() != F) {
+                        Calls.push_back(CI);
+                    }
+                }
+            }
+            for (Instruction *SC: SCI->getSanityChecks(F)) {
+                NumChecks += 1;
+                if (!Calls.empty() && isCheckedByCallee(SC, Calls, DT)) {
+                    LLVM_DEBUG(dbgs() << "Checked by callee: " << *SC << "\n");
+                    Removed.insert(SC);
+                    NumAfterCall += 1;
+                }
+            }
+        }
+    }
+
+    // An entry check stays unless every call site guarantees it
+    std::map<Function*, std::vector<Instruction*>> EntryChecks;
+    for (Function &F: M) {
+        std::vector<Instruction*> Checks = getEntryChecks(F);
+        if (!Checks.empty()) {
+            EntryChecks[&F] = Checks;
+        }
+    }
+    std::set<Instruction*> Unchecked;
+    for (Function &F: M) {
+        DominatorTree *DT = nullptr;
+        for (BasicBlock &BB: F) {
+            for (Instruction &Inst: BB) {
+                CallBase *CB = dyn_cast<CallBase>(&Inst);
+                auto It = CB ? EntryChecks.find(CB->getCalledFunction()) : EntryChecks.end();
+                if (It == EntryChecks.end()) {
+                    continue;
+                }
+                if (!DT) {
+                    DT = &getAnalysis<DominatorTreeWrapperPass>(F).getDomTree();
+                }
+                for (Instruction *SC: It->second) {
+                    if (!Unchecked.count(SC) && !isCheckedByCaller(SC, CB, *DT)) {
+                        Unchecked.insert(SC);
+                    }
+                }
+            }
+        }
+    }
+    for (auto &Entry: EntryChecks) {
+        for (Instruction *SC: Entry.second) {
+            if (!Unchecked.count(SC) && Removed.insert(SC).second) {
+                LLVM_DEBUG(dbgs() << "Checked by all callers: " << *SC << "\n");
+                NumOnEntry += 1;
+            }
+        }
+    }
+
+    // Every removed check is implied by a check that ran before it, so the
+    // decisions hold together although they were taken on the unchanged
+    // module
+    for (Instruction *SC: Removed) {
+        if (isa<CallInst>(SC)) {
+            RemovedCalls.insert(SC);
+        }
+        else {
+            foldSanityCheck(cast<BranchInst>(SC), SCI);
+        }
+    }
+    eraseCallbackChecks(RemovedCalls);
+
+    std::string filename = M.getSourceFileName();
+    filename = filename.substr(0, filename.rfind("."));
+    errs() << "CheckSummaries on " << filename << ": " << NumOnEntry << " checks guaranteed by callers, "
+           << NumAfterCall << " by callees, of " << NumChecks << "\n";
+    return !Removed.empty();
+}
+
+void CheckSummaries::summarize(Function &F, DominatorTree &DT) {
+    std::vector<Instruction*> Returns;
+    for (BasicBlock &BB: F) {
+        if (isa<ReturnInst>(BB.getTerminator())) {
+            Returns.push_back(BB.getTerminator());
+        }
+    }
+    if (Returns.empty()) {
+        return;
+    }
+    auto ReachesReturns = [&](Instruction *I, bool ShadowUnchanged) {
+        for (Instruction *R: Returns) {
+            if (!DT.dominates(I, R) || (ShadowUnchanged && !isShadowUnchanged(I, R))) {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    std::vector<Fact> &Facts = ExitFacts[&F];
+    for (Instruction *SC: SCI->getSanityChecks(&F)) {
+        if (Facts.size() >= MaxFacts) {
+            return;
+        }
+        if (!abortsOnFailure(SC) || !isExpressible(SC, {})) {
+            continue;
+        }
+        if (ReachesReturns(getCheckStart(SC), SCI->getCheckInfo(SC).isASan())) {
+            Facts.push_back(Fact{SC, {}});
+        }
+    }
+    // The summaries of the callees that run on every path to a return
+    for (BasicBlock &BB: F) {
+        for (Instruction &I: BB) {
+            CallInst *CI = dyn_cast<CallInst>(&I);
+            auto It = CI ? ExitFacts.find(CI->getCalledFunction()) : ExitFacts.end();
+            if (It == ExitFacts.end() || It->first == &F || !ReachesReturns(CI, false)) {
+                continue;
+            }
+            bool ShadowUnchanged = ReachesReturns(CI, true);
+            for (const Fact &Callee: It->second) {
+                if (Facts.size() >= MaxFacts) {
+                    return;
+                }
+                if (SCI->getCheckInfo(Callee.Check).isASan() && !ShadowUnchanged) {
+                    continue;
+                }
+                std::vector<CallBase*> Path(1, CI);
+                Path.insert(Path.end(), Callee.Path.begin(), Callee.Path.end());
+                if (isExpressible(Callee.Check, Path)) {
+                    Facts.push_back(Fact{Callee.Check, Path});
+                }
+            }
+        }
+    }
+}
+
+bool CheckSummaries::isCheckedByCallee(Instruction *SC, const std::vector<CallInst*> &Calls,
+                                       DominatorTree &DT) {
+    if (getConditionValues(SC).empty()) {
+        return false;
+    }
+    Instruction *Start = getCheckStart(SC);
+    bool IsASan = SCI->getCheckInfo(SC).isASan();
+    for (CallInst *CI: Calls) {
+        if (!DT.dominates(CI, Start) || (IsASan && !isShadowUnchanged(CI, Start))) {
+            continue;
+        }
+        for (const Fact &Callee: ExitFacts[CI->getCalledFunction()]) {
+            std::vector<CallBase*> Path(1, CI);
+            Path.insert(Path.end(), Callee.Path.begin(), Callee.Path.end());
+            if (sameCondition(Callee.Check, Path, SC)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+std::vector<Instruction*> CheckSummaries::getEntryChecks(Function &F) {
+    std::vector<Instruction*> Checks;
+    // All call sites have to be known
+    if (F.isDeclaration() || !F.hasLocalLinkage() || F.hasAddressTaken() || F.use_empty()) {
+        return Checks;
+    }
+    for (Instruction *SC: SCI->getSanityChecks(&F)) {
+        if (!isExpressible(SC, {})) {
+            continue;
+        }
+        if (SCI->getCheckInfo(SC).isASan() && !isShadowUnchanged(nullptr, getCheckStart(SC))) {
+            continue;
+        }
+        Checks.push_back(SC);
+    }
+    return Checks;
+}
+
+bool CheckSummaries::isCheckedByCaller(Instruction *SC, CallBase *CB, DominatorTree &DT) {
+    CallBase *Path[] = {CB};
+    bool IsASan = SCI->getCheckInfo(SC).isASan();
+    for (Instruction *Kept: SCI->getSanityChecks(CB->getFunction())) {
+        if (!abortsOnFailure(Kept)) {
+            continue;
+        }
+        Instruction *Start = getCheckStart(Kept);
+        if (!DT.dominates(Start, CB) || !sameCondition(SC, Path, Kept)) {
+            continue;
+        }
+        if (!IsASan || isShadowUnchanged(Start, CB)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool CheckSummaries::sameCondition(Instruction *Inner, ArrayRef<CallBase*> Path, Instruction *Outer) {
+    const SanityCheckInfo &InnerInfo = SCI->getCheckInfo(Inner);
+    const SanityCheckInfo &OuterInfo = SCI->getCheckInfo(Outer);
+    if (InnerInfo.Sanitizer != OuterInfo.Sanitizer ||
+        (InnerInfo.isASan() && InnerInfo.AccessSize != OuterInfo.AccessSize)) {
+        return false;
+    }
+    std::vector<Value*> InnerValues = getConditionValues(Inner);
+    std::vector<Value*> OuterValues = getConditionValues(Outer);
+    if (InnerValues.empty() || InnerValues.size() != OuterValues.size()) {
+        return false;
+    }
+    if (InnerInfo.isUBSan()) {
+        // The branches have to pass on the same side
+        const SCIPass::InstructionVec &OuterBranches = SCI->getCheckBranches(Outer);
+        auto OuterIt = OuterBranches.begin();
+        for (Instruction *BI: SCI->getCheckBranches(Inner)) {
+            unsigned RegularBranch = getRegularBranch(cast<BranchInst>(BI), SCI);
+            if (RegularBranch > 1 || RegularBranch != getRegularBranch(cast<BranchInst>(*OuterIt++), SCI)) {
+                return false;
+            }
+        }
+    }
+    for (unsigned I = 0, E = InnerValues.size(); I != E; ++I) {
+        if (!sameValue(InnerValues[I], Path, OuterValues[I])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool CheckSummaries::sameValue(Value *Inner, ArrayRef<CallBase*> Path, Value *Outer, unsigned Depth) {
+    if (Depth > MaxDepth) {
+        return false;
+    }
+    if (Inner->getType()->isPointerTy()) {
+        Inner = Inner->stripPointerCasts();
+    }
+    if (Outer->getType()->isPointerTy()) {
+        Outer = Outer->stripPointerCasts();
+    }
+    Argument *A = dyn_cast<Argument>(Inner);
+    if (A && !Path.empty()) {
+        CallBase *CB = Path.back();
+        if (CB->getCalledFunction() != A->getParent() || A->getArgNo() >= CB->arg_size()) {
+            return false;
+        }
+        return sameValue(CB->getArgOperand(A->getArgNo()), Path.drop_back(), Outer, Depth + 1);
+    }
+    // Both values are in the same function now
+    if (Path.empty()) {
+        return VN.equal(Inner, Outer);
+    }
+    if (isa<Constant>(Inner)) {
+        return Inner == Outer;
+    }
+    Instruction *InnerInst = dyn_cast<Instruction>(Inner);
+    Instruction *OuterInst = dyn_cast<Instruction>(Outer);
+    if (!InnerInst || !OuterInst || !isPureOperation(InnerInst) || !InnerInst->isSameOperationAs(OuterInst)) {
+        return false;
+    }
+    for (unsigned I = 0, E = InnerInst->getNumOperands(); I != E; ++I) {
+        if (!sameValue(InnerInst->getOperand(I), Path, OuterInst->getOperand(I), Depth + 1)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool CheckSummaries::isExpressible(Instruction *SC, ArrayRef<CallBase*> Path) {
+    std::vector<Value*> Values = getConditionValues(SC);
+    if (Values.empty()) {
+        return false;
+    }
+    for (Value *V: Values) {
+        if (!isExpressible(V, Path)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool CheckSummaries::isExpressible(Value *V, ArrayRef<CallBase*> Path, unsigned Depth) {
+    if (Depth > MaxDepth) {
+        return false;
+    }
+    if (V->getType()->isPointerTy()) {
+        V = V->stripPointerCasts();
+    }
+    if (Argument *A = dyn_cast<Argument>(V)) {
+        if (Path.empty()) {
+            return true;
+        }
+        CallBase *CB = Path.back();
+        if (CB->getCalledFunction() != A->getParent() || A->getArgNo() >= CB->arg_size()) {
+            return false;
+        }
+        return isExpressible(CB->getArgOperand(A->getArgNo()), Path.drop_back(), Depth + 1);
+    }
+    if (isa<Constant>(V)) {
+        return true;
+    }
+    Instruction *I = dyn_cast<Instruction>(V);
+    if (!I || !isPureOperation(I)) {
+        return false;
+    }
+    for (Value *Op: I->operands()) {
+        if (!isExpressible(Op, Path, Depth + 1)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::vector<Value*> CheckSummaries::getConditionValues(Instruction *SC) {
+    std::vector<Value*> Values;
+    const SanityCheckInfo &Info = SCI->getCheckInfo(SC);
+    if (Info.isASan()) {
+        if (Value *Ptr = SameLocationOracle::getCheckedPointer(SCI, SC)) {
+            Values.push_back(Ptr);
+        }
+        return Values;
+    }
+    if (!Info.isUBSan() || !isa<BranchInst>(SC) || !SCI->getSubChecks(SC).empty()) {
+        return Values;
+    }
+    for (Instruction *Inst: SCI->getCheckBranches(SC)) {
+        BranchInst *BI = cast<BranchInst>(Inst);
+        if (!BI->isConditional()) {
+            return std::vector<Value*>();
+        }
+        Values.push_back(BI->getCondition());
+    }
+    return Values;
+}
+
+Instruction *CheckSummaries::getCheckStart(Instruction *SC) {
+    if (isa<BranchInst>(SC)) {
+        return SCI->getCheckBranches(SC).front();
+    }
+    return SC;
+}
+
+// A check that reports and carries on (ASan's *_noabort, UBSan handlers
+// without _abort) does not protect the code after it
+bool CheckSummaries::abortsOnFailure(Instruction *SC) {
+    const CallInst *Report = SCI->getCheckInfo(SC).ReportCall;
+    if (!Report || !Report->getCalledFunction()) {
+        return false;
+    }
+    const Function *Handler = Report->getCalledFunction();
+    if (Handler->getName().startswith("__asan_")) {
+        return !Handler->getName().endswith("_noabort");
+    }
+    return Handler->getName().endswith("_abort") || Handler->getIntrinsicID() == Intrinsic::trap ||
+           isUBSanTrap(Handler);
+}
+
+bool CheckSummaries::isShadowUnchanged(Instruction *From, Instruction *To) {
+    auto IsClear = [](BasicBlock::iterator It, BasicBlock::iterator End) {
+        for (; It != End; ++It) {
+            if (mayChangeShadow(*It)) {
+                return false;
+            }
+        }
+        return true;
+    };
+    BasicBlock *ToBB = To->getParent();
+    BasicBlock *FromBB = From ? From->getParent() : nullptr;
+    if (FromBB == ToBB && From->comesBefore(To)) {
+        return IsClear(std::next(From->getIterator()), To->getIterator());
+    }
+    if (!IsClear(ToBB->begin(), To->getIterator())) {
+        return false;
+    }
+    // All blocks on a path from From to To, or from the entry
+    SmallPtrSet<BasicBlock*, 16> Visited;
+    std::vector<BasicBlock*> Worklist(pred_begin(ToBB), pred_end(ToBB));
+    while (!Worklist.empty()) {
+        BasicBlock *BB = Worklist.back();
+        Worklist.pop_back();
+        if (!Visited.insert(BB).second) {
+            continue;
+        }
+        if (BB == FromBB) {
+            if (!IsClear(std::next(From->getIterator()), BB->end())) {
+                return false;
+            }
+            continue;
+        }
+        if (!IsClear(BB->begin(), BB->end())) {
+            return false;
+        }
+        Worklist.insert(Worklist.end(), pred_begin(BB), pred_end(BB));
+    }
+    return true;
+}
+
+void CheckSummaries::getAnalysisUsage(AnalysisUsage& AU) const {
+    AU.addRequired<SCIPass>();
+    AU.addRequired<CallGraphWrapperPass>();
+    AU.addRequired<DominatorTreeWrapperPass>();
+}
+
+char CheckSummaries::ID = 0;
+static RegisterPass<CheckSummaries> X("sr-check-summaries",
+        "Removes checks implied by checks in callers or callees", false, false);
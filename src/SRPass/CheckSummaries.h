@@ -0,0 +1,93 @@
+// This file is part of ASAP.
+// Please see LICENSE.txt for copyright and licensing information.
+
+#ifndef SRPASS_CHECKSUMMARIES_H
+#define SRPASS_CHECKSUMMARIES_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/Pass.h"
+#include "ValueNumbering.h"
+
+#include <map>
+#include <set>
+#include <vector>
+
+namespace llvm {
+    class CallBase;
+    class CallInst;
+    class DominatorTree;
+    class Function;
+    class Instruction;
+    class Value;
+}
+
+struct SCIPass;
+
+// Removes checks that are implied by checks in another function. Checks
+// are compared by what they establish once passed: the pointer and access
+// size of an ASan check, the branch conditions of a UBSan check. Across a
+// call, the arguments of the callee are replaced by the values the call
+// passes, so only conditions computed from arguments and constants by
+// side-effect free operations are compared.
+//
+// Two kinds of summaries are used. A function with internal linkage whose
+// address is not taken loses the checks on its arguments that every call
+// site already guarantees by an aborting check dominating the call. And a
+// function summarises the aborting checks that pass on every path to its
+// returns, its own and those of the callees it always calls; summaries
+// are built bottom-up over the call graph, and a check after a call that
+// the callee's summary implies is removed. Between two ASan checks, no
+// call and no store that could change the shadow may happen.
+struct CheckSummaries : public llvm::ModulePass {
+    static char ID;
+
+    CheckSummaries() : ModulePass(ID) {}
+
+    virtual bool runOnModule(llvm::Module &M);
+
+    virtual void getAnalysisUsage(llvm::AnalysisUsage& AU) const;
+
+private:
+    // A check that has passed when a function returns. Path holds the calls
+    // that lead from the summarised function to the function of Check.
+    struct Fact {
+        llvm::Instruction *Check;
+        std::vector<llvm::CallBase*> Path;
+    };
+
+    SCIPass *SCI;
+    ValueNumbering VN;
+    std::map<llvm::Function*, std::vector<Fact>> ExitFacts;
+    // Callback checks to erase at the end of runOnModule
+    std::set<llvm::Instruction*> RemovedCalls;
+
+    void summarize(llvm::Function &F, llvm::DominatorTree &DT);
+    // Whether a check after one of Calls is implied by the callee's summary
+    bool isCheckedByCallee(llvm::Instruction *SC, const std::vector<llvm::CallInst*> &Calls,
+                           llvm::DominatorTree &DT);
+    // The checks of F on its arguments that every call site has to guarantee
+    std::vector<llvm::Instruction*> getEntryChecks(llvm::Function &F);
+    bool isCheckedByCaller(llvm::Instruction *SC, llvm::CallBase *CB, llvm::DominatorTree &DT);
+
+    // Whether Inner, with the arguments along Path replaced by the values
+    // passed, establishes the same condition as Outer
+    bool sameCondition(llvm::Instruction *Inner, llvm::ArrayRef<llvm::CallBase*> Path,
+                       llvm::Instruction *Outer);
+    bool sameValue(llvm::Value *Inner, llvm::ArrayRef<llvm::CallBase*> Path, llvm::Value *Outer,
+                   unsigned Depth = 0);
+    // Whether the condition of SC only depends on the arguments of the
+    // function at the start of Path
+    bool isExpressible(llvm::Instruction *SC, llvm::ArrayRef<llvm::CallBase*> Path);
+    bool isExpressible(llvm::Value *V, llvm::ArrayRef<llvm::CallBase*> Path, unsigned Depth = 0);
+    // The values a check condition is computed from: the pointer of an ASan
+    // check, the branch conditions of an unfused UBSan check
+    std::vector<llvm::Value*> getConditionValues(llvm::Instruction *SC);
+
+    llvm::Instruction *getCheckStart(llvm::Instruction *SC);
+    bool abortsOnFailure(llvm::Instruction *SC);
+    // Whether every path from From, or from the function entry if From is
+    // null, to To is free of calls and stores that could change the shadow
+    bool isShadowUnchanged(llvm::Instruction *From, llvm::Instruction *To);
+};
+
+#endif
@@ -0,0 +1,240 @@
+// This file is part of ASAP.
+// Please see LICENSE.txt for copyright and licensing information.
+
+#include "CoalesceChecks.h"
+#include "RangeChecks.h"
+#include "SCIPass.h"
+#include "SameLocation.h"
+#include "utils.h"
+#include "llvm/ADT/PostOrderIterator.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+
+#include <algorithm>
+#include <tuple>
+#define DEBUG_TYPE "sr-coalesce-checks"
+
+using namespace llvm;
+
+static cl::opt<unsigned> MaxWalk("coalesce-max-blocks",
+        cl::desc("Maximal number of blocks to follow when grouping checks"),
+        cl::init(64), cl::Hidden);
+
+namespace {
+    struct Access {
+        Instruction *Check;
+        // Position of the check on the walk
+        unsigned Order;
+        int64_t Begin;
+        int64_t End;
+    };
+}
+
+bool CoalesceChecks::runOnModule(Module &M) {
+    SCI = &getAnalysis<SCIPass>();
+    unsigned NumRemoved = 0;
+    for (Function &F: M) {
+        if (F.isDeclaration() || SCI->getSanityChecks(&F).empty()) {
+            continue;
+        }
+        NumRemoved += coalesceFunction(F);
+    }
+    eraseCallbackChecks(RemovedCalls);
+    errs() << "CoalesceChecks on " << M.getSourceFileName() << ": " << NumRemoved << " checks merged away\n";
+    return NumRemoved > 0;
+}
+
+std::vector<Instruction*> CoalesceChecks::getStraightLineChecks(Instruction *Start,
+        const std::map<Instruction*, Instruction*> &CheckOf) {
+    std::vector<Instruction*> Checks;
+    SmallPtrSet<BasicBlock*, 16> Visited;
+    BasicBlock *BB = Start->getParent();
+    BasicBlock::iterator It = Start->getIterator();
+    while (BB && Visited.size() < MaxWalk && Visited.insert(BB).second) {
+        BasicBlock *Next = nullptr;
+        // The check whose branch ends BB, if any
+        Instruction *Check = nullptr;
+        for (; It != BB->end(); ++It) {
+            Instruction *I = &*It;
+            auto Found = CheckOf.find(I);
+            if (Found != CheckOf.end()) {
+                if (std::find(Checks.begin(), Checks.end(), Found->second) == Checks.end()) {
+                    Checks.push_back(Found->second);
+                }
+                if (BranchInst *BI = dyn_cast<BranchInst>(I)) {
+                    Next = BI->getSuccessor(getRegularBranch(BI, SCI));
+                    Check = Found->second;
+                }
+                continue;
+            }
+            if (isa<CallInst>(I) && !isa<IntrinsicInst>(I)) {
+                return Checks;
+            }
+            if (isa<InvokeInst>(I)) {
+                return Checks;
+            }
+            // Shadow stores, like those poisoning stack variables that go
+            // out of scope, write to an address computed from an integer
+            if (StoreInst *SI = dyn_cast<StoreInst>(I)) {
+                if (isa<IntToPtrInst>(SI->getPointerOperand()->stripPointerCasts())) {
+                    return Checks;
+                }
+            }
+            if (BranchInst *BI = dyn_cast<BranchInst>(I)) {
+                if (BI->isUnconditional()) {
+                    Next = BI->getSuccessor(0);
+                }
+            }
+        }
+        // Next must only be entered from BB, or from the other branches of
+        // the check that ends BB, like ASan's slow path; a join or a loop
+        // header also runs without the checks seen so far
+        if (Next) {
+            for (BasicBlock *Pred: predecessors(Next)) {
+                if (Pred == BB) {
+                    continue;
+                }
+                auto Found = CheckOf.find(Pred->getTerminator());
+                if (!Check || Found == CheckOf.end() || Found->second != Check) {
+                    return Checks;
+                }
+            }
+        }
+        BB = Next;
+        if (BB) {
+            It = BB->begin();
+        }
+    }
+    return Checks;
+}
+
+unsigned CoalesceChecks::coalesceFunction(Function &F) {
+    const DataLayout &DL = F.getParent()->getDataLayout();
+    std::map<Instruction*, Instruction*> CheckOf;
+    for (Instruction *SC: SCI->getSanityChecks(&F)) {
+        if (isa<BranchInst>(SC)) {
+            for (Instruction *BI: SCI->getCheckBranches(SC)) {
+                CheckOf[BI] = SC;
+            }
+        }
+        else {
+            CheckOf[SC] = SC;
+        }
+    }
+
+    // Groups are collected before anything changes, walking the blocks in
+    // reverse post order so that a walk starts at the first check of its
+    // straight-line code
+    std::vector<std::vector<Access>> Groups;
+    std::set<Instruction*> Grouped;
+    ReversePostOrderTraversal<Function*> RPOT(&F);
+    for (BasicBlock *BB: RPOT) {
+        for (Instruction &I: *BB) {
+            auto Found = CheckOf.find(&I);
+            if (Found == CheckOf.end() || Grouped.count(Found->second)) {
+                continue;
+            }
+            std::vector<Instruction*> Checks = getStraightLineChecks(&I, CheckOf);
+            // Accesses by base pointer and access kind
+            std::map<std::pair<Value*, bool>, std::vector<Access>> ByBase;
+            for (unsigned Order = 0; Order < Checks.size(); ++Order) {
+                Instruction *Check = Checks[Order];
+                // A check already seen on an earlier walk stays in its group
+                if (!Grouped.insert(Check).second) {
+                    continue;
+                }
+                const SanityCheckInfo &Info = SCI->getCheckInfo(Check);
+                Value *Ptr = SameLocationOracle::getCheckedPointer(SCI, Check);
+                if (!Ptr || Info.AccessSize == 0 || !Info.ReportCall ||
+                    Info.ReportCall->getCalledFunction() == nullptr ||
+                    Info.ReportCall->getCalledFunction()->getName().endswith("_noabort")) {
+                    continue;
+                }
+                int64_t Offset = 0;
+                Value *Base = GetPointerBaseWithConstantOffset(Ptr, Offset, DL);
+                bool IsWrite = Info.Kind == SanityCheckInfo::Store;
+                ByBase[std::make_pair(Base, IsWrite)].push_back(
+                        Access{Check, Order, Offset, Offset + (int64_t)Info.AccessSize});
+            }
+            // Split each base into runs of overlapping or touching ranges
+            for (auto &Entry: ByBase) {
+                std::vector<Access> &Accesses = Entry.second;
+                std::sort(Accesses.begin(), Accesses.end(), [](const Access &A, const Access &B) {
+                    return std::tie(A.Begin, A.Order) < std::tie(B.Begin, B.Order);
+                });
+                std::vector<Access> Run;
+                int64_t RunEnd = 0;
+                for (const Access &A: Accesses) {
+                    if (!Run.empty() && A.Begin > RunEnd) {
+                        if (Run.size() > 1) {
+                            Groups.push_back(Run);
+                        }
+                        Run.clear();
+                    }
+                    RunEnd = Run.empty() ? A.End : std::max(RunEnd, A.End);
+                    Run.push_back(A);
+                }
+                if (Run.size() > 1) {
+                    Groups.push_back(Run);
+                }
+            }
+        }
+    }
+
+    unsigned NumRemoved = 0;
+    for (const std::vector<Access> &Group: Groups) {
+        const Access *First = &Group.front();
+        int64_t Begin = Group.front().Begin;
+        int64_t End = Group.front().End;
+        for (const Access &A: Group) {
+            if (A.Order < First->Order) {
+                First = &A;
+            }
+            Begin = std::min(Begin, A.Begin);
+            End = std::max(End, A.End);
+        }
+        Instruction *Check = First->Check;
+        const SanityCheckInfo &Info = SCI->getCheckInfo(Check);
+        Value *Ptr = SameLocationOracle::getCheckedPointer(SCI, Check);
+        int64_t Offset = 0;
+        Value *Base = GetPointerBaseWithConstantOffset(Ptr, Offset, DL);
+
+        // The base is used to compute the first checked pointer, so it is
+        // available at the first check
+        Instruction *InsertBefore = isa<BranchInst>(Check) ? SCI->getCheckBranches(Check).front() : Check;
+        LLVM_DEBUG(dbgs() << "Merging " << Group.size() << " checks on " << *Base
+                          << " into [" << Begin << ", " << End << ")\n");
+        IRBuilder<> IRB(InsertBefore);
+        Type *IntptrTy = DL.getIntPtrType(F.getContext());
+        Value *Beg = IRB.CreateAdd(IRB.CreatePtrToInt(Base, IntptrTy), ConstantInt::get(IntptrTy, Begin));
+        insertRangeCheck(InsertBefore, Beg, ConstantInt::get(IntptrTy, End - Begin), End - Begin,
+                         Info.Kind == SanityCheckInfo::Store, nullptr, nullptr);
+
+        for (const Access &A: Group) {
+            if (isa<CallInst>(A.Check)) {
+                RemovedCalls.insert(A.Check);
+            }
+            else {
+                foldSanityCheck(cast<BranchInst>(A.Check), SCI);
+            }
+        }
+        NumRemoved += Group.size() - 1;
+    }
+    return NumRemoved;
+}
+
+void CoalesceChecks::getAnalysisUsage(AnalysisUsage& AU) const {
+    AU.addRequired<SCIPass>();
+}
+
+char CoalesceChecks::ID = 0;
+static RegisterPass<CoalesceChecks> X("sr-coalesce-checks",
+        "Merges ASan checks of nearby accesses off one base into one range check", false, false);
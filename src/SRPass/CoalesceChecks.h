@@ -0,0 +1,53 @@
+// This file is part of ASAP.
+// Please see LICENSE.txt for copyright and licensing information.
+
+#ifndef SRPASS_COALESCECHECKS_H
+#define SRPASS_COALESCECHECKS_H
+
+#include "llvm/Pass.h"
+
+#include <map>
+#include <set>
+#include <vector>
+
+namespace llvm {
+    class Function;
+    class Instruction;
+}
+
+struct SCIPass;
+
+// Merges ASan checks of nearby accesses off one base pointer, such as
+// p->x, p->y or an unrolled a[i], a[i+1], into one range check at the
+// first of them. Checks are grouped along straight-line code: starting at
+// a check, the walk follows unconditional branches and the passing edges
+// of checks into blocks that are entered from nowhere else, and stops at
+// any other branch or at anything that may change what is poisoned (calls
+// and shadow stores). Every check on the walk thus
+// runs whenever the first one does, and no memory is freed or poisoned in
+// between, so checking their bytes up front reports the same errors. Only
+// aborting checks of the same base and access kind whose byte ranges
+// overlap or touch are merged, so the range holds no byte that is not
+// accessed.
+struct CoalesceChecks : public llvm::ModulePass {
+    static char ID;
+
+    CoalesceChecks() : ModulePass(ID) {}
+
+    virtual bool runOnModule(llvm::Module &M);
+
+    virtual void getAnalysisUsage(llvm::AnalysisUsage& AU) const;
+
+private:
+    SCIPass *SCI;
+    // Callback checks to erase at the end of runOnModule
+    std::set<llvm::Instruction*> RemovedCalls;
+
+    // The checks that run whenever Start does, in execution order. CheckOf
+    // maps the branches and callback calls of each check to the check.
+    std::vector<llvm::Instruction*> getStraightLineChecks(llvm::Instruction *Start,
+            const std::map<llvm::Instruction*, llvm::Instruction*> &CheckOf);
+    unsigned coalesceFunction(llvm::Function &F);
+};
+
+#endif
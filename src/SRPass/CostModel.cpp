@@ -469,6 +469,14 @@ unsigned getInstructionCost(const Instruction *I,
       return TTI->getIntrinsicInstrCost(II->getIntrinsicID(), II->getType(),
                                         Args, FMF);
     }
+    // Direct calls, e.g. ASan callback checks such as __asan_load4
+    if (const Function *F = cast<CallInst>(I)->getCalledFunction()) {
+      SmallVector<Type *, 4> Tys;
+      for (const Use &U : cast<CallInst>(I)->args())
+        Tys.push_back(U->getType());
+      return TTI->getCallInstrCost(const_cast<Function *>(F), I->getType(),
+                                   Tys);
+    }
     return -1;
   default:
     // We don't have any information on this instruction.
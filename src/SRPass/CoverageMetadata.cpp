@@ -0,0 +1,177 @@
+// This file is part of ASAP.
+// Please see LICENSE.txt for copyright and licensing information.
+
+#include "CoverageMetadata.h"
+#include "SCIPass.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DebugInfoMetadata.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Metadata.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <cstdio>
+#include <tuple>
+#include <vector>
+#define DEBUG_TYPE "sr-annotate"
+
+using namespace llvm;
+
+static cl::opt<std::string>
+AnnotateSCOV("annotate-scov", cl::desc("<input scov file>"), cl::init(""), cl::Hidden);
+
+static cl::opt<std::string>
+AnnotateUCOV("annotate-ucov", cl::desc("<input ucov file>"), cl::init(""), cl::Hidden);
+
+static const char *const CoverageKind = "sr.cov";
+
+void attachCoverage(Instruction *Inst, uint64_t ID, uint64_t LB, uint64_t RB, StringRef TU) {
+    LLVMContext &Ctx = Inst->getContext();
+    Type *Int64Ty = Type::getInt64Ty(Ctx);
+    Metadata *Ops[] = {
+        ConstantAsMetadata::get(ConstantInt::get(Int64Ty, ID)),
+        ConstantAsMetadata::get(ConstantInt::get(Int64Ty, LB)),
+        ConstantAsMetadata::get(ConstantInt::get(Int64Ty, RB)),
+        MDString::get(Ctx, TU)
+    };
+    Inst->setMetadata(CoverageKind, MDNode::get(Ctx, Ops));
+}
+
+static uint64_t getCoverageField(MDNode *MD, unsigned i) {
+    return mdconst::extract<ConstantInt>(MD->getOperand(i))->getZExtValue();
+}
+
+bool CoverageAnnotator::runOnModule(Module &M) {
+    SCIPass *SCI = &getAnalysis<SCIPass>();
+    struct {
+        uint64_t id;
+        uint64_t count[3];
+    } BrInfo;
+
+    FILE *fp_sc = fopen(AnnotateSCOV.c_str(), "rb");
+    FILE *fp_uc = fopen(AnnotateUCOV.c_str(), "rb");
+    if (fp_sc == NULL || fp_uc == NULL) {
+        errs() << "sr-annotate: no coverage for " << M.getSourceFileName() << "\n";
+        if (fp_sc) {
+            fclose(fp_sc);
+        }
+        if (fp_uc) {
+            fclose(fp_uc);
+        }
+        return false;
+    }
+
+    // Records are read in the order DCC numbered the checks of this TU
+    uint64_t NumSC = 0, NumUC = 0;
+    for (Function &F: M) {
+        for (Instruction *Inst: SCI->getSanityChecks(&F)) {
+            if (fread(&BrInfo, sizeof(BrInfo), 1, fp_sc) != 1) {
+                break;
+            }
+            attachCoverage(Inst, BrInfo.id, BrInfo.count[1], BrInfo.count[2], M.getSourceFileName());
+            NumSC += 1;
+        }
+        for (Instruction *Inst: SCI->getUCBranches(&F)) {
+            if (fread(&BrInfo, sizeof(BrInfo), 1, fp_uc) != 1) {
+                break;
+            }
+            attachCoverage(Inst, BrInfo.id, BrInfo.count[1], BrInfo.count[2], M.getSourceFileName());
+            NumUC += 1;
+        }
+    }
+    fclose(fp_sc);
+    fclose(fp_uc);
+    LLVM_DEBUG(dbgs() << "Annotated " << NumSC << " SCs and " << NumUC << " UCs of " << M.getSourceFileName() << "\n");
+    return NumSC + NumUC > 0;
+}
+
+void CoverageAnnotator::getAnalysisUsage(AnalysisUsage& AU) const {
+    AU.addRequired<SCIPass>();
+    AU.setPreservesAll();
+}
+
+void CoverageRecords::collect(Module &M, SCIPass *SCI) {
+    Copies.clear();
+    SplitSites.clear();
+    NumShared = 0;
+    std::vector<Instruction*> Annotated;
+    for (Function &F: M) {
+        for (Instruction *Inst: SCI->getSanityChecks(&F)) {
+            if (MDNode *MD = Inst->getMetadata(CoverageKind)) {
+                Copies[MD] += 1;
+                Annotated.push_back(Inst);
+            }
+        }
+        for (Instruction *Inst: SCI->getUCBranches(&F)) {
+            if (MDNode *MD = Inst->getMetadata(CoverageKind)) {
+                Copies[MD] += 1;
+                Annotated.push_back(Inst);
+            }
+        }
+    }
+    for (auto &Record: Copies) {
+        if (Record.second > 1) {
+            NumShared += Record.second;
+        }
+    }
+
+    // Number the split sites of the copies of shared records
+    typedef std::tuple<Function*, DILocation*, unsigned> Site;
+    std::map<Site, unsigned> SiteIDs;
+    std::map<std::pair<MDNode*, unsigned>, unsigned> CopiesAtSite;
+    for (Instruction *Inst: Annotated) {
+        MDNode *MD = Inst->getMetadata(CoverageKind);
+        unsigned NumCopies = Copies[MD];
+        if (NumCopies == 1) {
+            continue;
+        }
+        Site S(Inst->getFunction(), Inst->getDebugLoc() ? Inst->getDebugLoc()->getInlinedAt() : nullptr, NumCopies);
+        auto It = SiteIDs.insert(std::make_pair(S, SiteIDs.size() + 1)).first;
+        SplitSites[Inst] = It->second;
+        CopiesAtSite[std::make_pair(MD, It->second)] += 1;
+    }
+    // Copies that cannot be told apart from another copy of their record
+    for (Instruction *Inst: Annotated) {
+        auto It = SplitSites.find(Inst);
+        if (It != SplitSites.end() && CopiesAtSite[std::make_pair(Inst->getMetadata(CoverageKind), It->second)] > 1) {
+            SplitSites.erase(It);
+        }
+    }
+}
+
+unsigned CoverageRecords::getSplitSite(Instruction *Inst) const {
+    auto It = SplitSites.find(Inst);
+    return It == SplitSites.end() ? 0 : It->second;
+}
+
+bool CoverageRecords::get(Instruction *Inst, uint64_t Count[3]) const {
+    Count[0] = Count[1] = Count[2] = 0;
+    MDNode *MD = Inst->getMetadata(CoverageKind);
+    if (!MD) {
+        return false;
+    }
+    auto It = Copies.find(MD);
+    if (It == Copies.end()) {
+        return false;
+    }
+    uint64_t NumCopies = It->second;
+    if (NumCopies > 1 && getSplitSite(Inst) == 0) {
+        return false;
+    }
+    uint64_t LB = getCoverageField(MD, 1);
+    uint64_t RB = getCoverageField(MD, 2);
+    if (LB % NumCopies != 0 || RB % NumCopies != 0) {
+        return false;
+    }
+    Count[1] = LB / NumCopies;
+    Count[2] = RB / NumCopies;
+    Count[0] = Count[1] + Count[2];
+    return true;
+}
+
+char CoverageAnnotator::ID = 0;
+static RegisterPass<CoverageAnnotator> X("sr-annotate",
+        "Attaches coverage records to sanity checks and user checks", false, false);
@@ -0,0 +1,75 @@
+// This file is part of ASAP.
+// Please see LICENSE.txt for copyright and licensing information.
+
+#ifndef SRPASS_COVERAGEMETADATA_H
+#define SRPASS_COVERAGEMETADATA_H
+
+#include "llvm/Pass.h"
+
+#include <cstdint>
+#include <map>
+
+namespace llvm {
+    class Instruction;
+    class MDNode;
+    class Module;
+    class StringRef;
+}
+
+struct SCIPass;
+
+// Coverage records of sanity checks and user checks can be attached to the
+// branches themselves as !sr.cov metadata. Each record holds the check's id
+// in its TU's profile, its two branch counts, and the TU it was profiled in.
+// Unlike the per-TU profile files, whose records are read in the order DCC
+// numbered the checks, the records survive llvm-link and are cloned along
+// with the checks they belong to, so a merged module can be reduced as a
+// whole.
+void attachCoverage(llvm::Instruction *Inst, uint64_t ID, uint64_t LB, uint64_t RB, llvm::StringRef TU);
+
+// Annotates every SC and UC of a TU with its record from the -annotate-scov
+// and -annotate-ucov profiles.
+struct CoverageAnnotator : public llvm::ModulePass {
+    static char ID;
+
+    CoverageAnnotator() : ModulePass(ID) {}
+
+    virtual bool runOnModule(llvm::Module &M);
+
+    virtual void getAnalysisUsage(llvm::AnalysisUsage& AU) const;
+};
+
+// The records of a merged module. A record that inlining has copied to
+// several checks counts all of its copies together, and how the count is
+// divided among them was never measured. Its counts are split evenly among
+// the copies, but a split count is made up, so it is only compared with
+// counts split the same way at the same place: two copies inlined at one
+// call site, from records shared by the same number of copies, match
+// exactly when the records they were split from do. Each copy is tagged
+// with its split site, the function and inlined-at location it was inlined
+// to together with the number of copies, and checks only match checks with
+// the same tag. A check whose record does not divide evenly, or whose
+// split site holds two copies of its record, as happens without debug
+// locations, stays unprofiled.
+class CoverageRecords {
+public:
+    void collect(llvm::Module &M, SCIPass *SCI);
+
+    // Fills Count like a profile record (total, left, right) with the
+    // check's share of its record; returns false and zero counts if the
+    // check has no record or the record cannot be split
+    bool get(llvm::Instruction *Inst, uint64_t Count[3]) const;
+
+    // The split site of a check with a split record, 0 for a check with a
+    // record of its own. Only checks with the same split site may match.
+    unsigned getSplitSite(llvm::Instruction *Inst) const;
+
+    unsigned getNumShared() const { return NumShared; }
+
+private:
+    std::map<llvm::MDNode*, unsigned> Copies;
+    std::map<llvm::Instruction*, unsigned> SplitSites;
+    unsigned NumShared = 0;
+};
+
+#endif
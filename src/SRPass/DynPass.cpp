@@ -4,6 +4,7 @@
 #include "DynPass.h"
 #include "SCIPass.h"
 #include "utils.h"
+#include "PatternIndex.h"
 #include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/Function.h"
@@ -38,6 +39,8 @@ InputLOGG("logg", cl::desc("<input log file>"), cl::init(""), cl::Hidden);
 
 bool DynPass::runOnModule(Module &m) {
     SCI = &getAnalysis<SCIPass>();
+    VN.clear();
+    MemoryLocs.clear();
     std::string filename = m.getSourceFileName();
     filename = filename.substr(0, filename.rfind("."));
     
@@ -56,7 +59,7 @@ bool DynPass::runOnModule(Module &m) {
 
     std::map<Instruction*, Info> SC_Stat;
     std::map<Instruction*, Info> UC_Stat;
-    std::map<uint64_t, std::vector<stat>> SC_Pattern, SC_Pattern_opt;
+    PatternIndex<stat> SC_Pattern, SC_Pattern_opt;
     std::map<uint64_t, uint64_t> reducedSC;
     int count = 0;
     // for (Function &F: m) {
@@ -83,10 +86,10 @@ bool DynPass::runOnModule(Module &m) {
 
     // Start reading and storing SC coverage records from InputSCOV
     for (Function &F: m) {
-        for (Instruction *Inst: SCI->getSCBranches(&F)) {
+        for (Instruction *Inst: SCI->getSanityChecks(&F)) {
             assert(Inst->getParent()->getParent() == &F && "SCI must only contain instructions of the current function.");
             BranchInst *BI = dyn_cast<BranchInst>(Inst);
-            assert(BI && BI->isConditional() && "SCBranches must not contain instructions that aren't conditional branches.");
+            assert(((BI && BI->isConditional()) || isa<CallInst>(Inst)) && "Sanity checks must be conditional branches or callback checks.");
             fread(&BrInfo, sizeof(BrInfo), 1, fp_sc);
             // Revise the coverage pattern of SC
             // errs() <<"SC:"<<BrInfo.id << ":"<< BrInfo.count[0] <<":"<< BrInfo.count[1] <<":"<< BrInfo.count[2] << "\n";
@@ -107,7 +110,7 @@ bool DynPass::runOnModule(Module &m) {
             SC_Info.LB = BrInfo.count[1];
             SC_Info.RB = BrInfo.count[2];
             SC_Info.SC = Inst;
-            SC_Pattern[BrInfo.count[0]].push_back(SC_Info);
+            SC_Pattern.insert(SC_Info.LB, SC_Info.RB, SC_Info);
             flagSC += 1;
             costflagSC += BrInfo.count[0];
         }
@@ -134,9 +137,9 @@ bool DynPass::runOnModule(Module &m) {
             costflagUC += BrInfo.count[0];
             // For each instruction in UCBranch, check whether its coverage pattern matches certain patterns in SC_Pattern
 
-            if (SC_Pattern.count(BrInfo.count[0]) > 0 && BrInfo.count[0] > 0) {
+            if (SC_Pattern.hasTotal(BrInfo.count[0]) && BrInfo.count[0] > 0) {
                 // If UC and SC have ompletely the same dynamic pattern A+B:A:B
-                for (stat Info: SC_Pattern[BrInfo.count[0]]) {
+                for (const stat &Info: SC_Pattern.lookup(BrInfo.count[1], BrInfo.count[2])) {
                     if (findPhiInst(Inst, Info.SC)  && reducedSC.count(Info.id) == 0 && false) {
                         optimizeCheckAway(Info.SC);
                         errs() << "Reduced::UC:" << BrInfo.id<<"SC:"<<Info.id <<":"<< BrInfo.count[0]<<"--------\n";
@@ -144,7 +147,7 @@ bool DynPass::runOnModule(Module &m) {
                         costflagSC_opt -= BrInfo.count[0];
                         reducedSC[Info.id] = BrInfo.count[0];
                     }
-                    else if ((Info.LB == BrInfo.count[1] && Info.RB == BrInfo.count[2]) || (Info.LB == BrInfo.count[2] && Info.RB == BrInfo.count[1])) {
+                    else if (PatternIndex<stat>::matches(Info.LB, Info.RB, BrInfo.count[1], BrInfo.count[2])) {
                         // If UC and SC operate the same variable
                         // errs() << "TTT"<<Info.id << "---";
 
@@ -158,32 +161,28 @@ bool DynPass::runOnModule(Module &m) {
                     }
                 }
             }
-            else if (SC_Pattern.count(BrInfo.count[1]) > 0 && BrInfo.count[1] > 0) {
+            else if (SC_Pattern.hasTotal(BrInfo.count[1]) && BrInfo.count[1] > 0) {
                 // UC has pattern A+B:A:B, while SC has pattern A:A:0
-                for (stat Info: SC_Pattern[BrInfo.count[1]]) {
-                    if (Info.LB == 0 || Info.RB == 0) {
-                        // If UC and SC operate the same variable
-                        if (findSameSourceS(Info.SC, Inst, BrInfo.id, Info.id, 0) && reducedSC.count(Info.id) == 0) {
-                            optimizeCheckAway(Info.SC);
-                            errs() << "Reduced::UC:" << BrInfo.id<<"SC:"<<Info.id <<":"<< BrInfo.count[1]<<"--------\n";
-                            flagSC_opt -= 1;
-                            costflagSC_opt -= BrInfo.count[1];
-                            reducedSC[Info.id] = BrInfo.count[1];
-                        }
+                for (const stat &Info: SC_Pattern.lookupOneSided(BrInfo.count[1])) {
+                    // If UC and SC operate the same variable
+                    if (findSameSourceS(Info.SC, Inst, BrInfo.id, Info.id, 0) && reducedSC.count(Info.id) == 0) {
+                        optimizeCheckAway(Info.SC);
+                        errs() << "Reduced::UC:" << BrInfo.id<<"SC:"<<Info.id <<":"<< BrInfo.count[1]<<"--------\n";
+                        flagSC_opt -= 1;
+                        costflagSC_opt -= BrInfo.count[1];
+                        reducedSC[Info.id] = BrInfo.count[1];
                     }
                 }
             }
-            else if (SC_Pattern.count(BrInfo.count[2]) > 0 && BrInfo.count[2] > 0) {
+            else if (SC_Pattern.hasTotal(BrInfo.count[2]) && BrInfo.count[2] > 0) {
                 // UC has pattern A+B:A:B, while SC has pattern B:B:0
-                for (stat Info: SC_Pattern[BrInfo.count[2]]) {
-                    if (Info.LB == 0 || Info.RB == 0){
-                        if (findSameSourceS(Info.SC, Inst, BrInfo.id, Info.id, 0) && reducedSC.count(Info.id) == 0) {
-                            optimizeCheckAway(Info.SC);
-                            errs() << "Reduced::UC:" << BrInfo.id<<"SC:"<<Info.id <<":"<< BrInfo.count[1]<< "--------\n";
-                            flagSC_opt -= 1;
-                            costflagSC_opt -= BrInfo.count[2];
-                            reducedSC[Info.id] = BrInfo.count[2];
-                        }
+                for (const stat &Info: SC_Pattern.lookupOneSided(BrInfo.count[2])) {
+                    if (findSameSourceS(Info.SC, Inst, BrInfo.id, Info.id, 0) && reducedSC.count(Info.id) == 0) {
+                        optimizeCheckAway(Info.SC);
+                        errs() << "Reduced::UC:" << BrInfo.id<<"SC:"<<Info.id <<":"<< BrInfo.count[1]<< "--------\n";
+                        flagSC_opt -= 1;
+                        costflagSC_opt -= BrInfo.count[2];
+                        reducedSC[Info.id] = BrInfo.count[2];
                     }
                 }
             }
@@ -202,10 +201,10 @@ bool DynPass::runOnModule(Module &m) {
     fp_sc = fopen(Twine(InputSCOV).str().c_str(), "rb");
     uint64_t tmp = 0;
     for (Function &F: m) {
-        for (Instruction *Inst: SCI->getSCBranches(&F)) {
+        for (Instruction *Inst: SCI->getSanityChecks(&F)) {
             assert(Inst->getParent()->getParent() == &F && "SCI must only contain instructions of the current function.");
             BranchInst *BI = dyn_cast<BranchInst>(Inst);
-            assert(BI && BI->isConditional() && "SCBranches must not contain instructions that aren't conditional branches.");
+            assert(((BI && BI->isConditional()) || isa<CallInst>(Inst)) && "Sanity checks must be conditional branches or callback checks.");
             fread(&BrInfo, sizeof(BrInfo), 1, fp_sc);
             // errs() <<"SC:"<<BrInfo.id << ":"<< BrInfo.count[0] <<":"<< BrInfo.count[1] <<":"<< BrInfo.count[2] << "\n";
 
@@ -214,23 +213,21 @@ bool DynPass::runOnModule(Module &m) {
             // Set a flag to record whether the SC can be reduced
             is_reduced = false;
             // For each instruction in SCBranch, check whether its dynamic pattern matches certain patterns in SC_Pattern_opt
-            if (SC_Pattern.count(BrInfo.count[0]) > 0 && BrInfo.count[0] > 0) {
+            if (SC_Pattern.hasTotal(BrInfo.count[0]) && BrInfo.count[0] > 0) {
                 // New SC and existing SC have ompletely the same dynamic pattern A+B:A:B
                 // Check all SCs in SC_Pattern_opt
-                for (stat Info: SC_Pattern[BrInfo.count[0]]) {
-                    if (BrInfo.count[1] == Info.LB || BrInfo.count[2] == Info.LB) {
-                        // Also the same operation variable 
-                        // errs() << tmp << ":"<<Info.id << "---";
-
-                        if (BrInfo.id != Info.id && findSameSourceS(Inst, Info.SC, BrInfo.id, Info.id, 1)) {
-                            is_reduced = true;
-                            if (reducedSC.count(BrInfo.id) == 0) {
-                                optimizeCheckAway(Inst);
-                                errs() << "Reduced::SC:" << BrInfo.id<<"SC:"<<Info.id <<":"<< BrInfo.count[0]<< "--------\n";
-                                flagSC_opts -= 1;
-                                costflagSC_opts -= BrInfo.count[0];
-                                reducedSC[BrInfo.id] = BrInfo.count[0];
-                            }
+                for (const stat &Info: SC_Pattern.lookup(BrInfo.count[1], BrInfo.count[2])) {
+                    // Also the same operation variable 
+                    // errs() << tmp << ":"<<Info.id << "---";
+
+                    if (BrInfo.id != Info.id && findSameSourceS(Inst, Info.SC, BrInfo.id, Info.id, 1)) {
+                        is_reduced = true;
+                        if (reducedSC.count(BrInfo.id) == 0) {
+                            optimizeCheckAway(Inst);
+                            errs() << "Reduced::SC:" << BrInfo.id<<"SC:"<<Info.id <<":"<< BrInfo.count[0]<< "--------\n";
+                            flagSC_opts -= 1;
+                            costflagSC_opts -= BrInfo.count[0];
+                            reducedSC[BrInfo.id] = BrInfo.count[0];
                         }
                     }
                 }
@@ -244,7 +241,7 @@ bool DynPass::runOnModule(Module &m) {
                 SC_Info.LB = BrInfo.count[1];
                 SC_Info.RB = BrInfo.count[2];
                 SC_Info.SC = Inst;
-                // SC_Pattern_opt[BrInfo.count[0]].push_back(SC_Info);
+                // SC_Pattern_opt.insert(SC_Info.LB, SC_Info.RB, SC_Info);
                 if (reducedSC.count(BrInfo.id) == 0) {
                     test1 += 1;
                     test2 += BrInfo.count[0];
@@ -279,6 +276,8 @@ bool DynPass::runOnModule(Module &m) {
     fprintf(fpp, "%s %lu %lu %lu %lu %lu %lu\n", filename.c_str(), flagSC, flagSC_opt,flagSC_opts,costflagSC,costflagSC_opt,costflagSC_opts);
     fclose(fpp);
     }
+    Facts.apply();
+    eraseCallbackChecks(RemovedCalls);
     return true;
 }
 
@@ -310,7 +309,7 @@ bool DynPass::findSameSourceS(Instruction *B1, Instruction *B2, uint64_t id1, ui
         name1 = C1->getOpcodeName();
         name2 = C2->getOpcodeName();
     }
-    if (C1 == C2) {
+    if (VN.equal(C1, C2)) {
         return true;
     }
     else if (name1 == name2 && name1 !="phi" && C1->getNumOperands() == C2->getNumOperands() && C1->getNumOperands() != 0) {
@@ -334,16 +333,23 @@ bool DynPass::findSameSourceS(Instruction *B1, Instruction *B2, uint64_t id1, ui
 }
 
 bool DynPass::findSameSource(llvm::Instruction *BI1, llvm::Instruction *BI2, uint64_t id1, uint64_t id2, uint64_t flag) {
-    std::set<Value*> FClist1 = TrackMemoryLoc(BI1, id1);
-    std::set<Value*> FClist2 = TrackMemoryLoc(BI2, id2);
+    const std::set<Value*> &FClist1 = TrackMemoryLoc(BI1);
+    const std::set<Value*> &FClist2 = TrackMemoryLoc(BI2);
     return SameMemoryLoc(FClist1, FClist2, id1, id2);
 }
 
-std::set<Value*> DynPass::TrackMemoryLoc(Instruction *C, uint64_t id) {
+// The memory locations a branch or instruction depends on. They are tracked
+// once per instruction and kept until the instruction is changed.
+const std::set<Value*> &DynPass::TrackMemoryLoc(Instruction *C) {
+    auto It = MemoryLocs.find(C);
+    if (It != MemoryLocs.end()) {
+        return It->second;
+    }
     std::set<Instruction*> Clist;
-    std::set<Value*> FClist;
+    std::set<Instruction*> Visited;
+    std::set<Value*> &FClist = MemoryLocs[C];
     Instruction *Inst;
-    if (BranchInst *BI = dyn_cast<BranchInst>(C)) {
+    if (isa<BranchInst>(C)) {
         if (Instruction *Op=dyn_cast<Instruction>(C->getOperand(0))) {
             Clist.insert(Op);
         }
@@ -351,11 +357,10 @@ std::set<Value*> DynPass::TrackMemoryLoc(Instruction *C, uint64_t id) {
     else {
         bool is_end = true;
         for (Use &U: C->operands()) {
-            if (Instruction *Op = dyn_cast<Instruction>(U.get())) {
+            if (isa<Instruction>(U.get())) {
                 is_end = false;
             }
         }
-        StringRef OpName = C->getOpcodeName();
         if (!is_end) {
             Clist.insert(C);
         }
@@ -366,10 +371,13 @@ std::set<Value*> DynPass::TrackMemoryLoc(Instruction *C, uint64_t id) {
     while (Clist.size()!=0) {
         Inst = *Clist.begin(); 
         Clist.erase(Inst);           
+        if (!Visited.insert(Inst).second) {
+            continue;
+        }
         OpName = Inst->getOpcodeName();
         bool is_end = true;
         for (Use &U: Inst->operands()) {
-            if (Instruction *Op = dyn_cast<Instruction>(U.get())) {
+            if (isa<Instruction>(U.get())) {
                 is_end = false;
             }
         }
@@ -381,7 +389,7 @@ std::set<Value*> DynPass::TrackMemoryLoc(Instruction *C, uint64_t id) {
                 if (Instruction *I = dyn_cast<Instruction>(U.get())) {
                     Clist.insert(I);
                 }
-                else if (Constant *C = dyn_cast<Constant>(U.get())) {
+                else if (isa<Constant>(U.get())) {
                     // Do nothing
                     // FClist.insert(U.get());
                 }
@@ -397,13 +405,11 @@ std::set<Value*> DynPass::TrackMemoryLoc(Instruction *C, uint64_t id) {
     return FClist;
 }
 
-bool DynPass::SameMemoryLoc(std::set<Value*> FClist1, std::set<Value*> FClist2, uint64_t id1, uint64_t id2) {
+bool DynPass::SameMemoryLoc(const std::set<Value*> &FClist1, const std::set<Value*> &FClist2, uint64_t id1, uint64_t id2) {
     bool flag = false;
     if (FClist1.size() <= FClist2.size() && FClist1.size() > 0) {
-        while (!FClist1.empty()) {
+        for (Value *FC: FClist1) {
             flag = false;
-            Value *FC = *FClist1.begin();
-            FClist1.erase(FC);
             for (std::set<Value*>::iterator I=FClist2.begin(); I!=FClist2.end(); ++I) {
                 if (FC == *I) {
                     // Find same Value in FClist2, exit FOR loop, flag = true
@@ -488,7 +494,7 @@ bool DynPass::SameMemoryLoc(std::set<Value*> FClist1, std::set<Value*> FClist2,
                                     if (Instruction *SubOp2 = dyn_cast<Instruction>(Op2->getOperand(i))) {
                                         std::set<Value*> SubFClist1;
                                         SubFClist1.insert(Op1->getOperand(i));
-                                        std::set<Value*> SubFClist2 = TrackMemoryLoc(SubOp2, id2);
+                                        const std::set<Value*> &SubFClist2 = TrackMemoryLoc(SubOp2);
                                         if (SubFClist2.count(Op1->getOperand(i)) == 0) {
                                             flag = false;
                                             break;
@@ -614,23 +620,20 @@ bool DynPass::findPhiInst(Instruction *UC_Inst, Instruction *SC_Inst) {
 
 // Tries to remove a sanity check; returns true if it worked.
 void DynPass::optimizeCheckAway(Instruction *Inst) {
+    Facts.add(Inst, SCI);
+    if (isa<CallInst>(Inst)) {
+        // Callback checks are erased once matching is done, since the later
+        // phases still look at the operands of removed checks.
+        RemovedCalls.insert(Inst);
+        return;
+    }
     BranchInst *BI = cast<BranchInst>(Inst);
     assert(BI->isConditional() && "Sanity check must be conditional branch.");
-    
-    unsigned int RegularBranch = getRegularBranch(BI, SCI);
-    
-    bool Changed = false;
-    if (RegularBranch == 0) {
-        BI->setCondition(ConstantInt::getTrue(Inst->getContext()));
-        Changed = true;
-    } else if (RegularBranch == 1) {
-        BI->setCondition(ConstantInt::getFalse(Inst->getContext()));
-        Changed = true;
-    } else {
-        dbgs() << "Warning: Sanity check with no regular branch found.\n";
-        dbgs() << "The sanity check has been kept intact.\n";
-    }
-    // return Changed;
+    MemoryLocs.erase(BI);
+
+    // Folds every branch of the check, including the fast path in front of
+    // ASan's partial-granule slow path
+    foldSanityCheck(BI, SCI);
 }
 
 
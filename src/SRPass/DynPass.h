@@ -2,6 +2,8 @@
 // Please see LICENSE.txt for copyright and licensing information.
 
 #include "llvm/Pass.h"
+#include "ValueNumbering.h"
+#include "CheckFacts.h"
 
 #include <utility>
 #include <vector>
@@ -36,10 +38,17 @@ struct DynPass : public llvm::ModulePass {
     bool findPhiInst(llvm::Instruction *UC_Inst, llvm::Instruction *SC_Inst);
     bool findSameSource(llvm::Instruction *BI1, llvm::Instruction *BI2, uint64_t id1, uint64_t id2, uint64_t flag);
     bool reduceInstByCheck(llvm::Instruction *Inst);
-    std::set<llvm::Value*> TrackMemoryLoc(llvm::Instruction *C, uint64_t id);
-    bool SameMemoryLoc(std::set<llvm::Value*> FClist1, std::set<llvm::Value*> FClist2, uint64_t id1, uint64_t id2);
+    const std::set<llvm::Value*> &TrackMemoryLoc(llvm::Instruction *C);
+    bool SameMemoryLoc(const std::set<llvm::Value*> &FClist1, const std::set<llvm::Value*> &FClist2, uint64_t id1, uint64_t id2);
     bool findSameSourceS(llvm::Instruction *C1, llvm::Instruction *C2, uint64_t id1, uint64_t id2, uint64_t flag);
 private:
 
     SCIPass *SCI;
+    ValueNumbering VN;
+    // Callback checks to erase at the end of runOnModule
+    std::set<llvm::Instruction*> RemovedCalls;
+    // What the removed checks established, with -check-facts
+    CheckFacts Facts;
+    // Memoised results of TrackMemoryLoc
+    std::map<llvm::Instruction*, std::set<llvm::Value*>> MemoryLocs;
 };
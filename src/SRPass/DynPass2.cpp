@@ -4,6 +4,11 @@
 #include "DynPass2.h"
 #include "SCIPass.h"
 #include "utils.h"
+#include "PatternIndex.h"
+#include "MergeJoin.h"
+#include "SourceSignature.h"
+#include "SameLocation.h"
+#include "CoverageMetadata.h"
 #include "CostModel.h"
 #include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/IR/Constants.h"
@@ -14,12 +19,16 @@
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/Format.h"
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Analysis/MemorySSA.h"
 #include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/IR/Dominators.h"
 
 
 #include <algorithm>
 #include <memory>
 #include <system_error>
+#include <tuple>
 #define DEBUG_TYPE "dynpass2"
 
 using namespace llvm;
@@ -38,9 +47,16 @@ InputLOG("log2", cl::desc("<input log file>"), cl::init(""), cl::Hidden);
 static cl::opt<std::string>
 InputLOGG("logg2", cl::desc("<input log file>"), cl::init(""), cl::Hidden);
 
+static cl::opt<bool>
+ASanSameLocation("asan-same-location", cl::desc("Remove ASan checks of memory a dominating check already covers"), cl::init(false), cl::Hidden);
+
+static cl::opt<bool>
+MergedModule("dyn2-merged", cl::desc("Read coverage from the !sr.cov records of a merged module instead of -scov2/-ucov2"), cl::init(false), cl::Hidden);
+
 
 bool DynPass2::runOnModule(Module &m) {
     SCI = &getAnalysis<SCIPass>();
+    Signatures.clear();
     TargetTransformInfoWrapperPass &TTIWP = getAnalysis<TargetTransformInfoWrapperPass>();
     std::string filename = m.getSourceFileName();
     filename = filename.substr(0, filename.rfind("."));
@@ -56,11 +72,14 @@ bool DynPass2::runOnModule(Module &m) {
         uint64_t LB;
         uint64_t RB;
         Instruction* SC;
+        // Predicate of a fused check, or null for the whole check
+        Use* Sub;
     };
 
     std::map<Instruction*, Info> SC_Stat;
     std::map<Instruction*, Info> UC_Stat;
-    std::map<uint64_t, std::vector<stat>> SC_Pattern, SC_Pattern_opt;
+    PatternIndex<stat> SC_Pattern;
+    std::vector<stat> SC_Records;
     std::map<uint64_t, uint64_t> reducedSC;
     int count = 0;
     // for (Function &F: m) {
@@ -70,28 +89,49 @@ bool DynPass2::runOnModule(Module &m) {
     //     }
     // }
 
-    FILE *fp_sc = fopen(Twine(InputSCOV).str().c_str(), "rb");
-    // errs() << Twine(InputSCOV).str().c_str() << "\n";
-    // assert(fp_sc != NULL && "No valid SCOV file");
-    FILE *fp_uc = fopen(Twine(InputUCOV).str().c_str(), "rb");
-    // assert(fp_uc != NULL && "No valid UCOV file");
-    if (fp_sc != NULL && fp_uc != NULL) {
-    errs() << "DynPass2 on "<<filename << ";" << Twine(InputSCOV).str().c_str() << "\n";
+    FILE *fp_sc = NULL, *fp_uc = NULL;
+    // A merged module carries the records of all its TUs as metadata, and
+    // its checks are numbered afresh in module order
+    CoverageRecords Records;
+    uint64_t NextSC = 0, NextUC = 0;
+    if (MergedModule) {
+        Records.collect(m, SCI);
+    }
+    else {
+        fp_sc = fopen(Twine(InputSCOV).str().c_str(), "rb");
+        // errs() << Twine(InputSCOV).str().c_str() << "\n";
+        // assert(fp_sc != NULL && "No valid SCOV file");
+        fp_uc = fopen(Twine(InputUCOV).str().c_str(), "rb");
+        // assert(fp_uc != NULL && "No valid UCOV file");
+    }
+    auto readRecord = [&](Instruction *Inst, FILE *fp, uint64_t &NextID) {
+        if (!MergedModule) {
+            fread(&BrInfo, sizeof(BrInfo), 1, fp);
+            return;
+        }
+        BrInfo.id = NextID++;
+        Records.get(Inst, BrInfo.count);
+    };
+    if (MergedModule || (fp_sc != NULL && fp_uc != NULL)) {
+    errs() << "DynPass2 on "<<filename << ";" << (MergedModule ? "merged" : Twine(InputSCOV).str().c_str()) << "\n";
+    if (MergedModule) {
+        errs() << "Checks sharing an inlined record: " << Records.getNumShared() << "\n";
+    }
 
     uint64_t flagSC = 0, costflagSC = 0; // Number of SCs
     uint64_t flagUC = 0, costflagUC = 0; // Number of UCs
     uint64_t flagSC_opt = 0, costflagSC_opt = 0; // Number of SCs after the redundant SCs about UCs are reduced
     uint64_t flagSC_opts = 0, costflagSC_opts = 0; // Number of SCs after the redundant SCs about SCs are reduced
     uint64_t test1 = 0, test2 = 0, test3 = 0;
-    bool is_reduced = true;
+    markReportsCold(m);
 
     // Start reading and storing SC coverage records from InputSCOV
     for (Function &F: m) {
-        for (Instruction *Inst: SCI->getSCBranches(&F)) {
+        for (Instruction *Inst: SCI->getSanityChecks(&F)) {
             assert(Inst->getParent()->getParent() == &F && "SCI must only contain instructions of the current function.");
             BranchInst *BI = dyn_cast<BranchInst>(Inst);
-            assert(BI && BI->isConditional() && "SCBranches must not contain instructions that aren't conditional branches.");
-            fread(&BrInfo, sizeof(BrInfo), 1, fp_sc);
+            assert(((BI && BI->isConditional()) || isa<CallInst>(Inst)) && "Sanity checks must be conditional branches or callback checks.");
+            readRecord(Inst, fp_sc, NextSC);
             // Revise the coverage pattern of SC
             // errs() <<"SC:"<<BrInfo.id << ":"<< BrInfo.count[0] <<":"<< BrInfo.count[1] <<":"<< BrInfo.count[2] << "\n";
             BrInfo.count[0] = BrInfo.count[1] + BrInfo.count[2];
@@ -107,6 +147,7 @@ bool DynPass2::runOnModule(Module &m) {
             for (size_t i=0;i<3;i++){
                 SC_Stat[Inst][i] = BrInfo.count[i];
             }
+            setCheckWeights(Inst, BrInfo.count[1], BrInfo.count[2], SCI);
 
             // Store the dynamic patterns of instructions in SCBranches in SC_Pattern (totalCovTime->SC_Info)
             // SC_Info contains id, LB, RB, and *Inst
@@ -115,12 +156,26 @@ bool DynPass2::runOnModule(Module &m) {
             SC_Info.LB = BrInfo.count[1];
             SC_Info.RB = BrInfo.count[2];
             SC_Info.SC = Inst;
-            SC_Pattern[BrInfo.count[0]].push_back(SC_Info);
+            SC_Info.Sub = nullptr;
+            // Each predicate of a fused check is matched on its own, with the
+            // counts of the branch it is fused into
+            const std::vector<Use*> &SubChecks = SCI->getSubChecks(Inst);
+            if (SubChecks.empty()) {
+                SC_Pattern.insert(SC_Info.LB, SC_Info.RB, SC_Info);
+                SC_Records.push_back(SC_Info);
+            }
+            for (Use *Sub: SubChecks) {
+                SC_Info.Sub = Sub;
+                SC_Pattern.insert(SC_Info.LB, SC_Info.RB, SC_Info);
+                SC_Records.push_back(SC_Info);
+            }
             flagSC += 1;
             costflagSC += BrInfo.count[0];
         }
     }
-    fclose(fp_sc);
+    if (fp_sc) {
+        fclose(fp_sc);
+    }
     // Finish reading and storing SC coverage records from InputSCOV
 
     // Start reading and storing UC coverage records from InputUCOV
@@ -128,15 +183,35 @@ bool DynPass2::runOnModule(Module &m) {
     // For each SC in SC_Pattern, if its coverage pattern matches that of UC
     // And if the variable it operates is the same as that operated by UC
     // Then, the SC can be reduced.
+    // With exact count matching, the UCs are collected as probes and joined
+    // with the SCs by sort-merge; a count tolerance probes SC_Pattern instead
     flagSC_opt = flagSC;
     costflagSC_opt = costflagSC;
     errs() <<flagSC <<":"<<costflagSC << "----\n";
+    bool JoinUCs = CountTolerance::isExact();
+    struct ucprobe{
+        uint64_t id;
+        uint64_t Count;
+        Instruction* UC;
+    };
+    std::vector<JoinEntry<ucprobe>> UC_Probes;
+    // Reduces the SC if it has the same source as the UC
+    auto reduceByUC = [&](Instruction *UC, uint64_t UCId, const stat &Info, uint64_t Count) {
+        Instruction *Src = getCheckSource(Info.SC, Info.Sub);
+        if (Src && reducedSC.count(Info.id) == 0 && Records.getSplitSite(UC) == Records.getSplitSite(Info.SC) &&
+            findPhiInst(UC, Src) && reduceSanityCheck(Info.SC, Info.Sub)) {
+            errs() << "Reduced::UC:" << UCId<<"SC:"<<Info.id <<":"<< Count<<"--------\n";
+            flagSC_opt -= 1;
+            costflagSC_opt -= Count;
+            reducedSC[Info.id] = Count;
+        }
+    };
     for (Function &F: m) {
         for (Instruction *Inst: SCI->getUCBranches(&F)) {
             assert(Inst->getParent()->getParent() == &F && "SCI must only contain instructions of the current function.");
             BranchInst *BI = dyn_cast<BranchInst>(Inst);
             assert(BI && BI->isConditional() && "UCBranches must not contain instructions that aren't conditional branches.");
-            fread(&BrInfo, sizeof(BrInfo), 1, fp_uc);
+            readRecord(Inst, fp_uc, NextUC);
 
             flagUC += 1;
             costflagUC += BrInfo.count[0];
@@ -147,135 +222,234 @@ bool DynPass2::runOnModule(Module &m) {
             if (BrInfo.id >= 28 && BrInfo.id <= 37) {
                 errs() << "UC:" << BrInfo.id << ":" << BrInfo.count[0] << ":" << BrInfo.count[1] << ":" << BrInfo.count[2] << "\n";
             }
-            if (SC_Pattern.count(BrInfo.count[0]) > 0 && BrInfo.count[0] > 0) {
+            // The SC pattern the UC is matched against
+            uint64_t Total, Low, High;
+            bool OneSided = false;
+            if (SC_Pattern.hasTotal(BrInfo.count[0]) && BrInfo.count[0] > 0) {
                 // If UC and SC have ompletely the same dynamic pattern A+B:A:B
-                for (stat Info: SC_Pattern[BrInfo.count[0]]) {
-                    if ((Info.LB == BrInfo.count[1] && Info.RB == BrInfo.count[2]) || (Info.LB == BrInfo.count[2] && Info.RB == BrInfo.count[1])) {
-                        // If UC and SC operate the same variable
-                        // errs() << "TTT"<<Info.id << "---";
-                        if (findPhiInst(Inst, Info.SC,BrInfo.id,Info.id) && reducedSC.count(Info.id) == 0) {
-                            optimizeCheckAway(Info.SC);
-                            errs() << "Reduced::UC:" << BrInfo.id<<"SC:"<<Info.id <<":"<< BrInfo.count[0]<<"--------\n";
-                            flagSC_opt -= 1;
-                            costflagSC_opt -= BrInfo.count[0];
-                            reducedSC[Info.id] = BrInfo.count[0];
-                        }
-                    }
-                }
+                Total = BrInfo.count[0];
+                Low = std::min(BrInfo.count[1], BrInfo.count[2]);
+                High = std::max(BrInfo.count[1], BrInfo.count[2]);
             }
-            else if (SC_Pattern.count(BrInfo.count[1]) > 0 && BrInfo.count[1] > 0) {
+            else if (SC_Pattern.hasTotal(BrInfo.count[1]) && BrInfo.count[1] > 0) {
                 // UC has pattern A+B:A:B, while SC has pattern A:A:0
-                for (stat Info: SC_Pattern[BrInfo.count[1]]) {
-                    if (Info.LB == 0 || Info.RB == 0) {
-                        // If UC and SC operate the same variable
-                        if (findPhiInst(Inst, Info.SC,BrInfo.id,Info.id) && reducedSC.count(Info.id) == 0) {
-                            optimizeCheckAway(Info.SC);
-                            errs() << "Reduced::UC:" << BrInfo.id<<"SC:"<<Info.id <<":"<< BrInfo.count[1]<<"--------\n";
-                            flagSC_opt -= 1;
-                            costflagSC_opt -= BrInfo.count[1];
-                            reducedSC[Info.id] = BrInfo.count[1];
-                        }
-                    }
-                }
+                Total = High = BrInfo.count[1];
+                Low = 0;
+                OneSided = true;
             }
-            else if (SC_Pattern.count(BrInfo.count[2]) > 0 && BrInfo.count[2] > 0) {
+            else if (SC_Pattern.hasTotal(BrInfo.count[2]) && BrInfo.count[2] > 0) {
                 // UC has pattern A+B:A:B, while SC has pattern B:B:0
-                for (stat Info: SC_Pattern[BrInfo.count[2]]) {
-                    if (Info.LB == 0 || Info.RB == 0){
-                        if (findPhiInst(Inst, Info.SC, BrInfo.id,Info.id) && reducedSC.count(Info.id) == 0) {
-                            optimizeCheckAway(Info.SC);
-                            errs() << "Reduced::UC:" << BrInfo.id<<"SC:"<<Info.id <<":"<< BrInfo.count[1]<< "--------\n";
-                            flagSC_opt -= 1;
-                            costflagSC_opt -= BrInfo.count[2];
-                            reducedSC[Info.id] = BrInfo.count[2];
-                        }
-                    }
+                Total = High = BrInfo.count[2];
+                Low = 0;
+                OneSided = true;
+            }
+            else {
+                continue;
+            }
+            if (JoinUCs) {
+                const SourceSignature &Sig = Signatures.get(Inst);
+                if (!Sig.Leaves.empty()) {
+                    ucprobe Probe = {BrInfo.id, Total, Inst};
+                    UC_Probes.push_back({JoinKey{Total, Low, High, Sig.Fingerprint}, UC_Probes.size(), Probe});
                 }
+                continue;
+            }
+            for (const stat &Info: OneSided ? SC_Pattern.lookupOneSided(Total) : SC_Pattern.lookup(BrInfo.count[1], BrInfo.count[2])) {
+                // If UC and SC operate the same variable
+                reduceByUC(Inst, BrInfo.id, Info, Total);
             }
         }
     }
-    fclose(fp_uc);
+    // Join the UCs with the SCs of the same pattern and signature; only those
+    // pairs have their sources compared
+    if (JoinUCs) {
+        std::vector<JoinEntry<stat>> SC_Entries;
+        for (const stat &Info: SC_Records) {
+            Instruction *Src = getCheckSource(Info.SC, Info.Sub);
+            if (!Src) {
+                continue;
+            }
+            const SourceSignature &Sig = Signatures.get(Src);
+            if (Sig.Leaves.empty()) {
+                continue;
+            }
+            JoinKey Key = {Info.LB + Info.RB, std::min(Info.LB, Info.RB), std::max(Info.LB, Info.RB), Sig.Fingerprint};
+            SC_Entries.push_back({Key, SC_Entries.size(), Info});
+        }
+        mergeJoin(UC_Probes, SC_Entries, [&](const ucprobe &Probe, const stat &Info) {
+            reduceByUC(Probe.UC, Probe.id, Info, Probe.Count);
+        });
+    }
+    if (fp_uc) {
+        fclose(fp_uc);
+    }
     // Finish reading and storing UC coverage records from InputUCOV
 
     // Reduce redundant SCs among SCs
-    // For each SC read from SCOV file
-    // Check whether its pattern matches any SCs in SC_Pattern_opt
-    // If it is, this SC can be reduced
+    // Each SC read from SCOV file joins the class of SCs with its pattern
+    // and source; all but one check of each class can be reduced
     flagSC_opts = flagSC_opt;
     costflagSC_opts = costflagSC_opt;
     errs() <<flagSC_opt <<":"<<costflagSC_opt << "----\n";
-    fp_sc = fopen(Twine(InputSCOV).str().c_str(), "rb");
-    uint64_t tmp = 0;
+    if (!MergedModule) {
+        fp_sc = fopen(Twine(InputSCOV).str().c_str(), "rb");
+    }
+    NextSC = 0;
     uint64_t Cost = 0, Total_Cost = 0, Total_Cost_Opt = 0;
+    // SCs with the same coverage pattern and the same source signature are
+    // redundant with each other. They are grouped into classes by hashing
+    // (pattern, signature); each class keeps its cheapest check and the
+    // others are folded in one sweep.
+    struct member{
+        uint64_t id;
+        uint64_t count;
+        uint64_t cost;
+        Instruction* SC;
+        Use* Sub;
+        uint64_t LB;
+        uint64_t RB;
+    };
+    struct checkcost{
+        uint64_t id;
+        uint64_t count;
+        uint64_t cost;
+    };
+    std::map<std::tuple<uint64_t, uint64_t, uint64_t>, std::vector<std::vector<member>>> SC_Classes;
+    std::vector<checkcost> SC_Costs;
+    // ASan checks by function and base pointer, for -asan-same-location
+    std::map<std::pair<Function*, Value*>, std::vector<member>> ASanChecks;
     for (Function &F: m) {
         const TargetTransformInfo &TTI = TTIWP.getTTI(F);
-        for (Instruction *Inst: SCI->getSCBranches(&F)) {
+        for (Instruction *Inst: SCI->getSanityChecks(&F)) {
             assert(Inst->getParent()->getParent() == &F && "SCI must only contain instructions of the current function.");
             BranchInst *BI = dyn_cast<BranchInst>(Inst);
-            assert(BI && BI->isConditional() && "SCBranches must not contain instructions that aren't conditional branches.");
-            fread(&BrInfo, sizeof(BrInfo), 1, fp_sc);
+            assert(((BI && BI->isConditional()) || isa<CallInst>(Inst)) && "Sanity checks must be conditional branches or callback checks.");
+            readRecord(Inst, fp_sc, NextSC);
             // errs() <<"SC:"<<BrInfo.id << ":"<< BrInfo.count[0] <<":"<< BrInfo.count[1] <<":"<< BrInfo.count[2] << "\n";
             BrInfo.count[0] = BrInfo.count[1] + BrInfo.count[2];
             
             // Calculate cost of each checks
-            Cost = 0;
-            for (Instruction *CI: SCI->getInstructionsBySanityCheck(BI)) {
+            uint64_t StaticCost = 0;
+            for (Instruction *CI: SCI->getInstructionsBySanityCheck(Inst)) {
                 unsigned CurrentCost = CheckCost::getInstructionCost(CI, &TTI);
                 if (CurrentCost == (unsigned)(-1)) {
                     CurrentCost = 1;
                 }
-                Cost += CurrentCost * BrInfo.count[0];
+                StaticCost += CurrentCost;
             }
+            Cost = StaticCost * BrInfo.count[0];
             Total_Cost += Cost;
             Total_Cost_Opt += Cost;
-            tmp++;
-            // Set a flag to record whether the SC can be reduced
-            is_reduced = false;
-            // For each instruction in SCBranch, check whether its dynamic pattern matches certain patterns in SC_Pattern_opt
-            if (SC_Pattern.count(BrInfo.count[0]) > 0 && BrInfo.count[0] > 0) {
-                // New SC and existing SC have ompletely the same dynamic pattern A+B:A:B
-                // Check all SCs in SC_Pattern_opt
-                for (stat Info: SC_Pattern[BrInfo.count[0]]) {
-                    if (BrInfo.count[1] == Info.LB || BrInfo.count[2] == Info.LB) {
-                        // Also the same operation variable 
-                        // errs() << tmp << ":"<<Info.id << "---";
-
-                        if (BrInfo.id != Info.id && findPhiInst(Info.SC, Inst, Info.id, BrInfo.id)) {
-                            is_reduced = true;
-                            if (reducedSC.count(BrInfo.id) == 0) {
-                                optimizeCheckAway(Inst);
-                                errs() << "Reduced::SC:" << BrInfo.id<<"SC:"<<Info.id <<":"<< BrInfo.count[0]<< "--------\n";
-                                flagSC_opts -= 1;
-                                costflagSC_opts -= BrInfo.count[0];
-                                reducedSC[BrInfo.id] = BrInfo.count[0];
-                            }
-                        }
+            SC_Costs.push_back({BrInfo.id, BrInfo.count[0], Cost});
+
+            // Checks removed against UCs take no part; neither do removed
+            // predicates of fused checks
+            if (reducedSC.count(BrInfo.id) > 0) {
+                continue;
+            }
+            if (ASanSameLocation) {
+                if (Value *Ptr = SameLocationOracle::getCheckedPointer(SCI, Inst)) {
+                    member Member = {BrInfo.id, BrInfo.count[0], StaticCost, Inst, nullptr, BrInfo.count[1], BrInfo.count[2]};
+                    ASanChecks[std::make_pair(&F, Ptr->stripInBoundsOffsets())].push_back(Member);
+                }
+            }
+            if (BrInfo.count[0] == 0 || BrInfo.count[0] < CountTolerance::getMinCount()) {
+                continue;
+            }
+            std::vector<Use*> Subs(SCI->getSubChecks(Inst));
+            if (Subs.empty()) {
+                Subs.push_back(nullptr);
+            }
+            for (Use *Sub: Subs) {
+                Instruction *Src = getCheckSource(Inst, Sub);
+                if (!Src) {
+                    continue;
+                }
+                const SourceSignature &Sig = Signatures.get(Src);
+                if (Sig.Leaves.empty()) {
+                    continue;
+                }
+                member Member = {BrInfo.id, BrInfo.count[0], StaticCost, Inst, Sub, BrInfo.count[1], BrInfo.count[2]};
+                // With a count tolerance, near patterns share a bucket and
+                // the class decides whether they match
+                std::tuple<uint64_t, uint64_t, uint64_t> Key(0, 0, Sig.Fingerprint);
+                if (CountTolerance::isExact()) {
+                    Key = std::make_tuple(std::min(BrInfo.count[1], BrInfo.count[2]), std::max(BrInfo.count[1], BrInfo.count[2]), Sig.Fingerprint);
+                }
+                std::vector<std::vector<member>> &Bucket = SC_Classes[Key];
+                bool found = false;
+                for (std::vector<member> &Class: Bucket) {
+                    const member &First = Class.front();
+                    if (PatternIndex<stat>::matches(First.LB, First.RB, Member.LB, Member.RB) &&
+                        Records.getSplitSite(First.SC) == Records.getSplitSite(Member.SC) &&
+                        Signatures.get(getCheckSource(First.SC, First.Sub)) == Sig) {
+                        Class.push_back(Member);
+                        found = true;
+                        break;
                     }
                 }
-            } 
-            // Calculate reduced asap cost
-            if (reducedSC.count(BrInfo.id) == 1) {
-                Total_Cost_Opt -= Cost;
-                test3 += 1;
+                if (!found) {
+                    Bucket.push_back(std::vector<member>(1, Member));
+                }
+            }
+        }
+    }
+    // Keep the cheapest check of each class, the first one on ties
+    for (auto &Bucket: SC_Classes) {
+        for (std::vector<member> &Class: Bucket.second) {
+            size_t Keep = 0;
+            for (size_t i = 1; i < Class.size(); i++) {
+                if (Class[i].cost < Class[Keep].cost) {
+                    Keep = i;
+                }
             }
-            // If the SC cannot be reduced, it should be inserted into SC_Pattern_opt, becoming one of the existing SCs.
-            if (!is_reduced) {
-                // Insert this Instruction into SC_Pattern_opt
-                // Including its id, LB, RB, and *Inst
-                struct stat SC_Info;
-                SC_Info.id = BrInfo.id;
-                SC_Info.LB = BrInfo.count[1];
-                SC_Info.RB = BrInfo.count[2];
-                SC_Info.SC = Inst;
-                // SC_Pattern_opt[BrInfo.count[0]].push_back(SC_Info);
-                if (reducedSC.count(BrInfo.id) == 0) {
-                    test1 += 1;
-                    test2 += BrInfo.count[0];
+            for (size_t i = 0; i < Class.size(); i++) {
+                const member &Member = Class[i];
+                if (i != Keep && reducedSC.count(Member.id) == 0 && reduceSanityCheck(Member.SC, Member.Sub)) {
+                    errs() << "Reduced::SC:" << Member.id<<"SC:"<<Class[Keep].id <<":"<< Member.count<< "--------\n";
+                    flagSC_opts -= 1;
+                    costflagSC_opts -= Member.count;
+                    reducedSC[Member.id] = Member.count;
+                }
+            }
+        }
+    }
+    // ASan checks of memory that a dominating check already covers, with no
+    // write or free in between, are redundant whatever their profile
+    if (ASanSameLocation) {
+        SameLocationOracle Oracle(this, SCI);
+        for (auto &Group: ASanChecks) {
+            for (const member &Check: Group.second) {
+                if (reducedSC.count(Check.id) > 0) {
+                    continue;
+                }
+                for (const member &Kept: Group.second) {
+                    if (reducedSC.count(Kept.id) == 0 && Oracle.implies(Kept.SC, Check.SC)) {
+                        reduceSanityCheck(Check.SC, nullptr);
+                        errs() << "Reduced::SC:" << Check.id<<"SC:"<<Kept.id <<":"<< Check.count<< "--------\n";
+                        flagSC_opts -= 1;
+                        costflagSC_opts -= Check.count;
+                        reducedSC[Check.id] = Check.count;
+                        break;
+                    }
                 }
             }
         }
     }
-    fclose(fp_sc);
+    // Calculate reduced asap cost
+    for (const checkcost &C: SC_Costs) {
+        if (reducedSC.count(C.id) == 1) {
+            Total_Cost_Opt -= C.cost;
+            test3 += 1;
+        }
+        else {
+            test1 += 1;
+            test2 += C.count;
+        }
+    }
+    if (fp_sc) {
+        fclose(fp_sc);
+    }
     errs() << "UC num :: " << flagUC << ";SC Num :: " << flagSC << ";SC percent after L1 :: " << flagSC_opt * 1.0 / (flagSC + 0.000000001) * 100 << "\%;SC percent after L2 :: " << flagSC_opts * 1.0 / (flagSC + 0.000000001) * 100 << "\%\n";
     errs() << "SC cost percent:: "<< costflagSC / (costflagSC + 0.000000001) * 100  << ";SC cost percent after L1 :: " << costflagSC_opt * 1.0 / (costflagSC + 0.000000001) * 100 << "\%;SC cost percent after L2 :: " << costflagSC_opts * 1.0 / (costflagSC + 0.000000001) * 100 << "\%\n";
     errs() <<"com:" << test1<<":"<<test2<<":"<<flagSC_opts<<":"<<costflagSC_opts<<"\n";
@@ -304,6 +478,8 @@ bool DynPass2::runOnModule(Module &m) {
     fprintf(fpp, "%s %lu %lu %lu %lu %lu %lu %lu %lu\n", filename.c_str(), flagSC, flagSC_opt,flagSC_opts,costflagSC,costflagSC_opt,costflagSC_opts, Total_Cost, Total_Cost_Opt);
     fclose(fpp);
     }
+    Facts.apply();
+    eraseCallbackChecks(RemovedCalls);
     return true;
 }
 
@@ -463,177 +639,61 @@ bool DynPass2::runOnModule(Module &m) {
 // }
 
 
-bool DynPass2::findPhiInst(Instruction *UC_Inst, Instruction *SC_Inst, uint64_t id1, uint64_t id2) {
-    std::set<Instruction*> UC_list;
-    std::set<Value*> UC_Slist;
-    UC_list.insert(UC_Inst);
-    std::set<Instruction*> SC_list;
-    std::set<Value*> SC_Slist;
-    SC_list.insert(SC_Inst);
-    bool flag = true;
-    bool is_end = true;
-    uint64_t count = 0;
-    Instruction *Inst;
-    while (!SC_list.empty()) {
-        flag = false;
-        Instruction *Inst = *SC_list.begin();
-        SC_list.erase(Inst);
-        StringRef OpName = Inst->getOpcodeName();
-        if (OpName == "phi") {
-            SC_Slist.insert(Inst);
-        }
-        else if (BranchInst *BI = dyn_cast<BranchInst>(Inst)) {
-            if (Instruction *Op=dyn_cast<Instruction>(Inst->getOperand(0))) {
-                SC_list.insert(Op);
-            }
-        }
-        else {
-            flag = true;
-        }
-        if (flag) {
-            if (id1 == 610 && id2 == 609) {
-                errs() << "***" << OpName << ":" << SC_Slist.size() << ":" <<Inst->getNumOperands();
-            }
-            count = 0;
-            is_end = true;
-            for (Use &U: Inst->operands()) {
-                if (Instruction *Op = dyn_cast<Instruction>(U.get())) {
-                    SC_list.insert(Op);
-                    is_end = false;
-                    if (id1 == 610 && id2 == 609) {
-                        errs() << "Inst:";
-                    }
-                }
-                else if (Constant *C = dyn_cast<Constant>(U.get())) {
-                    if (id1 == 610 && id2 == 609) {
-                        errs() << "Const:";
-                    }
-                    // SC_Slist.insert(C);
-                    count += 1;
-                    // if (OpName == "icmp") {
-                    //     SC_Slist.insert(C);
-                    // }
-                }
-                else {
-                    if (id1 == 610 && id2 == 609) {
-                        errs() << "Not Const:";
-                    }
-                    SC_Slist.insert(U.get());
-                }
-            }
-            // if (Inst->getNumOperands() == 0) {
-            //     SC_Slist.insert(Inst);
-            // }
-            if (count == Inst->getNumOperands()) {
-                SC_Slist.insert(Inst);
-            }
-        }
+// A UC and an SC, or two SCs, have the same source if they are computed from
+// the same leaf values. Signatures are computed once per branch.
+bool DynPass2::findPhiInst(Instruction *UC_Inst, Instruction *SC_Inst) {
+    const SourceSignature &SC_Sig = Signatures.get(SC_Inst);
+    if (SC_Sig.Leaves.empty()) {
+        return false;
     }
-    if (id1 == 610 && id2 == 609) {
-        errs() << "SSSSCCCC***" << SC_Slist.size();
-    }
-    flag = true;
-    while (!UC_list.empty()) {
-        flag = false;
-        Instruction *Inst = *UC_list.begin();
-        UC_list.erase(Inst);
-        StringRef OpName = Inst->getOpcodeName();
-        if (OpName == "phi") {
-            UC_Slist.insert(Inst);
-        }
-        else if (BranchInst *BI = dyn_cast<BranchInst>(Inst)) {
-            if (Instruction *Op=dyn_cast<Instruction>(Inst->getOperand(0))) {
-                UC_list.insert(Op);
-            }
-        }
-        else {
-            flag = true;
-        }
-
-        if (flag) {
-            if (id1==610 && id2 == 609) {
-                errs() << "***" << OpName << ":" << UC_Slist.size() << ":" <<Inst->getNumOperands();
-            }
-            count = 0;
-            is_end = true;
-            for (Use &U: Inst->operands()) {
-                if (Instruction *Op = dyn_cast<Instruction>(U.get())) {
-                    UC_list.insert(Op);
-                    is_end = false;
-                    if (id1 == 610 && id2 == 609) {
-                        errs() << "Inst:";
-                    }
-                }
-                else if (Constant *C = dyn_cast<Constant>(U.get())) {
-                    if (id1 == 610 && id2 == 609) {
-                        errs() << "Const:";
-                    }
-                    // if (OpName == "icmp") {
-                    //     UC_Slist.insert(C);
-                    // }
-                    // UC_Slist.insert(C);
-                    count += 1;
-                }
-                else {
-                    UC_Slist.insert(U.get());
-                    if (id1 == 610 && id2 == 609) {
-                        errs() << "Not Const:";
-                    }
-                }
-            }
-            // if (Inst->getNumOperands() == 0) {
-            //     UC_Slist.insert(Inst);
-            //     errs() << "hhhhhhhhhhhhhhhhhhhhhhhh";
-            // }
-            if (count == Inst->getNumOperands()) {
-                UC_Slist.insert(Inst);
-            }
-        }
-    }
-    if (id1 == 610 && id2 == 609) {
-        errs() << "UUUUCCCC***" << UC_Slist.size();
-    }
-    flag = false;
-    if (SC_Slist.size() == UC_Slist.size()) {
-        while (!SC_Slist.empty()) {
-            flag = false;
-            Value *SC_Inst = *SC_Slist.begin();
-            SC_Slist.erase(SC_Inst);
-            if (UC_Slist.count(SC_Inst) > 0) {
-                flag = true;
-            }
-            if (!flag) {
-                break;
-            }
-        }
-    }
-
-    return flag;
+    return Signatures.get(UC_Inst) == SC_Sig;
 }
 
 // Tries to remove a sanity check; returns true if it worked.
 void DynPass2::optimizeCheckAway(Instruction *Inst) {
+    Facts.add(Inst, SCI);
+    if (isa<CallInst>(Inst)) {
+        // Callback checks are erased once matching is done, since the later
+        // phases still look at the operands of removed checks.
+        RemovedCalls.insert(Inst);
+        return;
+    }
     BranchInst *BI = cast<BranchInst>(Inst);
     assert(BI->isConditional() && "Sanity check must be conditional branch.");
-    
-    unsigned int RegularBranch = getRegularBranch(BI, SCI);
-    
-    bool Changed = false;
-    if (RegularBranch == 0) {
-        BI->setCondition(ConstantInt::getTrue(Inst->getContext()));
-        Changed = true;
-    } else if (RegularBranch == 1) {
-        BI->setCondition(ConstantInt::getFalse(Inst->getContext()));
-        Changed = true;
-    } else {
-        dbgs() << "Warning: Sanity check with no regular branch found.\n";
-        dbgs() << "The sanity check has been kept intact.\n";
+    Signatures.invalidate(BI);
+
+    // Folds every branch of the check, including the fast path in front of
+    // ASan's partial-granule slow path
+    foldSanityCheck(BI, SCI);
+}
+
+
+// The instruction whose sources identify the check: the branch itself, or
+// the predicate of a fused check. Null once the predicate has been removed.
+Instruction *DynPass2::getCheckSource(Instruction *SC, Use *Sub) {
+    if (!Sub) {
+        return SC;
     }
-    // return Changed;
+    return dyn_cast<Instruction>(Sub->get());
 }
 
+// Removes a whole check, or one predicate of a fused check. Returns true if
+// the check is gone entirely.
+bool DynPass2::reduceSanityCheck(Instruction *SC, Use *Sub) {
+    if (!Sub) {
+        optimizeCheckAway(SC);
+        return true;
+    }
+    LLVM_DEBUG(dbgs() << "Removing predicate " << *Sub->get() << " of " << *SC << "\n");
+    Signatures.invalidate(SC);
+    Facts.add(SC, SCI, Sub);
+    return removeSubCheck(cast<BranchInst>(SC), Sub, SCI);
+}
 
 void DynPass2::getAnalysisUsage(AnalysisUsage& AU) const {
+    AU.addRequired<AAResultsWrapperPass>();
+    AU.addRequired<DominatorTreeWrapperPass>();
+    AU.addRequired<MemorySSAWrapperPass>();
     AU.addRequired<TargetTransformInfoWrapperPass>();
     AU.addRequired<SCIPass>();
     AU.setPreservesAll();
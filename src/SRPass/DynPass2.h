@@ -2,6 +2,8 @@
 // Please see LICENSE.txt for copyright and licensing information.
 
 #include "llvm/Pass.h"
+#include "SourceSignature.h"
+#include "CheckFacts.h"
 
 #include <utility>
 #include <vector>
@@ -17,6 +19,7 @@ namespace llvm {
     class raw_ostream;
     class Instruction;
     class Value;
+    class Use;
 }
 
 struct SCIPass;
@@ -32,9 +35,16 @@ struct DynPass2 : public llvm::ModulePass {
     virtual void getAnalysisUsage(llvm::AnalysisUsage& AU) const;
     
     void optimizeCheckAway(llvm::Instruction *Inst);
-    bool findPhiInst(llvm::Instruction *UC_Inst, llvm::Instruction *SC_Inst, uint64_t id1, uint64_t id2);
+    bool findPhiInst(llvm::Instruction *UC_Inst, llvm::Instruction *SC_Inst);
     bool reduceInstByCheck(llvm::Instruction *Inst);
+    llvm::Instruction *getCheckSource(llvm::Instruction *SC, llvm::Use *Sub);
+    bool reduceSanityCheck(llvm::Instruction *SC, llvm::Use *Sub);
 private:
 
     SCIPass *SCI;
+    SourceSignatures Signatures;
+    // Callback checks to erase at the end of runOnModule
+    std::set<llvm::Instruction*> RemovedCalls;
+    // What the removed checks established, with -check-facts
+    CheckFacts Facts;
 };
@@ -1,6 +1,7 @@
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/DerivedTypes.h"
 #include "llvm/IR/IRBuilder.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
 #include "llvm/Transforms/Utils/ModuleUtils.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/Function.h"
@@ -14,6 +15,7 @@
 
 #include "DynamicCallCounter.h"
 #include "SCIPass.h"
+#include "utils.h"
 
 #define DEBUG_TYPE "dccpass"
 
@@ -33,6 +35,18 @@ computeFunctionIDs(ArrayRef<Instruction*> instructions, uint64_t nextID) {
     return idMap;
 }
 
+// Returns the block in which executions of the given successor edge are
+// counted. Successors shared with other branches (e.g. a single llvm.trap
+// block used by several UBSan checks) get a new block on the edge so that
+// each check is counted separately.
+static BasicBlock *getCounterBlock(BranchInst *BI, unsigned SuccNum) {
+    BasicBlock *Succ = BI->getSuccessor(SuccNum);
+    if (Succ->getSinglePredecessor()) {
+        return Succ;
+    }
+    return SplitEdge(BI->getParent(), Succ);
+}
+
 // Create the CCOUNT(functionInfo) table used by the runtime library.
 static void
 createBranchTable(Module& m, std::vector<Instruction*> toCount, uint64_t numBranchInsts, std::string str) {
@@ -85,18 +99,18 @@ DynamicCallCounter::runOnModule(Module &m) {
   // First identify the functions we wish to track
     std::vector<Instruction*> CountSC;
     std::vector<Instruction*> CountUC;
-    SCIPass &SCI = getAnalysis<SCIPass>();
+    SCI = &getAnalysis<SCIPass>();
 
     for (Function &F: m) {
         LLVM_DEBUG(dbgs() << "DynPass on " << F.getName() << "\n");
-        for (Instruction *Inst: SCI.getSCBranches(&F)) {
+        for (Instruction *Inst: SCI->getSanityChecks(&F)) {
             assert(Inst->getParent()->getParent() == &F && "SCI must only contain instructions of the current function.");
             BranchInst *BI = dyn_cast<BranchInst>(Inst);
-            assert(BI && BI->isConditional() && "SCBranches must not contain instructions that aren't conditional branches.");
-            CountSC.push_back(BI);
+            assert(((BI && BI->isConditional()) || isa<CallInst>(Inst)) && "Sanity checks must be conditional branches or callback checks.");
+            CountSC.push_back(Inst);
             // errs() << "S check : " << BI->getSuccessor(0)->getName() << ":" << BI->getSuccessor(1)->getName() << "---";
         }
-        for (Instruction *Inst: SCI.getUCBranches(&F)) {
+        for (Instruction *Inst: SCI->getUCBranches(&F)) {
             assert(Inst->getParent()->getParent() == &F && "SCI must only contain instructions of the current function.");
             BranchInst *BI = dyn_cast<BranchInst>(Inst);
             assert(BI && BI->isConditional() && "UCBranches must not contain instructions that aren't conditional branches.");
@@ -169,21 +183,58 @@ DynamicCallCounter::runOnModule(Module &m) {
 void
 DynamicCallCounter::handleCalledBranch(Module& m, Instruction& I, Value* counter, std::string str, std::string filename) {
     BranchInst *BI = dyn_cast<BranchInst>(&I);
-    if (BI && BI->isConditional()) {
+    if (isa<CallInst>(&I) && str == "SC") {
+        // A callback check has no branches of its own; count its executions
+        // as the regular branch, so it has the coverage pattern A:A:0.
+        IRBuilder<> builderI(&I);
+        builderI.CreateCall(counter, {builderI.getInt64(ids_SC[&I]),builderI.getInt64(0)});
+        builderI.CreateCall(counter, {builderI.getInt64(ids_SC[&I]),builderI.getInt64(1)});
+    }
+    else if (BI && BI->isConditional()) {
         if (str == "SC") {
             uint64_t type = 0;
-            IRBuilder<> builderI(&I);
+            // A check that spans several branches is counted once, at its
+            // first branch
+            const SCIPass::InstructionVec &Branches = SCI->getCheckBranches(&I);
+
+            // Edges that leave the check before its last branch (ASan's fast
+            // path for a zero shadow byte) pass the check as well. They are
+            // classified before any counter block is inserted, since
+            // splitting an edge to a shared trap or report block changes the
+            // successors the classification looks at.
+            unsigned int RegularBranch = getRegularBranch(BI, SCI);
+            std::vector<std::pair<BranchInst*, unsigned int>> PassingEdges;
+            for (Instruction *Inst: Branches) {
+                BranchInst *CheckBI = cast<BranchInst>(Inst);
+                if (CheckBI == BI || RegularBranch > 1) {
+                    continue;
+                }
+                for (unsigned int i = 0; i < CheckBI->getNumSuccessors(); i++) {
+                    if (!SCI->isCheckSuccessor(CheckBI, CheckBI->getSuccessor(i))) {
+                        PassingEdges.push_back(std::make_pair(CheckBI, i));
+                    }
+                }
+            }
+
+            IRBuilder<> builderI(Branches.front());
             builderI.CreateCall(counter, {builderI.getInt64(ids_SC[&I]),builderI.getInt64(type)});
 
-            BasicBlock *BB = BI->getSuccessor(0);
+            BasicBlock *BB = getCounterBlock(BI, 0);
             IRBuilder<> builderA(&*BB->getFirstInsertionPt());
             type = 1;
             builderA.CreateCall(counter, {builderA.getInt64(ids_SC[&I]),builderA.getInt64(type)});
 
-            BB = BI->getSuccessor(1);
+            BB = getCounterBlock(BI, 1);
             IRBuilder<> builderB(&*BB->getFirstInsertionPt());
             type = 2;
             builderB.CreateCall(counter, {builderB.getInt64(ids_SC[&I]),builderB.getInt64(type)});
+
+            for (auto &Edge: PassingEdges) {
+                BB = getCounterBlock(Edge.first, Edge.second);
+                IRBuilder<> builderR(&*BB->getFirstInsertionPt());
+                type = RegularBranch + 1;
+                builderR.CreateCall(counter, {builderR.getInt64(ids_SC[&I]),builderR.getInt64(type)});
+            }
         }
         else if (str == "UC") {
             IRBuilder<> builderI(&I);
@@ -193,9 +244,9 @@ DynamicCallCounter::handleCalledBranch(Module& m, Instruction& I, Value* counter
     }
 }
 
+// Counter blocks are split into the CFG, so no analysis is preserved
 void DynamicCallCounter::getAnalysisUsage(AnalysisUsage& AU) const {
     AU.addRequired<SCIPass>();
-    AU.setPreservesAll();
 }
 
 
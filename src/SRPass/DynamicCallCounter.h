@@ -7,7 +7,7 @@ namespace llvm {
   class AnalysisUsage;
 }
 
-
+struct SCIPass;
 
 struct DynamicCallCounter : public llvm::ModulePass {
   static char ID;
@@ -22,5 +22,7 @@ struct DynamicCallCounter : public llvm::ModulePass {
 
   void handleCalledBranch(llvm::Module& m, llvm::Instruction& f, llvm::Value* counter, std::string str, std::string filename);
 
+private:
+  SCIPass *SCI;
 };
 
@@ -0,0 +1,171 @@
+// This file is part of ASAP.
+// Please see LICENSE.txt for copyright and licensing information.
+
+#include "FuseOverflowChecks.h"
+#include "SCIPass.h"
+#include "utils.h"
+#include "llvm/ADT/PostOrderIterator.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/PatternMatch.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+
+#define DEBUG_TYPE "sr-fuse-overflow"
+
+using namespace llvm;
+using namespace llvm::PatternMatch;
+
+static cl::opt<unsigned> MaxChain("fuse-max-checks",
+        cl::desc("Maximal number of overflow checks fused into one branch"),
+        cl::init(16), cl::Hidden);
+
+bool FuseOverflowChecks::runOnModule(Module &M) {
+    SCI = &getAnalysis<SCIPass>();
+    unsigned NumFused = 0, NumBranches = 0;
+    for (Function &F: M) {
+        if (F.isDeclaration() || SCI->getSCBranches(&F).empty()) {
+            continue;
+        }
+        Heads.clear();
+        for (Instruction *SC: SCI->getSCBranches(&F)) {
+            Heads.insert(cast<BranchInst>(SC));
+        }
+        // Chains are collected before anything changes, walking the blocks
+        // in reverse post order so that a chain starts at its first check
+        std::vector<std::vector<BranchInst*>> Chains;
+        std::set<BranchInst*> Chained;
+        ReversePostOrderTraversal<Function*> RPOT(&F);
+        for (BasicBlock *BB: RPOT) {
+            BranchInst *BI = dyn_cast<BranchInst>(BB->getTerminator());
+            if (!BI || Heads.count(BI) == 0 || Chained.count(BI) || !isFusable(BI)) {
+                continue;
+            }
+            std::vector<BranchInst*> Chain = getChain(BI);
+            Chained.insert(Chain.begin(), Chain.end());
+            if (Chain.size() > 1) {
+                Chains.push_back(Chain);
+            }
+        }
+        for (const std::vector<BranchInst*> &Chain: Chains) {
+            fuseChain(Chain);
+            NumFused += Chain.size();
+            NumBranches += 1;
+        }
+    }
+    errs() << "FuseOverflowChecks on " << M.getSourceFileName() << ": " << NumFused
+           << " overflow checks fused into " << NumBranches << " branches\n";
+    return NumBranches > 0;
+}
+
+// An aborting UBSan check of one *.with.overflow intrinsic
+bool FuseOverflowChecks::isFusable(BranchInst *BI) {
+    const SanityCheckInfo &Info = SCI->getCheckInfo(BI);
+    if (!Info.isUBSan() || Info.Kind != SanityCheckInfo::Overflow ||
+        SCI->getCheckBranches(BI).size() != 1 || !SCI->getSubChecks(BI).empty()) {
+        return false;
+    }
+    Value *Cond = BI->getCondition();
+    match(Cond, m_Not(m_Value(Cond)));
+    ExtractValueInst *EV = dyn_cast<ExtractValueInst>(Cond);
+    if (!EV || !isa<WithOverflowInst>(EV->getAggregateOperand())) {
+        return false;
+    }
+    unsigned RegularBranch = getRegularBranch(BI, SCI);
+    if (RegularBranch > 1) {
+        return false;
+    }
+    // The handler block is entered again from the slow path, so it must not
+    // depend on where it is entered from
+    BasicBlock *Report = BI->getSuccessor(1 - RegularBranch);
+    return Report != BI->getSuccessor(RegularBranch) && !isa<PHINode>(Report->begin()) &&
+           isa<UnreachableInst>(Report->getTerminator());
+}
+
+std::vector<BranchInst*> FuseOverflowChecks::getChain(BranchInst *Start) {
+    std::vector<BranchInst*> Chain(1, Start);
+    BasicBlock *Prev = Start->getParent();
+    BasicBlock *Next = Start->getSuccessor(getRegularBranch(Start, SCI));
+    while (Chain.size() < MaxChain && Next->getSinglePredecessor() == Prev) {
+        for (Instruction &I: *Next) {
+            if (&I != Next->getTerminator() && !isSafeToSpeculativelyExecute(&I)) {
+                return Chain;
+            }
+        }
+        BranchInst *BI = dyn_cast<BranchInst>(Next->getTerminator());
+        if (!BI) {
+            return Chain;
+        }
+        Prev = Next;
+        if (BI->isUnconditional()) {
+            Next = BI->getSuccessor(0);
+            continue;
+        }
+        if (Heads.count(BI) == 0 || !isFusable(BI)) {
+            return Chain;
+        }
+        Chain.push_back(BI);
+        Next = BI->getSuccessor(getRegularBranch(BI, SCI));
+    }
+    return Chain;
+}
+
+void FuseOverflowChecks::fuseChain(const std::vector<BranchInst*> &Chain) {
+    BranchInst *Last = Chain.back();
+    LLVMContext &Ctx = Last->getContext();
+    Function *F = Last->getParent()->getParent();
+    IRBuilder<> IRB(Last);
+
+    // The failure flag and handler block of every check, in program order
+    std::vector<Value*> Fails;
+    std::vector<BasicBlock*> Reports;
+    for (BranchInst *BI: Chain) {
+        unsigned RegularBranch = getRegularBranch(BI, SCI);
+        Value *Cond = BI->getCondition();
+        Fails.push_back(RegularBranch == 0 ? IRB.CreateNot(Cond) : Cond);
+        Reports.push_back(BI->getSuccessor(1 - RegularBranch));
+    }
+    Value *AnyFail = Fails.front();
+    for (size_t i = 1; i < Fails.size(); i++) {
+        AnyFail = IRB.CreateOr(AnyFail, Fails[i], "sr.overflow");
+    }
+    LLVM_DEBUG(dbgs() << "Fusing " << Chain.size() << " overflow checks into " << *AnyFail << "\n");
+
+    // The slow path finds the first failing check again
+    std::vector<BasicBlock*> Slow;
+    for (size_t i = 0; i + 1 < Chain.size(); i++) {
+        Slow.push_back(BasicBlock::Create(Ctx, "overflow.slow", F, Reports.back()));
+    }
+    for (size_t i = 0; i < Slow.size(); i++) {
+        BasicBlock *Else = i + 1 < Slow.size() ? Slow[i + 1] : Reports.back();
+        BranchInst::Create(Reports[i], Else, Fails[i], Slow[i]);
+    }
+
+    for (size_t i = 0; i + 1 < Chain.size(); i++) {
+        foldSanityCheck(Chain[i], SCI);
+    }
+    unsigned RegularBranch = getRegularBranch(Last, SCI);
+    Last->setSuccessor(1 - RegularBranch, Slow.front());
+    if (RegularBranch == 0) {
+        Last->setCondition(IRB.CreateNot(AnyFail));
+        Last->setMetadata(LLVMContext::MD_prof, MDBuilder(Ctx).createBranchWeights(100000, 1));
+    }
+    else {
+        Last->setCondition(AnyFail);
+        Last->setMetadata(LLVMContext::MD_prof, MDBuilder(Ctx).createBranchWeights(1, 100000));
+    }
+}
+
+void FuseOverflowChecks::getAnalysisUsage(AnalysisUsage& AU) const {
+    AU.addRequired<SCIPass>();
+}
+
+char FuseOverflowChecks::ID = 0;
+static RegisterPass<FuseOverflowChecks> X("sr-fuse-overflow",
+        "Fuses chains of UBSan overflow checks into one branch", false, false);
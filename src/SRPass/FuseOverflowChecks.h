@@ -0,0 +1,49 @@
+// This file is part of ASAP.
+// Please see LICENSE.txt for copyright and licensing information.
+
+#ifndef SRPASS_FUSEOVERFLOWCHECKS_H
+#define SRPASS_FUSEOVERFLOWCHECKS_H
+
+#include "llvm/Pass.h"
+
+#include <set>
+#include <vector>
+
+namespace llvm {
+    class BranchInst;
+    class Function;
+}
+
+struct SCIPass;
+
+// Fuses the UBSan overflow checks of a straight-line chain of arithmetic,
+// such as a*b + c*d - e, into one branch. The overflow flags of all
+// operations are or'ed at the last check, which branches to a slow path
+// that tests the flags again in program order and reports the first
+// overflowing operation with its original handler call, so diagnostics are
+// unchanged. The chain follows the passing edges of the checks through
+// blocks without other predecessors and may only contain instructions
+// that are safe to execute speculatively, so nothing observable happens
+// between the first check and the fused one. Only checks whose handler
+// aborts are fused.
+struct FuseOverflowChecks : public llvm::ModulePass {
+    static char ID;
+
+    FuseOverflowChecks() : ModulePass(ID) {}
+
+    virtual bool runOnModule(llvm::Module &M);
+
+    virtual void getAnalysisUsage(llvm::AnalysisUsage& AU) const;
+
+private:
+    SCIPass *SCI;
+    // The first branches of the checks in the current function
+    std::set<llvm::BranchInst*> Heads;
+
+    bool isFusable(llvm::BranchInst *BI);
+    // The fusable checks that follow Start on its passing edges, Start first
+    std::vector<llvm::BranchInst*> getChain(llvm::BranchInst *Start);
+    void fuseChain(const std::vector<llvm::BranchInst*> &Chain);
+};
+
+#endif
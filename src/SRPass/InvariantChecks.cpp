@@ -0,0 +1,297 @@
+// This file is part of ASAP.
+// Please see LICENSE.txt for copyright and licensing information.
+
+#include "InvariantChecks.h"
+#include "SCIPass.h"
+#include "utils.h"
+#include "llvm/ADT/MapVector.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/ValueMapper.h"
+
+#include <algorithm>
+#include <functional>
+#define DEBUG_TYPE "sr-hoist-checks"
+
+using namespace llvm;
+
+namespace {
+    // Copies the computation of a value out of a loop. Instructions for
+    // which IsCopied holds are copied, all others must be defined outside
+    // the loop. Values in VMap are replaced without looking at them.
+    class SliceCloner {
+    public:
+        ValueToValueMapTy VMap;
+
+        SliceCloner(Loop *L, std::function<bool(Instruction*)> IsCopied) : L(L), IsCopied(IsCopied) {}
+
+        bool canClone(Value *V) {
+            Instruction *I = dyn_cast<Instruction>(V);
+            if (!I || VMap.count(I)) {
+                return true;
+            }
+            if (!IsCopied(I)) {
+                return !L->contains(I);
+            }
+            if (!Checked.insert(I).second) {
+                return true;
+            }
+            if (isa<PHINode>(I) || I->mayHaveSideEffects()) {
+                return false;
+            }
+            // Only shadow loads may be copied; the loop is known not to
+            // change the shadow
+            if (LoadInst *Load = dyn_cast<LoadInst>(I)) {
+                if (Load->isVolatile() || !isa<IntToPtrInst>(Load->getPointerOperand()->stripPointerCasts())) {
+                    return false;
+                }
+            }
+            else if (I->mayReadFromMemory()) {
+                return false;
+            }
+            for (Value *Op: I->operands()) {
+                if (!canClone(Op)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        Value *clone(Value *V, Instruction *InsertBefore) {
+            auto Found = VMap.find(V);
+            if (Found != VMap.end()) {
+                return Found->second;
+            }
+            Instruction *I = dyn_cast<Instruction>(V);
+            if (!I || !IsCopied(I)) {
+                return V;
+            }
+            Instruction *Copy = I->clone();
+            for (Use &Op: Copy->operands()) {
+                Op.set(clone(Op.get(), InsertBefore));
+            }
+            Copy->insertBefore(InsertBefore);
+            VMap[I] = Copy;
+            return Copy;
+        }
+
+    private:
+        Loop *L;
+        std::function<bool(Instruction*)> IsCopied;
+        SmallPtrSet<Instruction*, 16> Checked;
+    };
+}
+
+bool HoistInvariantChecks::runOnModule(Module &M) {
+    SCI = &getAnalysis<SCIPass>();
+    unsigned NumHoisted = 0;
+    for (Function &F: M) {
+        if (F.isDeclaration() || SCI->getSanityChecks(&F).empty()) {
+            continue;
+        }
+        LoopInfo &LI = getAnalysis<LoopInfoWrapperPass>(F).getLoopInfo();
+        DominatorTree &DT = getAnalysis<DominatorTreeWrapperPass>(F).getDomTree();
+
+        // Checks by the innermost loop they run in
+        MapVector<Loop*, std::vector<Instruction*>> ChecksByLoop;
+        for (Instruction *SC: SCI->getSanityChecks(&F)) {
+            Instruction *Start = isa<BranchInst>(SC) ? SCI->getCheckBranches(SC).front() : SC;
+            if (Loop *L = LI.getLoopFor(Start->getParent())) {
+                ChecksByLoop[L].push_back(SC);
+            }
+        }
+        for (auto &Entry: ChecksByLoop) {
+            if (!Entry.first->getLoopPreheader() || !isSideEffectFree(Entry.first)) {
+                continue;
+            }
+            for (Instruction *SC: Entry.second) {
+                if (hoistCheck(Entry.first, SC, DT, LI)) {
+                    NumHoisted += 1;
+                }
+            }
+        }
+        for (BranchInst *BI: FoldedChecks) {
+            foldSanityCheck(BI, SCI);
+        }
+        FoldedChecks.clear();
+    }
+    eraseCallbackChecks(RemovedCalls);
+    errs() << "HoistInvariantChecks on " << M.getSourceFileName() << ": " << NumHoisted << " checks hoisted\n";
+    return NumHoisted > 0;
+}
+
+// A loop that calls nothing that might not return or that changes the
+// shadow, and that writes no shadow itself
+bool HoistInvariantChecks::isSideEffectFree(Loop *L) {
+    for (BasicBlock *BB: L->blocks()) {
+        for (Instruction &I: *BB) {
+            CallInst *CI = dyn_cast<CallInst>(&I);
+            if (CI && !isa<IntrinsicInst>(CI) && !isCallbackCheck(CI) && !isAbortingCall(CI)) {
+                return false;
+            }
+            if (isa<InvokeInst>(&I)) {
+                return false;
+            }
+            StoreInst *SI = dyn_cast<StoreInst>(&I);
+            if (SI && isa<IntToPtrInst>(SI->getPointerOperand()->stripPointerCasts())) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool HoistInvariantChecks::reachesOnEntry(Loop *L, Instruction *Start, DominatorTree &DT,
+                                          BranchInst *&ExitBranch) {
+    ExitBranch = nullptr;
+    BasicBlock *Header = L->getHeader();
+    BasicBlock *StartBB = Start->getParent();
+    BasicBlock *Latch = L->getLoopLatch();
+    if (!Latch || !DT.dominates(StartBB, Latch)) {
+        return false;
+    }
+    const SCIPass::BlockSet &CheckBlocks = SCI->getSanityCheckBlocks(Header->getParent());
+    SmallVector<BasicBlock*, 8> Exiting;
+    L->getExitingBlocks(Exiting);
+    for (BasicBlock *BB: Exiting) {
+        bool LeavesLoop = false;
+        for (BasicBlock *Succ: successors(BB)) {
+            if (!L->contains(Succ) && CheckBlocks.count(Succ) == 0) {
+                LeavesLoop = true;
+            }
+        }
+        if (!LeavesLoop || DT.dominates(StartBB, BB)) {
+            continue;
+        }
+        BranchInst *BI = dyn_cast<BranchInst>(BB->getTerminator());
+        if (BB != Header || !BI || !BI->isConditional()) {
+            return false;
+        }
+        ExitBranch = BI;
+    }
+    return true;
+}
+
+bool HoistInvariantChecks::hoistCheck(Loop *L, Instruction *Check, DominatorTree &DT, LoopInfo &LI) {
+    const SanityCheckInfo &Info = SCI->getCheckInfo(Check);
+    const CallInst *Report = Info.ReportCall;
+    if (!Report || !Report->getCalledFunction() ||
+        Report->getCalledFunction()->getName().endswith("_noabort")) {
+        return false;
+    }
+    const BasicBlock *ReportBB = isa<BranchInst>(Check) ? Report->getParent() : nullptr;
+    if (ReportBB && !isa<UnreachableInst>(ReportBB->getTerminator())) {
+        return false;
+    }
+
+    Instruction *Start = isa<BranchInst>(Check) ? SCI->getCheckBranches(Check).front() : Check;
+    BranchInst *ExitBranch = nullptr;
+    if (!reachesOnEntry(L, Start, DT, ExitBranch)) {
+        return false;
+    }
+    BasicBlock *Preheader = L->getLoopPreheader();
+    BasicBlock *Header = L->getHeader();
+
+    // The header's exit test, evaluated on the values the loop is entered with
+    SliceCloner Entry(L, [Header](Instruction *I) {
+        return I->getParent() == Header && !isa<PHINode>(I);
+    });
+    if (ExitBranch) {
+        for (PHINode &Phi: Header->phis()) {
+            Entry.VMap[&Phi] = Phi.getIncomingValueForBlock(Preheader);
+        }
+        if (!Entry.canClone(ExitBranch->getCondition())) {
+            return false;
+        }
+    }
+
+    // The instructions only used by this check are copied along, as is the
+    // report block. The failure condition is the conjunction of the branch
+    // conditions along the edges that lead to the report.
+    const SCIPass::InstructionSet &Private = SCI->getInstructionsBySanityCheck(Check);
+    SliceCloner Slice(L, [&Private, ReportBB](Instruction *I) {
+        return Private.count(I) || (ReportBB && I->getParent() == ReportBB);
+    });
+    std::vector<std::pair<BranchInst*, bool>> FailEdges;
+    if (ReportBB) {
+        const SCIPass::InstructionVec &Branches = SCI->getCheckBranches(Check);
+        BranchInst *BI = cast<BranchInst>(Start);
+        while (true) {
+            unsigned RegularBranch = getRegularBranch(BI, SCI);
+            if (RegularBranch > 1 || !Slice.canClone(BI->getCondition())) {
+                return false;
+            }
+            FailEdges.push_back(std::make_pair(BI, RegularBranch == 1));
+            BasicBlock *FailBB = BI->getSuccessor(1 - RegularBranch);
+            if (FailBB == ReportBB) {
+                break;
+            }
+            BI = dyn_cast<BranchInst>(FailBB->getTerminator());
+            if (!BI || FailEdges.size() >= Branches.size() ||
+                std::find(Branches.begin(), Branches.end(), BI) == Branches.end()) {
+                return false;
+            }
+        }
+    }
+    for (Value *Arg: Report->args()) {
+        if (!Slice.canClone(Arg)) {
+            return false;
+        }
+    }
+
+    LLVM_DEBUG(dbgs() << "Hoisting " << *Check << " to " << Preheader->getName() << "\n");
+    Instruction *InsertBefore = Preheader->getTerminator();
+    if (ExitBranch) {
+        IRBuilder<> IRB(InsertBefore);
+        Value *Stay = Entry.clone(ExitBranch->getCondition(), InsertBefore);
+        if (!L->contains(ExitBranch->getSuccessor(0))) {
+            Stay = IRB.CreateNot(Stay);
+        }
+        InsertBefore = SplitBlockAndInsertIfThen(Stay, InsertBefore, false, nullptr, &DT, &LI);
+    }
+    if (ReportBB) {
+        IRBuilder<> IRB(InsertBefore);
+        Value *Fail = nullptr;
+        for (auto &Edge: FailEdges) {
+            Value *Cond = Slice.clone(Edge.first->getCondition(), InsertBefore);
+            if (!Edge.second) {
+                Cond = IRB.CreateNot(Cond);
+            }
+            Fail = Fail ? IRB.CreateAnd(Fail, Cond) : Cond;
+        }
+        MDNode *Weights = MDBuilder(Check->getContext()).createBranchWeights(1, 100000);
+        InsertBefore = SplitBlockAndInsertIfThen(Fail, InsertBefore, true, Weights, &DT, &LI);
+    }
+    Instruction *Copy = Report->clone();
+    for (Use &Arg: cast<CallInst>(Copy)->args()) {
+        Arg.set(Slice.clone(Arg.get(), InsertBefore));
+    }
+    Copy->insertBefore(InsertBefore);
+
+    if (ReportBB) {
+        FoldedChecks.push_back(cast<BranchInst>(Check));
+    }
+    else {
+        RemovedCalls.insert(Check);
+    }
+    return true;
+}
+
+void HoistInvariantChecks::getAnalysisUsage(AnalysisUsage& AU) const {
+    AU.addRequired<SCIPass>();
+    AU.addRequired<DominatorTreeWrapperPass>();
+    AU.addRequired<LoopInfoWrapperPass>();
+}
+
+char HoistInvariantChecks::ID = 0;
+static RegisterPass<HoistInvariantChecks> X("sr-hoist-checks",
+        "Hoists loop-invariant sanity checks to the loop preheader", false, false);
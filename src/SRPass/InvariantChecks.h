@@ -0,0 +1,59 @@
+// This file is part of ASAP.
+// Please see LICENSE.txt for copyright and licensing information.
+
+#ifndef SRPASS_INVARIANTCHECKS_H
+#define SRPASS_INVARIANTCHECKS_H
+
+#include "llvm/Pass.h"
+
+#include <set>
+#include <vector>
+
+namespace llvm {
+    class BranchInst;
+    class DominatorTree;
+    class Instruction;
+    class Loop;
+    class LoopInfo;
+}
+
+struct SCIPass;
+
+// Moves sanity checks whose operands do not change in a loop, together
+// with their report, from the loop body to the preheader. The copy runs
+// only if the loop reaches the check on its first iteration: either no
+// exit comes before the check, or only the header's exit does, in which
+// case the header's exit test is evaluated on the entry values to guard
+// the copy. The loop must call nothing that might not return or that
+// changes the shadow, so the check gives the same result on every
+// iteration and reporting it before the loop only drops side effects that
+// cannot be observed after an abort. Only checks whose report block ends
+// in unreachable are moved.
+struct HoistInvariantChecks : public llvm::ModulePass {
+    static char ID;
+
+    HoistInvariantChecks() : ModulePass(ID) {}
+
+    virtual bool runOnModule(llvm::Module &M);
+
+    virtual void getAnalysisUsage(llvm::AnalysisUsage& AU) const;
+
+private:
+    SCIPass *SCI;
+    // Callback checks to erase at the end of runOnModule
+    std::set<llvm::Instruction*> RemovedCalls;
+    // Check branches to fold once the function has been processed, since
+    // folding invalidates the dominator tree
+    std::vector<llvm::BranchInst*> FoldedChecks;
+
+    bool isSideEffectFree(llvm::Loop *L);
+    // Whether the loop reaches Start on its first iteration unless its
+    // header exits. ExitBranch is set to the header's exit branch if it
+    // comes before Start, and to null otherwise.
+    bool reachesOnEntry(llvm::Loop *L, llvm::Instruction *Start, llvm::DominatorTree &DT,
+                        llvm::BranchInst *&ExitBranch);
+    bool hoistCheck(llvm::Loop *L, llvm::Instruction *Check, llvm::DominatorTree &DT,
+                    llvm::LoopInfo &LI);
+};
+
+#endif
@@ -0,0 +1,74 @@
+// This file is part of ASAP.
+// Please see LICENSE.txt for copyright and licensing information.
+
+#ifndef SRPASS_MERGEJOIN_H
+#define SRPASS_MERGEJOIN_H
+
+#include <algorithm>
+#include <cstdint>
+#include <tuple>
+#include <vector>
+
+// Join key of a check: its canonical count pattern (total, lower and higher
+// branch count) and the fingerprint of its source signature. Two checks can
+// only match if their keys are equal.
+struct JoinKey {
+    uint64_t Total;
+    uint64_t Low;
+    uint64_t High;
+    uint64_t Fingerprint;
+
+    bool operator<(const JoinKey &Other) const {
+        return std::tie(Total, Low, High, Fingerprint) <
+            std::tie(Other.Total, Other.Low, Other.High, Other.Fingerprint);
+    }
+
+    bool operator==(const JoinKey &Other) const {
+        return Total == Other.Total && Low == Other.Low && High == Other.High &&
+            Fingerprint == Other.Fingerprint;
+    }
+};
+
+template <typename Record>
+struct JoinEntry {
+    JoinKey Key;
+    // Position in the input stream, to keep the stream order among equal keys
+    uint64_t Order;
+    Record R;
+};
+
+// Sort-merge join of two candidate streams. Both are sorted by key, and Fn
+// is called on each pair of entries with equal keys, in key order and then
+// in stream order. The expensive confirmation of a pair is left to Fn.
+template <typename Left, typename Right, typename Callback>
+void mergeJoin(std::vector<JoinEntry<Left>> &Lefts, std::vector<JoinEntry<Right>> &Rights, Callback Fn) {
+    auto byKey = [](const auto &A, const auto &B) {
+        return A.Key < B.Key || (A.Key == B.Key && A.Order < B.Order);
+    };
+    std::sort(Lefts.begin(), Lefts.end(), byKey);
+    std::sort(Rights.begin(), Rights.end(), byKey);
+
+    size_t L = 0, R = 0;
+    while (L < Lefts.size() && R < Rights.size()) {
+        if (Lefts[L].Key < Rights[R].Key) {
+            L++;
+        }
+        else if (Rights[R].Key < Lefts[L].Key) {
+            R++;
+        }
+        else {
+            size_t REnd = R;
+            while (REnd < Rights.size() && Rights[REnd].Key == Lefts[L].Key) {
+                REnd++;
+            }
+            for (; L < Lefts.size() && Lefts[L].Key == Rights[R].Key; L++) {
+                for (size_t i = R; i < REnd; i++) {
+                    Fn(Lefts[L].R, Rights[i].R);
+                }
+            }
+            R = REnd;
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,328 @@
+// This file is part of ASAP.
+// Please see LICENSE.txt for copyright and licensing information.
+
+#include "ObjectBounds.h"
+#include "SCIPass.h"
+#include "SameLocation.h"
+#include "utils.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/Analysis/CFG.h"
+#include "llvm/Analysis/MemoryBuiltins.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/Analysis/TargetLibraryInfo.h"
+#include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Operator.h"
+#include "llvm/IR/PatternMatch.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#define DEBUG_TYPE "sr-object-bounds"
+
+using namespace llvm;
+using namespace llvm::PatternMatch;
+
+static cl::opt<std::string>
+BoundsLog("object-bounds-log", cl::desc("<file the number of checked and removed checks is appended to>"),
+        cl::init(""), cl::Hidden);
+
+// The first word of a live ASan stack frame
+static const uint64_t StackFrameMagic = 0x41B58AB3;
+
+// Splits an integer address into a base and a constant offset
+static Value *getFrameBase(Value *Addr, uint64_t &Offset) {
+    Value *Base = nullptr;
+    ConstantInt *C = nullptr;
+    if (match(Addr, m_Add(m_Value(Base), m_ConstantInt(C)))) {
+        Offset = C->getZExtValue();
+        return Base;
+    }
+    Offset = 0;
+    return Addr;
+}
+
+// The description of the ASan stack frame at the integer address Frame,
+// or an empty string if Frame is not one. ASan stores a magic number into
+// the first word of the frame and the address of the description into the
+// second.
+static StringRef getFrameDescription(Value *Frame) {
+    bool HasMagic = false;
+    StringRef Description;
+    std::vector<Value*> Addrs(1, Frame);
+    Addrs.insert(Addrs.end(), Frame->user_begin(), Frame->user_end());
+    for (Value *Addr: Addrs) {
+        uint64_t Offset = 0;
+        if (getFrameBase(Addr, Offset) != Frame) {
+            continue;
+        }
+        for (User *U: Addr->users()) {
+            if (!isa<IntToPtrInst>(U)) {
+                continue;
+            }
+            for (User *Store: U->users()) {
+                StoreInst *SI = dyn_cast<StoreInst>(Store);
+                if (!SI || SI->getPointerOperand() != U) {
+                    continue;
+                }
+                Value *V = SI->getValueOperand();
+                if (Offset == 0 && match(V, m_SpecificInt(StackFrameMagic))) {
+                    HasMagic = true;
+                }
+                if (Offset == 8 && Operator::getOpcode(V) == Instruction::PtrToInt) {
+                    GlobalVariable *GV = dyn_cast<GlobalVariable>(cast<Operator>(V)->getOperand(0)->stripPointerCasts());
+                    ConstantDataSequential *Str = GV && GV->hasDefinitiveInitializer() ?
+                            dyn_cast<ConstantDataSequential>(GV->getInitializer()) : nullptr;
+                    if (Str && Str->isCString()) {
+                        Description = Str->getAsCString();
+                    }
+                }
+            }
+        }
+    }
+    return HasMagic ? Description : StringRef();
+}
+
+// Looks up the size of the variable at Offset in a frame description
+// "NumVars (Offset Size NameLength Name)*"
+static bool getFrameVariableSize(StringRef Description, uint64_t Offset, uint64_t &Size) {
+    uint64_t NumVars = 0;
+    if (Description.consumeInteger(10, NumVars)) {
+        return false;
+    }
+    for (uint64_t I = 0; I < NumVars; ++I) {
+        uint64_t VarOffset = 0, VarSize = 0, NameLength = 0;
+        if (!Description.consume_front(" ") || Description.consumeInteger(10, VarOffset) ||
+            !Description.consume_front(" ") || Description.consumeInteger(10, VarSize) ||
+            !Description.consume_front(" ") || Description.consumeInteger(10, NameLength) ||
+            !Description.consume_front(" ") || Description.size() < NameLength) {
+            return false;
+        }
+        Description = Description.drop_front(NameLength);
+        if (VarOffset == Offset) {
+            Size = VarSize;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Whether ASan poisons stack variables of F out of their scope, which it
+// marks with 0xf8 in the shadow
+static bool hasScopePoisoning(Function &F) {
+    for (Instruction &I: instructions(F)) {
+        if (CallInst *CI = dyn_cast<CallInst>(&I)) {
+            Function *Callee = CI->getCalledFunction();
+            if (Callee && Callee->getName() == "__asan_set_shadow_f8") {
+                return true;
+            }
+        }
+        StoreInst *SI = dyn_cast<StoreInst>(&I);
+        ConstantInt *C = SI ? dyn_cast<ConstantInt>(SI->getValueOperand()) : nullptr;
+        if (!C || Operator::getOpcode(SI->getPointerOperand()->stripPointerCasts()) != Instruction::IntToPtr) {
+            continue;
+        }
+        const APInt &Shadow = C->getValue();
+        for (unsigned Bit = 0; Bit + 8 <= Shadow.getBitWidth(); Bit += 8) {
+            if (Shadow.extractBitsAsZExtValue(8, Bit) == 0xf8) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+bool ObjectBoundsChecks::runOnModule(Module &M) {
+    SCI = &getAnalysis<SCIPass>();
+    uint64_t NumChecks = 0, NumRemoved = 0;
+    for (Function &F: M) {
+        if (F.isDeclaration() || SCI->getSanityChecks(&F).empty()) {
+            continue;
+        }
+        DominatorTree &DT = getAnalysis<DominatorTreeWrapperPass>(F).getDomTree();
+        ScalarEvolution &SE = getAnalysis<ScalarEvolutionWrapperPass>(F).getSE();
+        const TargetLibraryInfo &TLI = getAnalysis<TargetLibraryInfoWrapperPass>().getTLI(F);
+        bool MayFree = mayFree(F, TLI);
+        bool ScopePoisoned = hasScopePoisoning(F);
+
+        std::vector<Instruction*> Removed;
+        for (Instruction *SC: SCI->getSanityChecks(&F)) {
+            Value *Ptr = SameLocationOracle::getCheckedPointer(SCI, SC);
+            if (!Ptr) {
+                continue;
+            }
+            NumChecks += 1;
+            const SCEV *S = SE.getSCEV(Ptr);
+            const SCEVUnknown *Base = dyn_cast<SCEVUnknown>(SE.getPointerBase(S));
+            uint64_t ObjSize = 0;
+            if (!Base || !getObjectBytes(Base->getValue(), ObjSize, TLI, MayFree, ScopePoisoned)) {
+                continue;
+            }
+            const SCEV *Offset = SE.getMinusSCEV(S, Base);
+            if (isa<SCEVCouldNotCompute>(Offset)) {
+                continue;
+            }
+            ConstantRange Range = SE.getSignedRange(Offset);
+            uint64_t AccessSize = SCI->getCheckInfo(SC).AccessSize;
+            if (Range.isEmptySet() || Range.getSignedMin().isNegative() ||
+                Range.getSignedMax().getZExtValue() > ObjSize ||
+                ObjSize - Range.getSignedMax().getZExtValue() < AccessSize) {
+                continue;
+            }
+            Instruction *Start = isa<BranchInst>(SC) ? SCI->getCheckBranches(SC).front() : SC;
+            AllocaInst *AI = dyn_cast<AllocaInst>(Base->getValue());
+            if (AI && !isLiveAt(AI, Start, DT)) {
+                continue;
+            }
+            LLVM_DEBUG(dbgs() << "In bounds of " << *Base->getValue() << ": " << *Offset
+                              << " in " << Range << "\n");
+            Removed.push_back(SC);
+        }
+        // Checks are folded once the function is analysed, so that SCEV
+        // sees the function unchanged
+        for (Instruction *SC: Removed) {
+            if (isa<CallInst>(SC)) {
+                RemovedCalls.insert(SC);
+            }
+            else {
+                foldSanityCheck(cast<BranchInst>(SC), SCI);
+            }
+        }
+        NumRemoved += Removed.size();
+    }
+    eraseCallbackChecks(RemovedCalls);
+
+    std::string filename = M.getSourceFileName();
+    filename = filename.substr(0, filename.rfind("."));
+    errs() << "ObjectBoundsChecks on " << filename << ": " << NumRemoved << " of " << NumChecks
+           << " ASan checks in bounds\n";
+    if (!BoundsLog.empty()) {
+        FILE *fp = fopen(BoundsLog.c_str(), "ab");
+        if (fp != NULL) {
+            fprintf(fp, "%s %lu %lu\n", filename.c_str(), NumChecks, NumRemoved);
+            fclose(fp);
+        }
+    }
+    return NumRemoved > 0;
+}
+
+bool ObjectBoundsChecks::getObjectBytes(Value *Base, uint64_t &Size, const TargetLibraryInfo &TLI,
+                                        bool MayFree, bool ScopePoisoned) {
+    if (AllocaInst *AI = dyn_cast<AllocaInst>(Base)) {
+        ConstantInt *N = dyn_cast<ConstantInt>(AI->getArraySize());
+        if (!AI->isStaticAlloca() || !N) {
+            return false;
+        }
+        const DataLayout &DL = AI->getModule()->getDataLayout();
+        Size = DL.getTypeAllocSize(AI->getAllocatedType()) * N->getZExtValue();
+        return true;
+    }
+    // ASan moves the static allocas into one frame and addresses each as
+    // inttoptr(Frame + Offset)
+    if (IntToPtrInst *ITP = dyn_cast<IntToPtrInst>(Base)) {
+        uint64_t Offset = 0;
+        Value *Frame = getFrameBase(ITP->getOperand(0), Offset);
+        return !ScopePoisoned && getFrameVariableSize(getFrameDescription(Frame), Offset, Size);
+    }
+    if (GlobalVariable *GV = dyn_cast<GlobalVariable>(Base)) {
+        if (GV->isDeclaration() || GV->isInterposable()) {
+            return false;
+        }
+        const DataLayout &DL = GV->getParent()->getDataLayout();
+        Type *Ty = GV->getValueType();
+        // ASan replaces an instrumented global by one of type {T, [N x i8]},
+        // whose array is the redzone
+        StructType *ST = dyn_cast<StructType>(Ty);
+        if (ST && ST->isLiteral() && ST->getNumElements() == 2 && ST->getElementType(1)->isArrayTy() &&
+            ST->getElementType(1)->getArrayElementType()->isIntegerTy(8)) {
+            Ty = ST->getElementType(0);
+        }
+        Size = DL.getTypeAllocSize(Ty);
+        return true;
+    }
+    if (isa<CallBase>(Base) && !MayFree && isAllocLikeFn(Base, &TLI)) {
+        const DataLayout &DL = cast<Instruction>(Base)->getModule()->getDataLayout();
+        return getObjectSize(Base, Size, DL, &TLI);
+    }
+    return false;
+}
+
+bool ObjectBoundsChecks::isLiveAt(AllocaInst *AI, Instruction *At, DominatorTree &DT) {
+    std::vector<Instruction*> Starts, Ends;
+    std::vector<Value*> Worklist(1, AI);
+    while (!Worklist.empty()) {
+        Value *V = Worklist.back();
+        Worklist.pop_back();
+        for (User *U: V->users()) {
+            if (isa<BitCastInst>(U)) {
+                Worklist.push_back(U);
+            }
+            else if (IntrinsicInst *II = dyn_cast<IntrinsicInst>(U)) {
+                if (II->getIntrinsicID() == Intrinsic::lifetime_start) {
+                    Starts.push_back(II);
+                }
+                else if (II->getIntrinsicID() == Intrinsic::lifetime_end) {
+                    Ends.push_back(II);
+                }
+            }
+        }
+    }
+    if (Starts.empty() && Ends.empty()) {
+        return true;
+    }
+    bool Started = false;
+    SmallPtrSet<BasicBlock*, 4> StartBlocks;
+    for (Instruction *S: Starts) {
+        Started |= DT.dominates(S, At);
+        StartBlocks.insert(S->getParent());
+    }
+    if (!Started) {
+        return false;
+    }
+    for (Instruction *E: Ends) {
+        if (isPotentiallyReachable(E, At, &StartBlocks, &DT)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ObjectBoundsChecks::mayFree(Function &F, const TargetLibraryInfo &TLI) {
+    for (BasicBlock &BB: F) {
+        for (Instruction &I: BB) {
+            CallBase *CB = dyn_cast<CallBase>(&I);
+            if (!CB || isa<IntrinsicInst>(CB)) {
+                continue;
+            }
+            CallInst *CI = dyn_cast<CallInst>(CB);
+            if (CI && (isCallbackCheck(CI) || isAbortingCall(CI))) {
+                continue;
+            }
+            if (isAllocLikeFn(CB, &TLI)) {
+                continue;
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+void ObjectBoundsChecks::getAnalysisUsage(AnalysisUsage& AU) const {
+    AU.addRequired<SCIPass>();
+    AU.addRequired<DominatorTreeWrapperPass>();
+    AU.addRequired<ScalarEvolutionWrapperPass>();
+    AU.addRequired<TargetLibraryInfoWrapperPass>();
+}
+
+char ObjectBoundsChecks::ID = 0;
+static RegisterPass<ObjectBoundsChecks> X("sr-object-bounds",
+        "Removes ASan checks of accesses proven inside objects of known size", false, false);
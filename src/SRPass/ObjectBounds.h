@@ -0,0 +1,63 @@
+// This file is part of ASAP.
+// Please see LICENSE.txt for copyright and licensing information.
+
+#ifndef SRPASS_OBJECTBOUNDS_H
+#define SRPASS_OBJECTBOUNDS_H
+
+#include "llvm/Pass.h"
+
+#include <cstdint>
+#include <set>
+
+namespace llvm {
+    class AllocaInst;
+    class DominatorTree;
+    class Function;
+    class Instruction;
+    class TargetLibraryInfo;
+    class Value;
+}
+
+struct SCIPass;
+
+// Removes ASan checks of accesses that provably stay inside an object of
+// known size. The checked pointer is split by ScalarEvolution into its
+// base object and an offset, and the check goes if the signed range of
+// the offset keeps the whole access inside the object. Objects are static
+// allocas, defined globals, with the redzone that ASan appends left out,
+// and heap objects from allocation functions of constant size in
+// functions that call nothing that could free them. An alloca with
+// lifetime markers must also be live at the check: a lifetime start has
+// to dominate it, and no lifetime end may reach it without passing a
+// lifetime start again.
+//
+// ASan itself replaces the static allocas of a function by one frame, a
+// %MyAlloca or a fake frame from __asan_stack_malloc_*, and addresses each
+// variable as inttoptr(Frame + Offset). Such a variable is found by its
+// offset in the frame description, which gives its size. Since the frame
+// keeps no lifetime markers, variables of functions where ASan poisons
+// out-of-scope variables are left alone.
+struct ObjectBoundsChecks : public llvm::ModulePass {
+    static char ID;
+
+    ObjectBoundsChecks() : ModulePass(ID) {}
+
+    virtual bool runOnModule(llvm::Module &M);
+
+    virtual void getAnalysisUsage(llvm::AnalysisUsage& AU) const;
+
+private:
+    SCIPass *SCI;
+    // Callback checks to erase at the end of runOnModule
+    std::set<llvm::Instruction*> RemovedCalls;
+
+    // The size in bytes of the object Base points to, or false if unknown
+    bool getObjectBytes(llvm::Value *Base, uint64_t &Size, const llvm::TargetLibraryInfo &TLI,
+                        bool MayFree, bool ScopePoisoned);
+    bool isLiveAt(llvm::AllocaInst *AI, llvm::Instruction *At, llvm::DominatorTree &DT);
+    // Whether F calls anything but sanitizer functions, intrinsics and
+    // allocation functions
+    bool mayFree(llvm::Function &F, const llvm::TargetLibraryInfo &TLI);
+};
+
+#endif
@@ -0,0 +1,65 @@
+// This file is part of ASAP.
+// Please see LICENSE.txt for copyright and licensing information.
+
+#include "PatternIndex.h"
+#include "llvm/Support/CommandLine.h"
+
+#include <cmath>
+#include <limits>
+
+using namespace llvm;
+
+static cl::opt<double>
+MatchEpsilon("match-epsilon", cl::desc("Relative difference allowed between matching branch counts"), cl::init(0.0), cl::Hidden);
+
+static cl::opt<unsigned long long>
+MatchMinCount("match-min-count", cl::desc("Minimum number of executions for a count pattern to match"), cl::init(0), cl::Hidden);
+
+double CountTolerance::getEpsilon() {
+    return MatchEpsilon;
+}
+
+uint64_t CountTolerance::getMinCount() {
+    return MatchMinCount;
+}
+
+bool CountTolerance::matches(uint64_t T1, uint64_t L1, uint64_t T2, uint64_t L2) {
+    if (std::min(T1, T2) < getMinCount()) {
+        return false;
+    }
+    if (isExact()) {
+        return T1 == T2 && L1 == L2;
+    }
+    double Epsilon = getEpsilon();
+    double Larger = std::max(T1, T2);
+    if (std::fabs((double)T1 - (double)T2) > Epsilon * Larger) {
+        return false;
+    }
+    // Compare how the counts are split, as shares of each total
+    double Share1 = T1 ? (double)L1 / T1 : 0;
+    double Share2 = T2 ? (double)L2 / T2 : 0;
+    return std::fabs(Share1 - Share2) <= Epsilon;
+}
+
+uint64_t CountTolerance::getLowerTotal(uint64_t Total) {
+    if (isExact()) {
+        return Total;
+    }
+    double Epsilon = std::min(getEpsilon(), 1.0);
+    return (uint64_t)std::ceil(Total * (1 - Epsilon));
+}
+
+uint64_t CountTolerance::getUpperTotal(uint64_t Total) {
+    if (isExact()) {
+        return Total;
+    }
+    double Epsilon = getEpsilon();
+    if (Epsilon >= 1) {
+        return std::numeric_limits<uint64_t>::max();
+    }
+    double Upper = std::floor(Total / (1 - Epsilon));
+    if (Upper >= (double)std::numeric_limits<uint64_t>::max()) {
+        return std::numeric_limits<uint64_t>::max();
+    }
+    return (uint64_t)Upper;
+}
@@ -0,0 +1,194 @@
+// This file is part of ASAP.
+// Please see LICENSE.txt for copyright and licensing information.
+
+#ifndef SRPASS_PATTERNINDEX_H
+#define SRPASS_PATTERNINDEX_H
+
+#include "llvm/ADT/Hashing.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// How closely two count patterns have to agree to match. By default they
+// must be equal. With -match-epsilon, the totals may differ by that
+// fraction of the larger one, and the shares of the lower branch by that
+// much; with -match-min-count, patterns executed fewer times never match.
+struct CountTolerance {
+    static double getEpsilon();
+    static uint64_t getMinCount();
+
+    static bool isExact() {
+        return getEpsilon() <= 0;
+    }
+
+    // Totals T1 and T2 and lower branch counts L1 and L2 of two patterns
+    static bool matches(uint64_t T1, uint64_t L1, uint64_t T2, uint64_t L2);
+
+    // Range of totals that can match Total
+    static uint64_t getLowerTotal(uint64_t Total);
+    static uint64_t getUpperTotal(uint64_t Total);
+};
+
+// Index of coverage records by their branch count pattern.
+//
+// A record with branch counts LB:RB is filed under the canonical key
+// (LB+RB, min(LB,RB), max(LB,RB)), so the records that match a pattern in
+// either branch order are found with one lookup, instead of scanning every
+// record that only shares the total count. Records that always take the
+// same branch are also filed by their total for the one-sided A:A:0
+// patterns, and all records are filed by total for matching that ignores
+// how the count is split.
+//
+// When the CountTolerance is not exact, the records are also kept sorted by
+// total, and a lookup binary-searches the band of totals that can match
+// before comparing the splits. Exact lookups return the indexed vectors
+// themselves; tolerant lookups return a buffer that the next lookup reuses.
+template <typename Record>
+class PatternIndex {
+public:
+    void insert(uint64_t LB, uint64_t RB, const Record &R) {
+        Key K = makeKey(LB, RB);
+        ByPattern[K].push_back(R);
+        ByTotal[K.Total].push_back(R);
+        if (LB == 0 || RB == 0) {
+            OneSided[K.Total].push_back(R);
+        }
+        if (!CountTolerance::isExact()) {
+            Sorted.push_back(Entry{K, R});
+            IsSorted = false;
+        }
+    }
+
+    // Records with branch counts LB:RB or RB:LB
+    const std::vector<Record> &lookup(uint64_t LB, uint64_t RB) const {
+        Key K = makeKey(LB, RB);
+        if (CountTolerance::isExact()) {
+            return K.Total >= CountTolerance::getMinCount() ? find(ByPattern, K) : none();
+        }
+        Matches.clear();
+        forBand(K.Total, [&](const Entry &E) {
+            if (CountTolerance::matches(K.Total, K.Low, E.K.Total, E.K.Low)) {
+                Matches.push_back(E.R);
+            }
+        });
+        return Matches;
+    }
+
+    // Records executed Total times that always took the same branch
+    const std::vector<Record> &lookupOneSided(uint64_t Total) const {
+        if (CountTolerance::isExact()) {
+            return Total >= CountTolerance::getMinCount() ? find(OneSided, Total) : none();
+        }
+        Matches.clear();
+        forBand(Total, [&](const Entry &E) {
+            if (E.K.Low == 0 && CountTolerance::matches(Total, 0, E.K.Total, 0)) {
+                Matches.push_back(E.R);
+            }
+        });
+        return Matches;
+    }
+
+    // Records executed Total times
+    const std::vector<Record> &lookupTotal(uint64_t Total) const {
+        if (CountTolerance::isExact()) {
+            return Total >= CountTolerance::getMinCount() ? find(ByTotal, Total) : none();
+        }
+        Matches.clear();
+        forBand(Total, [&](const Entry &E) {
+            Matches.push_back(E.R);
+        });
+        return Matches;
+    }
+
+    bool hasTotal(uint64_t Total) const {
+        if (Total < CountTolerance::getMinCount()) {
+            return false;
+        }
+        if (CountTolerance::isExact()) {
+            return ByTotal.count(Total) > 0;
+        }
+        bool Found = false;
+        forBand(Total, [&](const Entry &) {
+            Found = true;
+        });
+        return Found;
+    }
+
+    // Whether the patterns LB1:RB1 and LB2:RB2 match, in either branch order
+    static bool matches(uint64_t LB1, uint64_t RB1, uint64_t LB2, uint64_t RB2) {
+        Key K1 = makeKey(LB1, RB1);
+        Key K2 = makeKey(LB2, RB2);
+        return CountTolerance::matches(K1.Total, K1.Low, K2.Total, K2.Low);
+    }
+
+private:
+    struct Key {
+        uint64_t Total;
+        uint64_t Low;
+        uint64_t High;
+
+        bool operator==(const Key &Other) const {
+            return Total == Other.Total && Low == Other.Low && High == Other.High;
+        }
+    };
+
+    struct KeyHash {
+        size_t operator()(const Key &K) const {
+            return llvm::hash_combine(K.Total, K.Low, K.High);
+        }
+    };
+
+    static Key makeKey(uint64_t LB, uint64_t RB) {
+        return LB < RB ? Key{LB + RB, LB, RB} : Key{LB + RB, RB, LB};
+    }
+
+    struct Entry {
+        Key K;
+        Record R;
+    };
+
+    static const std::vector<Record> &none() {
+        static const std::vector<Record> None;
+        return None;
+    }
+
+    template <typename Map, typename K>
+    static const std::vector<Record> &find(const Map &M, const K &Key) {
+        auto It = M.find(Key);
+        return It == M.end() ? none() : It->second;
+    }
+
+    // Calls Fn on every record whose total can match Total, and that was
+    // executed often enough, in insertion order among equal totals
+    template <typename Callback>
+    void forBand(uint64_t Total, Callback Fn) const {
+        if (!IsSorted) {
+            std::stable_sort(Sorted.begin(), Sorted.end(), [](const Entry &A, const Entry &B) {
+                return A.K.Total < B.K.Total;
+            });
+            IsSorted = true;
+        }
+        uint64_t Lower = std::max(CountTolerance::getLowerTotal(Total), CountTolerance::getMinCount());
+        uint64_t Upper = CountTolerance::getUpperTotal(Total);
+        auto It = std::lower_bound(Sorted.begin(), Sorted.end(), Lower, [](const Entry &E, uint64_t T) {
+            return E.K.Total < T;
+        });
+        for (; It != Sorted.end() && It->K.Total <= Upper; ++It) {
+            Fn(*It);
+        }
+    }
+
+    std::unordered_map<Key, std::vector<Record>, KeyHash> ByPattern;
+    std::unordered_map<uint64_t, std::vector<Record>> ByTotal;
+    std::unordered_map<uint64_t, std::vector<Record>> OneSided;
+    // All records when the tolerance is not exact, sorted by total on the
+    // first lookup after an insert
+    mutable std::vector<Entry> Sorted;
+    mutable bool IsSorted = true;
+    // Result of the last tolerant lookup
+    mutable std::vector<Record> Matches;
+};
+
+#endif
@@ -0,0 +1,196 @@
+// This file is part of ASAP.
+// Please see LICENSE.txt for copyright and licensing information.
+
+#include "RangeChecks.h"
+#include "SCIPass.h"
+#include "SameLocation.h"
+#include "utils.h"
+#include "llvm/ADT/MapVector.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#if LLVM_VERSION_MAJOR >= 11
+#include "llvm/Transforms/Utils/ScalarEvolutionExpander.h"
+#else
+#include "llvm/Analysis/ScalarEvolutionExpander.h"
+#endif
+
+#include <cstdlib>
+#include <vector>
+#define DEBUG_TYPE "sr-range-checks"
+
+using namespace llvm;
+
+void insertRangeCheck(Instruction *InsertBefore, Value *Beg, Value *Size,
+                      uint64_t AccessSize, bool IsWrite,
+                      DominatorTree *DT, LoopInfo *LI) {
+    Module *M = InsertBefore->getModule();
+    LLVMContext &Ctx = M->getContext();
+    Type *IntptrTy = M->getDataLayout().getIntPtrType(Ctx);
+
+    IRBuilder<> IRB(InsertBefore);
+    FunctionCallee RegionFn = M->getOrInsertFunction("__asan_region_is_poisoned", IntptrTy, IntptrTy, IntptrTy);
+    Value *Poisoned = IRB.CreateCall(RegionFn, {Beg, Size}, "sr.poisoned");
+    Value *Cond = IRB.CreateICmpNE(Poisoned, ConstantInt::get(IntptrTy, 0));
+
+    MDNode *Weights = MDBuilder(Ctx).createBranchWeights(1, 100000);
+    Instruction *Term = SplitBlockAndInsertIfThen(Cond, InsertBefore, true, Weights, DT, LI);
+    IRB.SetInsertPoint(Term);
+    FunctionCallee ReportFn = M->getOrInsertFunction(IsWrite ? "__asan_report_store_n" : "__asan_report_load_n",
+                                                     Type::getVoidTy(Ctx), IntptrTy, IntptrTy);
+    CallInst *Report = IRB.CreateCall(ReportFn, {Poisoned, ConstantInt::get(IntptrTy, AccessSize)});
+    Report->setDoesNotReturn();
+}
+
+bool LoopRangeChecks::runOnModule(Module &M) {
+    SCI = &getAnalysis<SCIPass>();
+    bool Changed = false;
+    unsigned NumHoisted = 0;
+    for (Function &F: M) {
+        if (F.isDeclaration() || SCI->getSanityChecks(&F).empty()) {
+            continue;
+        }
+        LoopInfo &LI = getAnalysis<LoopInfoWrapperPass>(F).getLoopInfo();
+        DominatorTree &DT = getAnalysis<DominatorTreeWrapperPass>(F).getDomTree();
+        ScalarEvolution &SE = getAnalysis<ScalarEvolutionWrapperPass>(F).getSE();
+
+        // Checks by the innermost loop they run in
+        MapVector<Loop*, std::vector<Instruction*>> ChecksByLoop;
+        for (Instruction *SC: SCI->getSanityChecks(&F)) {
+            Instruction *Start = isa<BranchInst>(SC) ? SCI->getCheckBranches(SC).front() : SC;
+            if (Loop *L = LI.getLoopFor(Start->getParent())) {
+                ChecksByLoop[L].push_back(SC);
+            }
+        }
+        for (auto &Entry: ChecksByLoop) {
+            if (!isHoistable(Entry.first)) {
+                continue;
+            }
+            for (Instruction *SC: Entry.second) {
+                if (hoistRangeCheck(Entry.first, SC, SE, DT, LI)) {
+                    Changed = true;
+                    NumHoisted += 1;
+                }
+            }
+        }
+    }
+    eraseCallbackChecks(RemovedCalls);
+    errs() << "LoopRangeChecks on " << M.getSourceFileName() << ": " << NumHoisted << " checks hoisted\n";
+    return Changed;
+}
+
+// A loop whose iterations all run to the latch, unless a sanity check
+// aborts: it leaves only at its latch or into sanity check blocks, and it
+// calls nothing that might not return.
+bool LoopRangeChecks::isHoistable(Loop *L) {
+    BasicBlock *Latch = L->getLoopLatch();
+    if (!L->getLoopPreheader() || !Latch || !L->isLoopExiting(Latch)) {
+        return false;
+    }
+    const SCIPass::BlockSet &CheckBlocks = SCI->getSanityCheckBlocks(Latch->getParent());
+    for (BasicBlock *BB: L->blocks()) {
+        for (BasicBlock *Succ: successors(BB)) {
+            if (BB != Latch && !L->contains(Succ) && CheckBlocks.count(Succ) == 0) {
+                return false;
+            }
+        }
+        for (Instruction &I: *BB) {
+            CallInst *CI = dyn_cast<CallInst>(&I);
+            if (CI && !isa<IntrinsicInst>(CI) && !isCallbackCheck(CI) && !isAbortingCall(CI)) {
+                return false;
+            }
+            if (isa<InvokeInst>(&I)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool LoopRangeChecks::hoistRangeCheck(Loop *L, Instruction *Check, ScalarEvolution &SE,
+                                      DominatorTree &DT, LoopInfo &LI) {
+    BasicBlock *Preheader = L->getLoopPreheader();
+    BasicBlock *Latch = L->getLoopLatch();
+    // The exit count of the latch is the trip count, since the other exits
+    // abort
+    const SCEV *BackedgeTaken = SE.getExitCount(L, Latch);
+    if (isa<SCEVCouldNotCompute>(BackedgeTaken)) {
+        return false;
+    }
+
+    const SanityCheckInfo &Info = SCI->getCheckInfo(Check);
+    Value *Ptr = SameLocationOracle::getCheckedPointer(SCI, Check);
+    if (!Ptr || !Info.ReportCall || Info.ReportCall->getCalledFunction() == nullptr ||
+        Info.ReportCall->getCalledFunction()->getName().endswith("_noabort")) {
+        return false;
+    }
+    // The check must run on every iteration
+    Instruction *Start = isa<BranchInst>(Check) ? SCI->getCheckBranches(Check).front() : Check;
+    if (!DT.dominates(Start->getParent(), Latch)) {
+        return false;
+    }
+
+    const SCEVAddRecExpr *AR = dyn_cast<SCEVAddRecExpr>(SE.getSCEV(Ptr));
+    if (!AR || AR->getLoop() != L || !AR->isAffine() ||
+        !(AR->hasNoSelfWrap() || AR->hasNoUnsignedWrap() || AR->hasNoSignedWrap())) {
+        return false;
+    }
+    const SCEVConstant *Step = dyn_cast<SCEVConstant>(AR->getStepRecurrence(SE));
+    if (!Step) {
+        return false;
+    }
+    int64_t StepVal = Step->getAPInt().getSExtValue();
+    if (StepVal == 0 || (uint64_t)std::llabs(StepVal) > Info.AccessSize) {
+        return false;
+    }
+    const SCEV *First = AR->getStart();
+    const SCEV *Last = AR->evaluateAtIteration(BackedgeTaken, SE);
+    const SCEV *Low = StepVal > 0 ? First : Last;
+    const SCEV *High = StepVal > 0 ? Last : First;
+    Instruction *InsertBefore = Preheader->getTerminator();
+    if (!isSafeToExpandAt(Low, InsertBefore, SE) || !isSafeToExpandAt(High, InsertBefore, SE)) {
+        return false;
+    }
+
+    LLVM_DEBUG(dbgs() << "Hoisting " << *Check << " over [" << *Low << ", " << *High << "]\n");
+    const DataLayout &DL = Preheader->getModule()->getDataLayout();
+    Type *IntptrTy = DL.getIntPtrType(Ptr->getContext());
+    SCEVExpander Expander(SE, DL, "sr.range");
+    Value *LowV = Expander.expandCodeFor(Low, Ptr->getType(), InsertBefore);
+    Value *HighV = Expander.expandCodeFor(High, Ptr->getType(), InsertBefore);
+    IRBuilder<> IRB(InsertBefore);
+    Value *Beg = IRB.CreatePtrToInt(LowV, IntptrTy);
+    Value *End = IRB.CreateAdd(IRB.CreatePtrToInt(HighV, IntptrTy), ConstantInt::get(IntptrTy, Info.AccessSize));
+    insertRangeCheck(InsertBefore, Beg, IRB.CreateSub(End, Beg), Info.AccessSize,
+                     Info.Kind == SanityCheckInfo::Store, &DT, &LI);
+
+    if (isa<CallInst>(Check)) {
+        RemovedCalls.insert(Check);
+    }
+    else {
+        foldSanityCheck(cast<BranchInst>(Check), SCI);
+    }
+    return true;
+}
+
+void LoopRangeChecks::getAnalysisUsage(AnalysisUsage& AU) const {
+    AU.addRequired<SCIPass>();
+    AU.addRequired<DominatorTreeWrapperPass>();
+    AU.addRequired<LoopInfoWrapperPass>();
+    AU.addRequired<ScalarEvolutionWrapperPass>();
+}
+
+char LoopRangeChecks::ID = 0;
+static RegisterPass<LoopRangeChecks> X("sr-range-checks",
+        "Hoists ASan checks of affine loop accesses into one range check", false, false);
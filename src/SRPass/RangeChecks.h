@@ -0,0 +1,60 @@
+// This file is part of ASAP.
+// Please see LICENSE.txt for copyright and licensing information.
+
+#ifndef SRPASS_RANGECHECKS_H
+#define SRPASS_RANGECHECKS_H
+
+#include "llvm/Pass.h"
+
+#include <cstdint>
+#include <set>
+
+namespace llvm {
+    class DominatorTree;
+    class Instruction;
+    class Loop;
+    class LoopInfo;
+    class ScalarEvolution;
+    class Value;
+}
+
+struct SCIPass;
+
+// Inserts an ASan check of the Size bytes at integer address Beg before
+// InsertBefore. The check asks the ASan runtime for the first poisoned byte
+// of the range and reports an access of AccessSize bytes there, so one
+// check covers the accesses of several original checks. DT and LI, if
+// given, are kept up to date.
+void insertRangeCheck(llvm::Instruction *InsertBefore, llvm::Value *Beg, llvm::Value *Size,
+                      uint64_t AccessSize, bool IsWrite,
+                      llvm::DominatorTree *DT, llvm::LoopInfo *LI);
+
+// Replaces the ASan checks of affine accesses in a loop with one check of
+// the whole accessed range in the loop preheader. A check qualifies if it
+// runs on every iteration of a loop with a computable trip count that only
+// exits at its latch or into sanity check blocks and calls nothing that
+// might not return, its pointer is an add recurrence of that loop that
+// does not wrap, and the accesses leave no gaps (|step| <= access size), so
+// the range holds no byte that the loop would not access. Only aborting
+// checks are hoisted; recovering ones would report once instead of per
+// access.
+struct LoopRangeChecks : public llvm::ModulePass {
+    static char ID;
+
+    LoopRangeChecks() : ModulePass(ID) {}
+
+    virtual bool runOnModule(llvm::Module &M);
+
+    virtual void getAnalysisUsage(llvm::AnalysisUsage& AU) const;
+
+private:
+    SCIPass *SCI;
+    // Callback checks to erase at the end of runOnModule
+    std::set<llvm::Instruction*> RemovedCalls;
+
+    bool isHoistable(llvm::Loop *L);
+    bool hoistRangeCheck(llvm::Loop *L, llvm::Instruction *Check, llvm::ScalarEvolution &SE,
+                         llvm::DominatorTree &DT, llvm::LoopInfo &LI);
+};
+
+#endif
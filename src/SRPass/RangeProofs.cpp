@@ -0,0 +1,158 @@
+// This file is part of ASAP.
+// Please see LICENSE.txt for copyright and licensing information.
+
+#include "RangeProofs.h"
+#include "SCIPass.h"
+#include "utils.h"
+#include "llvm/Analysis/LazyValueInfo.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Operator.h"
+#include "llvm/IR/PatternMatch.h"
+#include "llvm/Support/Debug.h"
+
+#include <vector>
+#define DEBUG_TYPE "sr-prove-checks"
+
+using namespace llvm;
+using namespace llvm::PatternMatch;
+
+bool ProveChecks::runOnModule(Module &M) {
+    SCI = &getAnalysis<SCIPass>();
+    unsigned NumProven = 0, NumPredicates = 0, NumChecks = 0;
+    for (Function &F: M) {
+        if (F.isDeclaration() || SCI->getSCBranches(&F).empty()) {
+            continue;
+        }
+        LVI = &getAnalysis<LazyValueInfoWrapperPass>(F).getLVI();
+        SE = &getAnalysis<ScalarEvolutionWrapperPass>(F).getSE();
+        for (Instruction *SC: SCI->getSCBranches(&F)) {
+            const SanityCheckInfo &Info = SCI->getCheckInfo(SC);
+            BranchInst *BI = cast<BranchInst>(SC);
+            if (!Info.isUBSan() || SCI->getCheckBranches(SC).size() != 1) {
+                continue;
+            }
+            unsigned RegularBranch = getRegularBranch(BI, SCI);
+            if (RegularBranch > 1) {
+                continue;
+            }
+            NumChecks += 1;
+            const std::vector<Use*> &SubChecks = SCI->getSubChecks(SC);
+            if (SubChecks.empty()) {
+                Outcome Passes = RegularBranch == 0 ? AlwaysTrue : AlwaysFalse;
+                if (evaluate(BI->getCondition(), BI) == Passes) {
+                    LLVM_DEBUG(dbgs() << "Proven: " << *BI->getCondition() << "\n");
+                    foldSanityCheck(BI, SCI);
+                    NumProven += 1;
+                }
+                continue;
+            }
+            // A predicate of an or fails the check if it holds, one of an
+            // and if it does not
+            for (Use *Sub: SubChecks) {
+                if (isa<Constant>(Sub->get())) {
+                    continue;
+                }
+                Instruction *Op = cast<Instruction>(Sub->getUser());
+                Outcome Passes = Op->getOpcode() == Instruction::Or ? AlwaysFalse : AlwaysTrue;
+                if (evaluate(Sub->get(), BI) == Passes) {
+                    LLVM_DEBUG(dbgs() << "Proven predicate: " << *Sub->get() << "\n");
+                    NumPredicates += 1;
+                    if (removeSubCheck(BI, Sub, SCI)) {
+                        NumProven += 1;
+                    }
+                }
+            }
+        }
+    }
+    errs() << "ProveChecks on " << M.getSourceFileName() << ": " << NumProven << " of " << NumChecks
+           << " UBSan checks proven, " << NumPredicates << " fused predicates proven\n";
+    return NumProven > 0 || NumPredicates > 0;
+}
+
+ProveChecks::Outcome ProveChecks::evaluate(Value *V, Instruction *CxtI, unsigned Depth) {
+    if (ConstantInt *C = dyn_cast<ConstantInt>(V)) {
+        return C->isZero() ? AlwaysFalse : AlwaysTrue;
+    }
+    if (Depth > 6) {
+        return Unknown;
+    }
+    Value *X, *Y;
+    if (match(V, m_Not(m_Value(X)))) {
+        Outcome O = evaluate(X, CxtI, Depth + 1);
+        return O == Unknown ? Unknown : (O == AlwaysTrue ? AlwaysFalse : AlwaysTrue);
+    }
+    if (match(V, m_And(m_Value(X), m_Value(Y)))) {
+        Outcome OX = evaluate(X, CxtI, Depth + 1);
+        Outcome OY = evaluate(Y, CxtI, Depth + 1);
+        if (OX == AlwaysFalse || OY == AlwaysFalse) {
+            return AlwaysFalse;
+        }
+        return OX == AlwaysTrue && OY == AlwaysTrue ? AlwaysTrue : Unknown;
+    }
+    if (match(V, m_Or(m_Value(X), m_Value(Y)))) {
+        Outcome OX = evaluate(X, CxtI, Depth + 1);
+        Outcome OY = evaluate(Y, CxtI, Depth + 1);
+        if (OX == AlwaysTrue || OY == AlwaysTrue) {
+            return AlwaysTrue;
+        }
+        return OX == AlwaysFalse && OY == AlwaysFalse ? AlwaysFalse : Unknown;
+    }
+    // The overflow flag of a *.with.overflow intrinsic
+    if (ExtractValueInst *EV = dyn_cast<ExtractValueInst>(V)) {
+        WithOverflowInst *WO = dyn_cast<WithOverflowInst>(EV->getAggregateOperand());
+        if (!WO || EV->getNumIndices() != 1 || EV->getIndices()[0] != 1) {
+            return Unknown;
+        }
+        ConstantRange NoWrap = ConstantRange::makeGuaranteedNoWrapRegion(
+                WO->getBinaryOp(), getRange(WO->getRHS(), CxtI),
+                WO->isSigned() ? OverflowingBinaryOperator::NoSignedWrap : OverflowingBinaryOperator::NoUnsignedWrap);
+        return NoWrap.contains(getRange(WO->getLHS(), CxtI)) ? AlwaysFalse : Unknown;
+    }
+    if (ICmpInst *Cmp = dyn_cast<ICmpInst>(V)) {
+        if (!Cmp->getOperand(0)->getType()->isIntegerTy()) {
+            return Unknown;
+        }
+        ConstantRange L = getRange(Cmp->getOperand(0), CxtI);
+        ConstantRange R = getRange(Cmp->getOperand(1), CxtI);
+        if (L.icmp(Cmp->getPredicate(), R)) {
+            return AlwaysTrue;
+        }
+        if (L.icmp(Cmp->getInversePredicate(), R)) {
+            return AlwaysFalse;
+        }
+    }
+    return Unknown;
+}
+
+ConstantRange ProveChecks::getRange(Value *V, Instruction *CxtI) {
+    if (ConstantInt *C = dyn_cast<ConstantInt>(V)) {
+        return ConstantRange(C->getValue());
+    }
+#if LLVM_VERSION_MAJOR >= 12
+    ConstantRange Range = LVI->getConstantRange(V, CxtI, false);
+#else
+    ConstantRange Range = LVI->getConstantRange(V, CxtI->getParent(), CxtI);
+#endif
+    if (SE->isSCEVable(V->getType())) {
+        const SCEV *S = SE->getSCEV(V);
+        Range = Range.intersectWith(SE->getSignedRange(S));
+        Range = Range.intersectWith(SE->getUnsignedRange(S));
+    }
+    return Range;
+}
+
+void ProveChecks::getAnalysisUsage(AnalysisUsage& AU) const {
+    AU.addRequired<SCIPass>();
+    AU.addRequired<LazyValueInfoWrapperPass>();
+    AU.addRequired<ScalarEvolutionWrapperPass>();
+}
+
+char ProveChecks::ID = 0;
+static RegisterPass<ProveChecks> X("sr-prove-checks",
+        "Removes UBSan checks whose conditions are proven by value ranges", false, false);
@@ -0,0 +1,53 @@
+// This file is part of ASAP.
+// Please see LICENSE.txt for copyright and licensing information.
+
+#ifndef SRPASS_RANGEPROOFS_H
+#define SRPASS_RANGEPROOFS_H
+
+#include "llvm/Pass.h"
+#include "llvm/IR/ConstantRange.h"
+
+namespace llvm {
+    class Instruction;
+    class LazyValueInfo;
+    class ScalarEvolution;
+    class Value;
+}
+
+struct SCIPass;
+
+// Removes UBSan checks that can never fail. A check condition is evaluated
+// over the ranges its operands may take, as known to LazyValueInfo and to
+// ScalarEvolution: overflow flags are false if the operand ranges lie in
+// the region where the operation cannot wrap, compares are decided if
+// their operand ranges decide them, and and/or/not combine the results.
+// This covers, for example, induction variables bounded by the trip
+// count, values masked to a small range and shifts by bounded amounts.
+// Predicates of fused checks are removed one by one. Since the proof does
+// not depend on a profile, the pass is meant to run before profiling.
+struct ProveChecks : public llvm::ModulePass {
+    static char ID;
+
+    ProveChecks() : ModulePass(ID) {}
+
+    virtual bool runOnModule(llvm::Module &M);
+
+    virtual void getAnalysisUsage(llvm::AnalysisUsage& AU) const;
+
+private:
+    SCIPass *SCI;
+    llvm::LazyValueInfo *LVI;
+    llvm::ScalarEvolution *SE;
+
+    enum Outcome {
+        Unknown,
+        AlwaysFalse,
+        AlwaysTrue
+    };
+    // The value of the boolean V right before CxtI
+    Outcome evaluate(llvm::Value *V, llvm::Instruction *CxtI, unsigned Depth = 0);
+    // The values the integer V may take right before CxtI
+    llvm::ConstantRange getRange(llvm::Value *V, llvm::Instruction *CxtI);
+};
+
+#endif
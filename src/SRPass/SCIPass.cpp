@@ -4,16 +4,22 @@
 #include "SCIPass.h"
 #include "utils.h"
 #include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/Config/llvm-config.h"
 #include "llvm/Pass.h"
+#include "llvm/IR/Constants.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/Metadata.h"
 #include "llvm/IR/CFG.h"
 #include "llvm/Support/Debug.h"
 #include "llvm/IR/Module.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Operator.h"
+#include "llvm/IR/PatternMatch.h"
 #define DEBUG_TYPE "sanity-check-instructions"
 
 using namespace llvm;
+using namespace llvm::PatternMatch;
 
 bool SCIPass::runOnModule(Module &M) {
     errs() << "Start SCIPass on " << M.getSourceFileName() << "\n";
@@ -21,8 +27,14 @@ bool SCIPass::runOnModule(Module &M) {
         SanityCheckBlocks[&F] = BlockSet();
         SanityCheckInstructions[&F] = InstructionSet();
         SCBranches[&F] = InstructionVec();
+        SCCalls[&F] = InstructionVec();
         UCBranches[&F] = InstructionVec();
         findInstructions(&F);
+        groupCheckBranches(&F);
+        decomposeChecks(&F);
+
+        SanityChecks[&F] = SCBranches[&F];
+        SanityChecks[&F].insert(SanityChecks[&F].end(), SCCalls[&F].begin(), SCCalls[&F].end());
 
         MDNode *MD = MDNode::get(M.getContext(), {});
         for (Instruction *Inst: SanityCheckInstructions[&F]) {
@@ -49,8 +61,9 @@ void SCIPass::findInstructions(Function *F) {
     // FILE *ff = fopen("./Cov/checkh.txt", "ab");
     for (BasicBlock &BB: *F) {
 
-        if (findSanityCheckCall(&BB)) {
+        if (const CallInst *CI = findSanityCheckCall(&BB)) {
             SanityCheckBlocks[F].insert(&BB);
+            SanityCheckInfo Info = classifyCheck(CI);
 
             // All instructions inside sanity check blocks are sanity check instructions
             for (Instruction &I: BB) {
@@ -65,6 +78,10 @@ void SCIPass::findInstructions(Function *F) {
                 BranchInst *BI = dyn_cast<BranchInst>(U);
                 if (BI && BI->isConditional()) {
                     SCBranches[F].push_back(BI);
+                    CheckInfos[BI] = Info;
+                    if (!Info.Operand) {
+                        classifyCondition(BI, CheckInfos[BI]);
+                    }
                     // fprintf(ff, "%s ", F->getName());
                     // for (Instruction &I: *BI->getParent()){
                     //     fprintf(ff, ":%s",I.getOpcodeName());
@@ -86,6 +103,18 @@ void SCIPass::findInstructions(Function *F) {
             }
         }
         // ******
+
+        // Callback checks do not branch anywhere; the call itself is the check
+        for (Instruction &I: BB) {
+            CallInst *CI = dyn_cast<CallInst>(&I);
+            if (CI && isCallbackCheck(CI)) {
+                SCCalls[F].push_back(CI);
+                CheckInfos[CI] = classifyCheck(CI);
+                ChecksByInstruction[CI].insert(CI);
+                Worklist.insert(CI);
+            }
+        }
+        // ******
     }
 
     while (!Worklist.empty()) {
@@ -158,6 +187,119 @@ void SCIPass::findInstructions(Function *F) {
     // fclose(ff);
 }
 
+void SCIPass::groupCheckBranches(Function *F) {
+    for (Instruction *SC: SCBranches[F]) {
+        CheckBranches[SC].push_back(SC);
+        CheckHeads[SC] = SC;
+    }
+    // Another conditional branch that only serves a check belongs to it if
+    // it lies on the check's way to the report: one edge leads to the check
+    // branch or the report, the other to where the check continues, like
+    // ASan's fast path in front of the slow path. A user branch whose side
+    // only holds check instructions does not have that shape.
+    for (Instruction *SC: SCBranches[F]) {
+        auto IBS = InstructionsBySanityCheck.find(SC);
+        if (IBS == InstructionsBySanityCheck.end()) {
+            continue;
+        }
+        BranchInst *SCBI = cast<BranchInst>(SC);
+        BasicBlock *Report = nullptr, *Cont = nullptr;
+        for (BasicBlock *Succ: successors(SCBI)) {
+            if (SanityCheckBlocks[F].count(Succ)) {
+                Report = Succ;
+            }
+            else {
+                Cont = Succ;
+            }
+        }
+        if (!Report || !Cont) {
+            continue;
+        }
+        for (Instruction *Inst: IBS->second) {
+            BranchInst *BI = dyn_cast<BranchInst>(Inst);
+            if (!BI || !BI->isConditional() || BI == SC) {
+                continue;
+            }
+            BasicBlock *Fail = BI->getSuccessor(0), *Pass = BI->getSuccessor(1);
+            if (Fail == Cont) {
+                std::swap(Fail, Pass);
+            }
+            if (Pass != Cont || (Fail != SC->getParent() && Fail != Report)) {
+                continue;
+            }
+            if (CheckHeads.insert(std::make_pair(BI, SC)).second) {
+                CheckBranches[SC].push_front(BI);
+            }
+        }
+    }
+}
+
+void SCIPass::decomposeChecks(Function *F) {
+    for (Instruction *SC: SCBranches[F]) {
+        if (CheckBranches[SC].size() != 1) {
+            continue;
+        }
+        BranchInst *BI = cast<BranchInst>(SC);
+        Instruction *Cond = dyn_cast<Instruction>(BI->getCondition());
+        if (!Cond || !Cond->hasOneUse()) {
+            continue;
+        }
+        // The check fails as soon as one predicate does: an or of failure
+        // conditions when the report is on the true edge, an and of success
+        // conditions when it is on the false edge
+        unsigned int RegularBranch = getRegularBranch(BI, this);
+        unsigned Opcode;
+        if (RegularBranch == 1) {
+            Opcode = Instruction::Or;
+        } else if (RegularBranch == 0) {
+            Opcode = Instruction::And;
+        } else {
+            continue;
+        }
+        if (Cond->getOpcode() != Opcode) {
+            continue;
+        }
+        std::vector<Use*> Subs;
+        collectSubChecks(Cond, Opcode, Subs);
+        if (Subs.size() > 1) {
+            SubChecks[SC] = Subs;
+        }
+    }
+}
+
+// Flattens a tree of the given opcode into the uses of its leaves. Inner
+// nodes must only feed the tree, since their operands are rewritten in place.
+void SCIPass::collectSubChecks(Instruction *Op, unsigned Opcode, std::vector<Use*> &Subs) {
+    for (Use &U: Op->operands()) {
+        if (isa<Constant>(U.get())) {
+            continue;
+        }
+        Instruction *Inst = dyn_cast<Instruction>(U.get());
+        if (Inst && Inst->getOpcode() == Opcode && Inst->hasOneUse()) {
+            collectSubChecks(Inst, Opcode, Subs);
+        } else {
+            Subs.push_back(&U);
+        }
+    }
+}
+
+const std::vector<Use*> &SCIPass::getSubChecks(Instruction *Inst) const {
+    static const std::vector<Use*> NoSubChecks;
+    auto It = SubChecks.find(Inst);
+    return It == SubChecks.end() ? NoSubChecks : It->second;
+}
+
+bool SCIPass::isCheckSuccessor(BranchInst *BI, BasicBlock *Succ) const {
+    Function *F = BI->getParent()->getParent();
+    if (SanityCheckBlocks.at(F).count(Succ)) {
+        return true;
+    }
+    auto Head = CheckHeads.find(BI);
+    auto SuccHead = CheckHeads.find(Succ->getTerminator());
+    return Head != CheckHeads.end() && SuccHead != CheckHeads.end() &&
+        SuccHead->first != BI && SuccHead->second == Head->second;
+}
+
 const CallInst *SCIPass::findSanityCheckCall(BasicBlock* BB) const {
     for (const Instruction &I: *BB) {
         if (const CallInst *CI = dyn_cast<CallInst>(&I)) {
@@ -169,6 +311,180 @@ const CallInst *SCIPass::findSanityCheckCall(BasicBlock* BB) const {
     return 0;
 }
 
+// Strips the casts that sanitizers insert when passing values to handlers.
+static Value *stripHandlerCasts(Value *V) {
+    while (Operator *Op = dyn_cast<Operator>(V)) {
+        if (!Instruction::isCast(Op->getOpcode())) {
+            break;
+        }
+        V = Op->getOperand(0);
+    }
+    return V;
+}
+
+// The argument of llvm.ubsantrap is the number of the handler the check
+// would call without -fsanitize-trap, in the order of clang's
+// SanitizerHandler enum. The numbers below are those of clang 13 and 14;
+// clang 12 numbers the handlers differently, so its traps are classified
+// by their condition only.
+static SanityCheckInfo::HandlerKind getTrapKind(uint64_t Handler) {
+#if LLVM_VERSION_MAJOR < 13
+    return SanityCheckInfo::UnknownHandler;
+#else
+    switch (Handler) {
+    case 0:  // AddOverflow
+    case 12: // MulOverflow
+    case 13: // NegateOverflow
+    case 19: // PointerOverflow
+    case 21: // SubOverflow
+        return SanityCheckInfo::Overflow;
+    case 3:  // DivremOverflow
+        return SanityCheckInfo::Div;
+    case 14: // NullabilityArg
+    case 15: // NullabilityReturn
+    case 16: // NonnullArg
+    case 17: // NonnullReturn
+    case 22: // TypeMismatch
+        return SanityCheckInfo::Null;
+    case 18: // OutOfBounds
+        return SanityCheckInfo::Bounds;
+    case 20: // ShiftOutOfBounds
+        return SanityCheckInfo::Shift;
+    default:
+        return SanityCheckInfo::UnknownHandler;
+    }
+#endif
+}
+
+SanityCheckInfo SCIPass::classifyCheck(const CallInst *CI) {
+    SanityCheckInfo Info;
+    Info.ReportCall = CI;
+    const Function *Callee = CI->getCalledFunction();
+    if (!Callee) {
+        return Info;
+    }
+    StringRef Name = Callee->getName();
+    unsigned NumArgs = CI->arg_size();
+
+    // __asan_report_[exp_]{load,store}{1,2,4,8,16,_n}[_noabort](addr[, size])
+    // and the callbacks __asan_[exp_]{load,store}{1,2,4,8,16,N}[_noabort]
+    if (Name.consume_front("__asan_report_") ||
+        (isCallbackCheck(CI) && Name.consume_front("__asan_"))) {
+        Info.Sanitizer = SanityCheckInfo::ASan;
+        Name.consume_front("exp_");
+        if (Name.consume_front("load")) {
+            Info.Kind = SanityCheckInfo::Load;
+        }
+        else if (Name.consume_front("store")) {
+            Info.Kind = SanityCheckInfo::Store;
+        }
+        if (NumArgs > 0) {
+            Info.Operand = stripHandlerCasts(CI->getArgOperand(0));
+        }
+        uint64_t Size = 0;
+        if (Name.startswith("_n") || Name.startswith("N")) {
+            if (NumArgs > 1) {
+                if (ConstantInt *C = dyn_cast<ConstantInt>(CI->getArgOperand(1))) {
+                    Info.AccessSize = C->getZExtValue();
+                }
+            }
+        }
+        else if (!Name.consumeInteger(10, Size)) {
+            Info.AccessSize = Size;
+        }
+    }
+    else if (Name.consume_front("__ubsan_handle_")) {
+        // Most handlers take (data, value[, value]); the operand we are
+        // interested in is the one whose range is actually checked.
+        Info.Sanitizer = SanityCheckInfo::UBSan;
+        unsigned OperandIdx = 1;
+        if (Name.startswith("add_overflow") || Name.startswith("sub_overflow") ||
+            Name.startswith("mul_overflow") || Name.startswith("negate_overflow") ||
+            Name.startswith("pointer_overflow")) {
+            Info.Kind = SanityCheckInfo::Overflow;
+        }
+        else if (Name.startswith("shift_out_of_bounds")) {
+            Info.Kind = SanityCheckInfo::Shift;
+            OperandIdx = 2;
+        }
+        else if (Name.startswith("divrem_overflow")) {
+            Info.Kind = SanityCheckInfo::Div;
+            OperandIdx = 2;
+        }
+        else if (Name.startswith("type_mismatch") || Name.startswith("nonnull_") ||
+                 Name.startswith("nullability_")) {
+            Info.Kind = SanityCheckInfo::Null;
+        }
+        else if (Name.startswith("out_of_bounds")) {
+            Info.Kind = SanityCheckInfo::Bounds;
+        }
+        // The minimal runtime's handlers take no arguments at all
+        if (NumArgs > OperandIdx) {
+            Info.Operand = stripHandlerCasts(CI->getArgOperand(OperandIdx));
+        }
+        setAccessSize(Info);
+    }
+    else if (Callee->getIntrinsicID() == Intrinsic::trap || isUBSanTrap(Callee)) {
+        // Only UBSan emits trapping checks (-fsanitize-trap). The operand is
+        // recovered from the branch condition, and so is the kind unless
+        // llvm.ubsantrap names the handler.
+        Info.Sanitizer = SanityCheckInfo::UBSan;
+        if (isUBSanTrap(Callee) && NumArgs > 0) {
+            if (ConstantInt *C = dyn_cast<ConstantInt>(CI->getArgOperand(0))) {
+                Info.Kind = getTrapKind(C->getZExtValue());
+            }
+        }
+    }
+    return Info;
+}
+
+
+void SCIPass::classifyCondition(const BranchInst *BI, SanityCheckInfo &Info) {
+    Value *Cond = BI->getCondition();
+    Value *NotCond = nullptr;
+    // clang branches on the negated overflow bit (no overflow -> continue)
+    if (match(Cond, m_Not(m_Value(NotCond)))) {
+        Cond = NotCond;
+    }
+    if (ExtractValueInst *EV = dyn_cast<ExtractValueInst>(Cond)) {
+        if (IntrinsicInst *II = dyn_cast<IntrinsicInst>(EV->getAggregateOperand())) {
+            switch (II->getIntrinsicID()) {
+            case Intrinsic::sadd_with_overflow:
+            case Intrinsic::uadd_with_overflow:
+            case Intrinsic::ssub_with_overflow:
+            case Intrinsic::usub_with_overflow:
+            case Intrinsic::smul_with_overflow:
+            case Intrinsic::umul_with_overflow:
+                if (Info.Kind == SanityCheckInfo::UnknownHandler) {
+                    Info.Kind = SanityCheckInfo::Overflow;
+                }
+                Info.Operand = II->getArgOperand(0);
+                break;
+            default:
+                break;
+            }
+        }
+    }
+    else if (CmpInst *Cmp = dyn_cast<CmpInst>(Cond)) {
+        // Shift, division and bounds checks compare the checked value
+        // against a constant limit
+        for (Use &U: Cmp->operands()) {
+            if (!isa<Constant>(U.get())) {
+                Info.Operand = stripHandlerCasts(U.get());
+                break;
+            }
+        }
+    }
+    setAccessSize(Info);
+}
+
+void SCIPass::setAccessSize(SanityCheckInfo &Info) {
+    if (Info.Operand && Info.Operand->getType()->isSized() && Info.ReportCall) {
+        const DataLayout &DL = Info.ReportCall->getModule()->getDataLayout();
+        Info.AccessSize = DL.getTypeStoreSize(Info.Operand->getType());
+    }
+}
+
 bool SCIPass::onlyUsedInSanityChecks(Value* V) {
     for (User *U: V->users()) {
         Instruction *Inst = dyn_cast<Instruction>(U);
@@ -10,6 +10,7 @@
 #include <map>
 #include <set>
 #include <list>
+#include <vector>
 
 namespace llvm {
     class AnalysisUsage;
@@ -22,6 +23,43 @@ namespace llvm {
     class dyn_cast;
 }
 
+// Classification of a sanity check: which sanitizer emitted it, what kind of
+// handler it reports to, and which pointer or value it guards. SCIPass computes
+// this once per check so that passes do not have to rediscover it.
+struct SanityCheckInfo {
+    enum SanitizerKind {
+        UnknownSanitizer,
+        ASan,
+        UBSan
+    };
+
+    enum HandlerKind {
+        UnknownHandler,
+        // __asan_report_*
+        Load,
+        Store,
+        // __ubsan_handle_*
+        Overflow,
+        Shift,
+        Div,
+        Null,
+        Bounds
+    };
+
+    SanitizerKind Sanitizer = UnknownSanitizer;
+    HandlerKind Kind = UnknownHandler;
+    // The checked pointer (ASan) or value (UBSan), with casts stripped.
+    llvm::Value *Operand = nullptr;
+    // Access size in bytes for ASan, store size of the checked value for UBSan.
+    // Zero if unknown.
+    uint64_t AccessSize = 0;
+    // The handler call the check reports to.
+    const llvm::CallInst *ReportCall = nullptr;
+
+    bool isASan() const { return Sanitizer == ASan; }
+    bool isUBSan() const { return Sanitizer == UBSan; }
+};
+
 // struct BranchInfo {
 //     static llvm::StringRef BranchName;
 //     void insert(llvm::Instruction *Inst) {
@@ -66,6 +104,18 @@ struct SCIPass : public llvm::ModulePass {
         return SCBranches.at(F);
     }
 
+    // ASan callback checks (__asan_load4 and friends), emitted instead of
+    // inline checks above -asan-instrumentation-with-call-threshold
+    const InstructionVec &getSCCalls(llvm::Function *F) const {
+        return SCCalls.at(F);
+    }
+
+    // All sanity checks of a function: the check branches followed by the
+    // callback checks. Profiles are recorded and read in this order.
+    const InstructionVec &getSanityChecks(llvm::Function *F) const {
+        return SanityChecks.at(F);
+    }
+
     const InstructionVec &getSCBranchesV(llvm::Function *F) const {
         return SCBranchesV.at(F);
     }
@@ -86,9 +136,37 @@ struct SCIPass : public llvm::ModulePass {
         return ChecksByInstruction.at(Inst);
     }
 
+    const SanityCheckInfo &getCheckInfo(llvm::Instruction *Inst) const {
+        return CheckInfos.at(Inst);
+    }
+
+    // The branches that make up a check, ending with the check branch itself.
+    // ASan checks of accesses smaller than a shadow granule have a fast-path
+    // branch on the shadow byte in front of the slow-path branch that leads
+    // to the report; both are one check with one profile entry.
+    const InstructionVec &getCheckBranches(llvm::Instruction *Inst) const {
+        return CheckBranches.at(Inst);
+    }
+
+    // Operand slots of the predicates that a check branch fuses with and/or,
+    // as left behind by the optimiser for adjacent overflow or bounds checks.
+    // Each predicate is a sub-check that can be rewritten out of the
+    // condition on its own. Empty if the check is not fused.
+    const std::vector<llvm::Use*> &getSubChecks(llvm::Instruction *Inst) const;
+
+    // Returns true if Succ lies on the failing side of the check that BI
+    // belongs to: a sanity check block, or the next branch of the same check.
+    bool isCheckSuccessor(llvm::BranchInst *BI, llvm::BasicBlock *Succ) const;
+
     // Searches the given basic block for a call instruction that corresponds to
     // a sanity check and will abort the program (e.g., __assert_fail).
     const llvm::CallInst *findSanityCheckCall(llvm::BasicBlock *BB) const;
+
+    // Classifies the check that reports through the given handler call.
+    static SanityCheckInfo classifyCheck(const llvm::CallInst *CI);
+    // Fills in the kind and operand of a check whose handler call does not
+    // name them (trapping and minimal-runtime UBSan checks).
+    static void classifyCondition(const llvm::BranchInst *BI, SanityCheckInfo &Info);
     
 private:
 
@@ -104,9 +182,26 @@ private:
     // All sanity checks themselves (branch instructions that could lead to an abort)
     std::map<llvm::Function*, InstructionVec> SCBranches;
     std::map<llvm::Function*, InstructionVec> SCBranchesV;
+    std::map<llvm::Function*, InstructionVec> SCCalls;
+    std::map<llvm::Function*, InstructionVec> SanityChecks;
 
     std::map<llvm::Function*, InstructionVec> UCBranches;
 
+    // Classification of each sanity check branch and callback check
+    std::map<llvm::Instruction*, SanityCheckInfo> CheckInfos;
+
+    // Branches of multi-branch checks, and the check branch each belongs to
+    std::map<llvm::Instruction*, InstructionVec> CheckBranches;
+    std::map<llvm::Instruction*, llvm::Instruction*> CheckHeads;
+
+    // Predicates of check branches with a fused condition
+    std::map<llvm::Instruction*, std::vector<llvm::Use*>> SubChecks;
+
     void findInstructions(llvm::Function *F);
+    void groupCheckBranches(llvm::Function *F);
+    void decomposeChecks(llvm::Function *F);
+    static void collectSubChecks(llvm::Instruction *Op, unsigned Opcode,
+                                 std::vector<llvm::Use*> &Subs);
     bool onlyUsedInSanityChecks(llvm::Value *V);
+    static void setAccessSize(SanityCheckInfo &Info);
 };
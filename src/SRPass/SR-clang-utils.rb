@@ -60,6 +60,12 @@ def find_llc()
   llc
 end
 
+def find_llvm_link()
+  llvm_link = $0.sub(/SR-clang(\+\+)?$/, 'llvm-link')
+  raise "cannot find llvm-link" if $0 == llvm_link
+  llvm_link
+end
+
 def find_ar()
   which('ar')
 end
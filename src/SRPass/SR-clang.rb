@@ -11,6 +11,9 @@
 #   Prepares the compilation with coverage instrumentation. After this step,
 #   the software should be compiled again, and the resulting binary will be
 #   instrumented for coverage.
+# - Alternatively: -SR-static
+#   Reduces checks without coverage. Every TU is reduced by StaPass when it
+#   is compiled, so no profiling run is needed.
 
 # This file is part of SanRazor.
 # Please see LICENSE.txt for copyright and licensing information.
@@ -95,6 +98,8 @@ class SRState
       SROptimizingCompiler.new(self)
     elsif current_state == :sanitizer
       SRSanCompiler.new(self)
+    elsif current_state == :static
+      SRStaticCompiler.new(self)
     else
       raise "Unknown SR state: #{current_state}"
     end
@@ -228,6 +233,7 @@ class SRInitialCompiler < BaseCompiler
         clang_args = cmd[1..-1]
         clang_args = ['-gline-tables-only',"-flto"] + clang_args
         run!(clang, *clang_args, "-o", orig_name)
+        prune_checks(orig_name)
         
         run!("#{state.state_path}/../coverage.sh",target_cov_name,target_global_name, "#{state.state_path}"+"/", cmd_copy)
 
@@ -256,6 +262,7 @@ class SRInitialCompiler < BaseCompiler
         clang_args = cmd[1..-1]
         clang_args = ['-gline-tables-only',"-flto"] + clang_args
         run!(clang, *clang_args, "-o", orig_name)
+        prune_checks(orig_name)
         
         run!("#{state.state_path}/../coverage.sh",target_cov_name,target_global_name, "#{state.state_path}"+"/", cmd_copy)
 
@@ -274,6 +281,26 @@ class SRInitialCompiler < BaseCompiler
     end
   end
 
+  # Checks that provably never fail are removed before profiling: UBSan
+  # checks by sr-prove-checks with SR_PROVE_CHECKS=1, ASan checks of
+  # accesses inside objects of known size by sr-object-bounds with
+  # SR_OBJECT_BOUNDS=1, and checks implied by checks in callers or callees
+  # by sr-check-summaries with SR_CHECK_SUMMARIES=1. The passes only fold
+  # the check branches; simplifycfg then deletes the edges to the report
+  # blocks, so that DCC and the reducers no longer see the checks. The
+  # optimizing build reuses this .orig.bc, so profiling and reduction see
+  # the same checks.
+  def prune_checks(orig_name)
+    passes = []
+    passes << '-sr-prove-checks' if ENV['SR_PROVE_CHECKS'] == '1'
+    if ENV['SR_OBJECT_BOUNDS'] == '1'
+      passes << '-sr-object-bounds' << "-object-bounds-log=#{File.join(state.state_path, 'bounds.txt')}"
+    end
+    passes << '-sr-check-summaries' if ENV['SR_CHECK_SUMMARIES'] == '1'
+    return if passes.empty?
+    run!(find_opt(), '-load', 'SRPass.so', *passes, '-simplifycfg', '-o', orig_name, orig_name)
+  end
+
   def do_link(cmd)
     linker_args = cmd[1..-1]
     super([cmd[0]] + linker_args)
@@ -285,7 +312,106 @@ end
 
 
 # Compiler for SR's fourth stage. Compiles an optimized program.
+#
+# With SR_LTO=1, every TU also keeps its bitcode annotated with its coverage
+# records (.ann.bc), and the link step reduces all annotated TUs together:
+# they are linked into one module, inlined, and DynPass2 matches SCs and UCs
+# across source files. Inputs without annotated bitcode, such as archives,
+# are linked with their per-TU reduced objects as before.
 class SROptimizingCompiler < BaseCompiler
+  def lto_mode?()
+    ENV['SR_LTO'] == '1'
+  end
+
+  def annotate(orig_name, ann_name, scov_name, ucov_name)
+    return unless lto_mode?
+    run!(find_opt(), '-load', 'SRPass.so', '-sr-annotate', "-annotate-scov=#{scov_name}", "-annotate-ucov=#{ucov_name}", "-o", ann_name, orig_name)
+  end
+
+  # -SR-opt -san-level=L0,L1,L2,L3 decides all listed levels in one SafePass
+  # run. Each level's reduced bitcode is kept as .SR.<level>.bc and the
+  # statistics of all levels go to levels.txt; the object is built at the
+  # last level.
+  def multi_level?()
+    state.san_level.to_s.include?(',')
+  end
+
+  # SR_COST_BUDGET=5 keeps at most 5% of the original check cost: after the
+  # pattern-based reduction, SafePass drops the most expensive checks left
+  # until the budget is met and lists them in budget.txt.
+  def cost_budget()
+    ENV['SR_COST_BUDGET']
+  end
+
+  # SR_CHECK_FACTS=1 makes the reducers keep what removed checks established,
+  # as assumptions and no-wrap flags, for the optimization that follows.
+  def fact_args()
+    ENV['SR_CHECK_FACTS'] == '1' ? ['-check-facts'] : []
+  end
+
+  def reduce_levels(orig_name, sr_name, scov_name, ucov_name, san_type)
+    levels = state.san_level.to_s
+    budget_args = []
+    if cost_budget
+      budget_args = ["-cost-budget=#{cost_budget}", "-cost-budget-report=#{File.join(state.state_path, 'budget.txt')}"]
+    end
+    run!(find_opt(), '-load', 'SRPass.so', '-SafePass', "-safe-scov=#{scov_name}", "-safe-ucov=#{ucov_name}",
+      "-san-type=#{san_type}", "-san-levels=#{levels}",
+      "-san-level-out=#{mangle(orig_name, '.orig.bc', '.SR')}",
+      "-san-level-report=#{File.join(state.state_path, 'levels.txt')}",
+      "-checkcost-logpath=#{File.join(state.state_path, 'CheckCost.txt')}",
+      *budget_args, *fact_args, "-o", sr_name, orig_name)
+  end
+
+  # SR_CHECK_TRANSFORMS is a comma-separated list of SRPass transforms, such
+  # as sr-range-checks, sr-coalesce-checks, sr-hoist-checks or
+  # sr-fuse-overflow, that rewrite the checks left after reduction.
+  def transform_checks(sr_name)
+    passes = (ENV['SR_CHECK_TRANSFORMS'] || '').split(',').collect { |p| "-#{p.strip}" }
+    passes << '-sr-check-summaries' if ENV['SR_CHECK_SUMMARIES'] == '1'
+    return if passes.empty?
+    run!(find_opt(), '-load', 'SRPass.so', *passes, '-o', sr_name, sr_name)
+  end
+
+  def do_link(cmd)
+    return super unless lto_mode?
+
+    output_name = get_arg(cmd, '-o') || 'a.out'
+    ann_names = []
+    linker_args = []
+    cmd[1..-1].each_with_index do |arg, i|
+      ext = ['.o', '.lo'].find { |e| arg.end_with?(e) }
+      ann_name = mangle(File.join(state.objects_directory, arg), ext, '.ann.bc') if ext
+      if ext and cmd[i] != '-o' and File.file?(ann_name)
+        ann_names << ann_name
+      else
+        linker_args << arg
+      end
+    end
+    return super if ann_names.empty?
+
+    merged_name = File.join(state.objects_directory, output_name + '.lto.bc')
+    inlined_name = File.join(state.objects_directory, output_name + '.lto.inl.bc')
+    sr_name = File.join(state.objects_directory, output_name + '.lto.SR.bc')
+    opt_name = File.join(state.objects_directory, output_name + '.lto.opt.bc')
+    lto_obj_name = File.join(state.objects_directory, output_name + '.lto.o')
+    log_name = File.join(state.state_path,"/check1.txt")
+    logg_name = File.join(state.state_path, "/check2.txt")
+    FileUtils.mkdir_p(File.dirname(merged_name))
+
+    opt_level = get_optlevel_for_llc(linker_args)
+    run!(find_llvm_link(), '-o', merged_name, *ann_names)
+    run!(find_opt(), '-inline', '-o', inlined_name, merged_name)
+    run!(find_opt(), '-load', 'SRPass.so', '-DynPass2', '-dyn2-merged', "-log2=#{log_name}", "-logg2=#{logg_name}", *fact_args, "-o", sr_name, inlined_name)
+    transform_checks(sr_name)
+    run!(find_opt(), opt_level, '-o', opt_name, sr_name)
+    run!(find_opt(), '-load', 'SRPass.so', '-SCClean', '-o', opt_name, opt_name)
+    run!(find_opt(), opt_level, '-o', opt_name, opt_name)
+    run!(find_llc(), opt_level, '-filetype=obj', '-relocation-model=pic', '-o', lto_obj_name, opt_name)
+
+    super([cmd[0], lto_obj_name] + linker_args)
+  end
+
   def do_compile(cmd)
     clang = find_clang()
     
@@ -313,6 +439,7 @@ class SROptimizingCompiler < BaseCompiler
     if target_name and target_name.end_with?('.o')
 
       orig_name = mangle(File.join(state.objects_directory,target_name), '.o', '.orig.bc')
+      ann_name = mangle(File.join(state.objects_directory,target_name), '.o', '.ann.bc')
       SR_name = mangle(File.join(state.objects_directory,target_name), '.o', '.SR.o')
       SRbc_name = mangle(File.join(state.objects_directory,target_name), '.o', '.SR.bc')
       opt_name = mangle(File.join(state.objects_directory,target_name), '.o', '.opt.o')
@@ -449,8 +576,15 @@ class SROptimizingCompiler < BaseCompiler
       # run!(find_opt(), '-load', 'SRPass.so', '-StaPass', "-Sscov=#{scov_name}", "-Sucov=#{ucov_name}", "-o", SRbc_name, orig_name)
       # run!(find_opt(), '-load', 'SRPass.so', '-DynPass', "-scov=#{scov_name}", "-ucov=#{ucov_name}", "-log=#{log_name}", "-logg=#{logg_name}", "-o", SR_name, orig_name)
       # run!(find_opt(), '-load', 'SRPass.so', '-DynPass', "-scov=#{scov_name}", "-ucov=#{ucov_name}", "-log=#{log_name}", "-logg=#{logg_name}", "-o", SRbc_name, orig_name)
-      run!(find_opt(), '-load', 'SRPass.so', '-DynPass2', "-scov2=#{scov_name}", "-ucov2=#{ucov_name}", "-log2=#{log_name}", "-logg2=#{logg_name}", "-o", SR_name, orig_name)
-      run!(find_opt(), '-load', 'SRPass.so', '-DynPass2', "-scov2=#{scov_name}", "-ucov2=#{ucov_name}", "-log2=#{log_name}", "-logg2=#{logg_name}", "-o", SRbc_name, orig_name)
+      if multi_level? || cost_budget
+        reduce_levels(orig_name, SR_name, scov_name, ucov_name, san_type)
+        FileUtils.cp(SR_name, SRbc_name)
+      else
+        run!(find_opt(), '-load', 'SRPass.so', '-DynPass2', "-scov2=#{scov_name}", "-ucov2=#{ucov_name}", "-log2=#{log_name}", "-logg2=#{logg_name}", *fact_args, "-o", SR_name, orig_name)
+        run!(find_opt(), '-load', 'SRPass.so', '-DynPass2', "-scov2=#{scov_name}", "-ucov2=#{ucov_name}", "-log2=#{log_name}", "-logg2=#{logg_name}", *fact_args, "-o", SRbc_name, orig_name)
+      end
+      transform_checks(SR_name)
+      annotate(orig_name, ann_name, scov_name, ucov_name)
 
       opt_level = get_optlevel_for_llc(clang_args)
       run!(find_opt(), opt_level, '-o', opt_name, SR_name)
@@ -460,6 +594,7 @@ class SROptimizingCompiler < BaseCompiler
       
     elsif target_name and target_name.end_with?('.lo')
       orig_name = mangle(File.join(state.objects_directory,target_name), '.lo', '.orig.bc')
+      ann_name = mangle(File.join(state.objects_directory,target_name), '.lo', '.ann.bc')
       SR_name = mangle(File.join(state.objects_directory,target_name), '.lo', '.SR.o')
       SRbc_name = mangle(File.join(state.objects_directory,target_name), '.lo', '.SR.bc')
       opt_name = mangle(File.join(state.objects_directory,target_name), '.lo', '.opt.o')
@@ -490,8 +625,15 @@ class SROptimizingCompiler < BaseCompiler
       # run!(find_opt(), '-load', 'SRPass.so', '-StaPass', "-Sscov=#{scov_name}", "-Sucov=#{ucov_name}", "-o", SRbc_name, orig_name)
       # run!(find_opt(), '-load', 'SRPass.so', '-DynPass', "-scov=#{scov_name}", "-ucov=#{ucov_name}", "-log=#{log_name}", "-logg=#{logg_name}", "-o", SR_name, orig_name)
       # run!(find_opt(), '-load', 'SRPass.so', '-DynPass', "-scov=#{scov_name}", "-ucov=#{ucov_name}", "-log=#{log_name}", "-logg=#{logg_name}", "-o", SRbc_name, orig_name)
-      run!(find_opt(), '-load', 'SRPass.so', '-DynPass2', "-scov2=#{scov_name}", "-ucov2=#{ucov_name}", "-log2=#{log_name}", "-logg2=#{logg_name}", "-o", SR_name, orig_name)
-      run!(find_opt(), '-load', 'SRPass.so', '-DynPass2', "-scov2=#{scov_name}", "-ucov2=#{ucov_name}", "-log2=#{log_name}", "-logg2=#{logg_name}", "-o", SRbc_name, orig_name)
+      if multi_level? || cost_budget
+        reduce_levels(orig_name, SR_name, scov_name, ucov_name, san_type)
+        FileUtils.cp(SR_name, SRbc_name)
+      else
+        run!(find_opt(), '-load', 'SRPass.so', '-DynPass2', "-scov2=#{scov_name}", "-ucov2=#{ucov_name}", "-log2=#{log_name}", "-logg2=#{logg_name}", *fact_args, "-o", SR_name, orig_name)
+        run!(find_opt(), '-load', 'SRPass.so', '-DynPass2', "-scov2=#{scov_name}", "-ucov2=#{ucov_name}", "-log2=#{log_name}", "-logg2=#{logg_name}", *fact_args, "-o", SRbc_name, orig_name)
+      end
+      transform_checks(SR_name)
+      annotate(orig_name, ann_name, scov_name, ucov_name)
 
       
       opt_level = get_optlevel_for_llc(clang_args)
@@ -539,6 +681,34 @@ class SRSanCompiler < BaseCompiler
   end
 end
 
+# Compiler for SR's static mode. Reduces checks without a profiling run, by
+# dominance and source alone; see StaPass.
+class SRStaticCompiler < BaseCompiler
+  def do_compile(cmd)
+    clang = find_clang()
+
+    target_name = get_arg(cmd, '-o')
+    return super if target_name =~ /conftest/
+    ext = ['.o', '.lo'].find { |e| target_name and target_name.end_with?(e) }
+    return super unless ext
+
+    orig_name = mangle(File.join(state.objects_directory,target_name), ext, '.orig.bc')
+    sta_name = mangle(File.join(state.objects_directory,target_name), ext, '.Sta.bc')
+    opt_name = mangle(File.join(state.objects_directory,target_name), ext, '.opt.o')
+    FileUtils.mkdir_p(File.dirname(orig_name))
+
+    clang_args = cmd[1..-1]
+    run!(clang, '-gline-tables-only', '-flto', *clang_args, '-o', orig_name)
+
+    opt_level = get_optlevel_for_llc(clang_args)
+    run!(find_opt(), '-load', 'SRPass.so', '-StaPass', '-o', sta_name, orig_name)
+    run!(find_opt(), opt_level, '-o', opt_name, sta_name)
+    run!(find_opt(), '-load', 'SRPass.so', '-SCClean', '-o', opt_name, opt_name)
+    run!(find_opt(), opt_level, '-o', opt_name, opt_name)
+    run!(find_llc(), opt_level, '-filetype=obj', '-relocation-model=pic', '-o', target_name, opt_name)
+  end
+end
+
 
 # Some makefiles compile and link with a single command. We need to handle this
 # specially and convert it into multiple commands.
@@ -625,6 +795,9 @@ def main(argv)
   elsif command == "-SR-san"
     state = SRState.new
     state.current_state = :sanitizer
+  elsif command == "-SR-static"
+    state = SRState.new
+    state.current_state = :static
   else
     raise "unknown command: #{command}"
   end
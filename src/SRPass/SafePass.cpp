@@ -5,6 +5,7 @@
 #include "SCIPass.h"
 #include "CostModel.h"
 #include "utils.h"
+#include "PatternIndex.h"
 #include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/Function.h"
@@ -15,6 +16,11 @@
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/Format.h"
 #include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/ValueMapper.h"
 
 #include <algorithm>
 #include <memory>
@@ -36,6 +42,21 @@ CheckType("san-type", cl::desc("<sanitizer type, choose asan or ubsan>"), cl::in
 static cl::opt<std::string>
 SanType("san-level", cl::desc("<sanitizer level, choose L0 or L1 or L2 or L3>"), cl::init(""), cl::Hidden);
 
+static cl::opt<std::string>
+SanLevels("san-levels", cl::desc("<comma-separated levels to decide in one run, e.g. L0,L1,L2,L3>"), cl::init(""), cl::Hidden);
+
+static cl::opt<std::string>
+LevelOutput("san-level-out", cl::desc("<prefix of the reduced bitcode written per level>"), cl::init(""), cl::Hidden);
+
+static cl::opt<std::string>
+LevelReport("san-level-report", cl::desc("<file the per-level statistics are appended to>"), cl::init(""), cl::Hidden);
+
+static cl::opt<double>
+CostBudget("cost-budget", cl::desc("<percent of the original check cost to keep, e.g. 5; negative keeps all>"), cl::init(-1), cl::Hidden);
+
+static cl::opt<std::string>
+BudgetReport("cost-budget-report", cl::desc("<file the checks dropped to meet -cost-budget are appended to>"), cl::init(""), cl::Hidden);
+
 static cl::opt<std::string>
 CheckID("checkcost-id", cl::desc("printCheckID"), cl::init(""), cl::Hidden);
 
@@ -54,6 +75,7 @@ namespace {
 
 bool SafePass::runOnModule(Module &m) {
     SCI = &getAnalysis<SCIPass>();
+    VN.clear();
     TargetTransformInfoWrapperPass &TTIWP = getAnalysis<TargetTransformInfoWrapperPass>();
     std::string filename = m.getSourceFileName();
     filename = filename.substr(0, filename.rfind("."));
@@ -93,11 +115,10 @@ bool SafePass::runOnModule(Module &m) {
     //     }
     // }
     std::map<Instruction*, info> SC_Stat;
-    std::map<uint64_t, std::vector<stat>> SC_Pattern, SC_Pattern_opt;
+    PatternIndex<stat> SC_Pattern;
     std::map<uint64_t, std::vector<coststat>> CostLevelRange;
-    std::vector<Instruction*> RSC;
+    std::map<Instruction*, uint64_t> SC_Cost;
     StringRef SCType = CheckType;
-    StringRef SCLevel = SanType;
 
     FILE *fp_sc = fopen(Twine(InputSCOV).str().c_str(), "rb");
     // errs() << Twine(InputSCOV).str().c_str() << "\n";
@@ -110,20 +131,17 @@ bool SafePass::runOnModule(Module &m) {
 
         uint64_t flagSC = 0, costflagSC = 0; // Number of SCs
         uint64_t flagUC = 0, costflagUC = 0; // Number of UCs
-        uint64_t flagSC_opt = 0, costflagSC_opt = 0; // Number of SCs after the redundant SCs about UCs are reduced
-        uint64_t flagSC_opts = 0, costflagSC_opts = 0; // Number of SCs after the redundant SCs about SCs are reduced
-        uint64_t test1 = 0, test2 = 0;
         uint64_t nInstructions = 0, nFreeInstructions = 0, total_cost = 0, total_num = 0;
-        bool is_reduced = true;
+        markReportsCold(m);
 
         // Start reading and storing SC coverage records from InputSCOV
         for (Function &F: m) {
             const TargetTransformInfo &TTI = TTIWP.getTTI(F);
-            for (Instruction *Inst: SCI->getSCBranches(&F)) {
+            for (Instruction *Inst: SCI->getSanityChecks(&F)) {
                 assert(Inst->getParent()->getParent() == &F && "SCI must only contain instructions of the current function.");
 
                 BranchInst *BI = dyn_cast<BranchInst>(Inst);
-                assert(BI && BI->isConditional() && "SCBranches must not contain instructions that aren't conditional branches.");
+                assert(((BI && BI->isConditional()) || isa<CallInst>(Inst)) && "Sanity checks must be conditional branches or callback checks.");
 
                 fread(&BrInfo, sizeof(BrInfo), 1, fp_sc);
                 // Revise the coverage pattern of SC
@@ -141,6 +159,7 @@ bool SafePass::runOnModule(Module &m) {
                     SC_Stat[Inst].count[i] = BrInfo.count[i];
                 }
                 SC_Stat[Inst].id = BrInfo.id;
+                setCheckWeights(Inst, BrInfo.count[1], BrInfo.count[2], SCI);
                 SC_Stat[Inst].CostLevel1 = 0;
                 SC_Stat[Inst].CostLevel2 = 0;
                 SC_Stat[Inst].NumLevel1 = 0;
@@ -154,14 +173,14 @@ bool SafePass::runOnModule(Module &m) {
                 SC_Info.LB = BrInfo.count[1];
                 SC_Info.RB = BrInfo.count[2];
                 SC_Info.SC = Inst;
-                SC_Pattern[BrInfo.count[0]].push_back(SC_Info);
+                SC_Pattern.insert(SC_Info.LB, SC_Info.RB, SC_Info);
                 flagSC += 1;
                 costflagSC += BrInfo.count[0];
                 total_num += 1;
                 
                 uint64_t Cost = 0;
                 // Calculate cost of each checks
-                for (Instruction *CI: SCI->getInstructionsBySanityCheck(BI)) {
+                for (Instruction *CI: SCI->getInstructionsBySanityCheck(Inst)) {
                     unsigned CurrentCost = CheckCost::getInstructionCost(CI, &TTI);
                     if (CurrentCost == (unsigned)(-1)) {
                         CurrentCost = 1;
@@ -180,6 +199,7 @@ bool SafePass::runOnModule(Module &m) {
                 SCCostInfo.NumLevel2 = 0;
                 SCCostInfo.SC = Inst;
                 CostLevelRange[Cost].push_back(SCCostInfo);
+                SC_Cost[Inst] = Cost;
             }
         }
         // std::sort(CheckCostVec.begin(), CheckCostVec.end(), largerCost);
@@ -225,13 +245,30 @@ bool SafePass::runOnModule(Module &m) {
             NumLevel1 = NumLevel2;
         }
 
+        // Every requested level is decided in the same traversal of the
+        // profiles. Checks are only folded once all levels are decided, so
+        // that each level sees the unreduced module.
+        std::vector<LevelDecision> Levels;
+        for (const std::string &Name: getRequestedLevels()) {
+            LevelDecision L;
+            L.Name = Name;
+            L.Reduced = reducedSC;
+            L.flagSC_opt = flagSC;
+            L.costflagSC_opt = costflagSC;
+            Levels.push_back(L);
+        }
+        LevelDecision *Main = &Levels.back();
+        for (LevelDecision &L: Levels) {
+            if (L.Name == SanType) {
+                Main = &L;
+            }
+        }
+
         // Start reading and storing UC coverage records from InputUCOV
         // During this process, each UC will be compared with all SCs in SC_Pattern
         // For each SC in SC_Pattern, if its coverage pattern matches that of UC
         // And if the variable it operates is the same as that operated by UC
         // Then, the SC can be reduced.
-        flagSC_opt = flagSC;
-        costflagSC_opt = costflagSC;
         errs() <<flagSC <<":"<<costflagSC << "----\n";
         for (Function &F: m) {
             for (Instruction *Inst: SCI->getUCBranches(&F)) {
@@ -243,75 +280,49 @@ bool SafePass::runOnModule(Module &m) {
 
                 flagUC += 1;
                 costflagUC += BrInfo.count[0];
-                // For each instruction in UCBranch, check whether its coverage pattern matches certain patterns in SC_Pattern
-                
-                if (SC_Pattern.count(BrInfo.count[0]) > 0 && BrInfo.count[0] > 0) {
-                    // If UC and SC have ompletely the same dynamic pattern A+B:A:B
-                    for (stat Info: SC_Pattern[BrInfo.count[0]]) {
-                        if ((Info.LB == BrInfo.count[1] && Info.RB == BrInfo.count[2]) || (Info.LB == BrInfo.count[2] && Info.RB == BrInfo.count[1])) {
+                for (LevelDecision &L: Levels) {
+                    StringRef SCLevel = L.Name;
+                    // Reduces Info.SC at this level, with the count of the UC
+                    auto reduce = [&](const stat &Info, uint64_t Count) {
+                        if (&L == Main && Info.id == atoi(checkid) && InputSCOV == CheckFile) {
+                            fprintf(fp_check, "This check is redundant with user defined checks.\n");
+                        }
+                        L.flagSC_opt -= 1;
+                        L.Removed.push_back(Info.SC);
+                        L.costflagSC_opt -= Count;
+                        L.Reduced[Info.id] = Count;
+                    };
+                    // For each instruction in UCBranch, check whether its coverage pattern matches certain patterns in SC_Pattern
+                    if (SC_Pattern.hasTotal(BrInfo.count[0]) && BrInfo.count[0] > 0) {
+                        // If UC and SC have ompletely the same dynamic pattern A+B:A:B
+                        for (const stat &Info: SC_Pattern.lookup(BrInfo.count[1], BrInfo.count[2])) {
                             // If UC and SC operate the same variable
-                            // errs() << "TTT"<<Info.id << "---";
-                            if (findSameSource(Info.SC, Inst, BrInfo.id, Info.id, 0, SCType, SCLevel)  && reducedSC.count(Info.id) == 0) {
-                                optimizeCheckAway(Info.SC);
-                                // errs() << "Reduced::UC:" << BrInfo.id<<"SC:"<<Info.id <<":"<< BrInfo.count[0]<<"--------\n";
-                                if (Info.id == atoi(checkid) && InputSCOV == CheckFile) {
-                                    fprintf(fp_check, "This check is redundant with user defined checks.\n");
-                                }
-                                flagSC_opt -= 1;
-                                RSC.push_back(Info.SC);
-                                costflagSC_opt -= BrInfo.count[0];
-                                reducedSC[Info.id] = BrInfo.count[0];
+                            if (findSameSource(Info.SC, Inst, BrInfo.id, Info.id, 0, SCType, SCLevel) && L.Reduced.count(Info.id) == 0) {
+                                reduce(Info, BrInfo.count[0]);
                             }
                         }
-                    }
-                    if (SCLevel != "L0") {
-                        for (stat Info: SC_Pattern[BrInfo.count[0]]) {
-                            if (findPhiInst(Info.SC, Inst) && reducedSC.count(Info.id) == 0) {
-                                optimizeCheckAway(Info.SC);
-                                if (Info.id == atoi(checkid) && InputSCOV == CheckFile) {
-                                    fprintf(fp_check, "This check is redundant with user defined checks.\n");
+                        if (SCLevel != "L0") {
+                            for (const stat &Info: SC_Pattern.lookupTotal(BrInfo.count[0])) {
+                                if (findPhiInst(Info.SC, Inst) && L.Reduced.count(Info.id) == 0) {
+                                    reduce(Info, BrInfo.count[0]);
                                 }
-                                flagSC_opt -= 1;
-                                RSC.push_back(Info.SC);
-                                costflagSC_opt -= BrInfo.count[0];
-                                reducedSC[Info.id] = BrInfo.count[0];
                             }
                         }
                     }
-                }
-                else if (SC_Pattern.count(BrInfo.count[1]) > 0 && BrInfo.count[1] > 0) {
-                    // UC has pattern A+B:A:B, while SC has pattern A:A:0
-                    for (stat Info: SC_Pattern[BrInfo.count[1]]) {
-                        if (Info.LB == 0 || Info.RB == 0) {
+                    else if (SC_Pattern.hasTotal(BrInfo.count[1]) && BrInfo.count[1] > 0) {
+                        // UC has pattern A+B:A:B, while SC has pattern A:A:0
+                        for (const stat &Info: SC_Pattern.lookupOneSided(BrInfo.count[1])) {
                             // If UC and SC operate the same variable
-                            if (findSameSource(Info.SC, Inst, BrInfo.id, Info.id, 0, SCType, SCLevel) && reducedSC.count(Info.id) == 0) {
-                                optimizeCheckAway(Info.SC);
-                                // errs() << "Reduced::UC:" << BrInfo.id<<"SC:"<<Info.id <<":"<< BrInfo.count[1]<<"--------\n";
-                                if (Info.id == atoi(checkid) && InputSCOV == CheckFile) {
-                                    fprintf(fp_check, "This check is redundant with user defined checks.\n");
-                                }
-                                flagSC_opt -= 1;
-                                RSC.push_back(Info.SC);
-                                costflagSC_opt -= BrInfo.count[1];
-                                reducedSC[Info.id] = BrInfo.count[1];
+                            if (findSameSource(Info.SC, Inst, BrInfo.id, Info.id, 0, SCType, SCLevel) && L.Reduced.count(Info.id) == 0) {
+                                reduce(Info, BrInfo.count[1]);
                             }
                         }
                     }
-                }
-                else if (SC_Pattern.count(BrInfo.count[2]) > 0 && BrInfo.count[2] > 0) {
-                    // UC has pattern A+B:A:B, while SC has pattern B:B:0
-                    for (stat Info: SC_Pattern[BrInfo.count[2]]) {
-                        if (Info.LB == 0 || Info.RB == 0){
-                            if (findSameSource(Info.SC, Inst, BrInfo.id, Info.id, 0, SCType, SCLevel) && reducedSC.count(Info.id) == 0) {
-                                optimizeCheckAway(Info.SC);
-                                // errs() << "Reduced::UC:" << BrInfo.id<<"SC:"<<Info.id <<":"<< BrInfo.count[1]<< "--------\n";
-                                if (Info.id == atoi(checkid) && InputSCOV == CheckFile) {
-                                    fprintf(fp_check, "This check is redundant with user defined checks.\n");
-                                }
-                                flagSC_opt -= 1;
-                                RSC.push_back(Info.SC);
-                                costflagSC_opt -= BrInfo.count[2];
-                                reducedSC[Info.id] = BrInfo.count[2];
+                    else if (SC_Pattern.hasTotal(BrInfo.count[2]) && BrInfo.count[2] > 0) {
+                        // UC has pattern A+B:A:B, while SC has pattern B:B:0
+                        for (const stat &Info: SC_Pattern.lookupOneSided(BrInfo.count[2])) {
+                            if (findSameSource(Info.SC, Inst, BrInfo.id, Info.id, 0, SCType, SCLevel) && L.Reduced.count(Info.id) == 0) {
+                                reduce(Info, BrInfo.count[2]);
                             }
                         }
                     }
@@ -322,74 +333,167 @@ bool SafePass::runOnModule(Module &m) {
         // Finish reading and storing UC coverage records from InputUCOV
 
         // Reduce redundant SCs among SCs
-        // For each SC read from SCOV file
-        // Check whether its pattern matches any SCs in SC_Pattern_opt
-        // If it is, this SC can be reduced
-        flagSC_opts = flagSC_opt;
-        costflagSC_opts = costflagSC_opt;
-        errs() <<flagSC_opt <<":"<<costflagSC_opt << "----\n";
+        // Each SC read from SCOV file joins the class of the first SC in
+        // SC_Pattern_opt with its pattern and source, or starts a new class.
+        // Each class then keeps its cheapest check and the others are reduced.
+        // Classes depend on the level, since the source test does.
+        for (LevelDecision &L: Levels) {
+            L.flagSC_opts = L.flagSC_opt;
+            L.costflagSC_opts = L.costflagSC_opt;
+            errs() << L.Name << ":" << L.flagSC_opt <<":"<<L.costflagSC_opt << "----\n";
+        }
         fp_sc = fopen(Twine(InputSCOV).str().c_str(), "rb");
-        uint64_t tmp = 0;
+        std::vector<PatternIndex<stat>> SC_Pattern_opt(Levels.size());
+        std::vector<std::vector<std::vector<stat>>> SC_Classes(Levels.size());
+        std::vector<std::map<uint64_t, size_t>> ClassOf(Levels.size());
         for (Function &F: m) {
-            for (Instruction *Inst: SCI->getSCBranches(&F)) {
+            for (Instruction *Inst: SCI->getSanityChecks(&F)) {
                 assert(Inst->getParent()->getParent() == &F && "SCI must only contain instructions of the current function.");
                 BranchInst *BI = dyn_cast<BranchInst>(Inst);
-                assert(BI && BI->isConditional() && "SCBranches must not contain instructions that aren't conditional branches.");
+                assert(((BI && BI->isConditional()) || isa<CallInst>(Inst)) && "Sanity checks must be conditional branches or callback checks.");
                 fread(&BrInfo, sizeof(BrInfo), 1, fp_sc);
                 // errs() <<"SC:"<<BrInfo.id << ":"<< BrInfo.count[0] <<":"<< BrInfo.count[1] <<":"<< BrInfo.count[2] << "\n";
                 // fprintf(fp,"SC:%lu:%lu:%lu:%lu\n",BrInfo.id, BrInfo.count[0], BrInfo.count[1], BrInfo.count[2]);
                 BrInfo.count[0] = BrInfo.count[1] + BrInfo.count[2];
-                tmp++;
-                // Set a flag to record whether the SC can be reduced
-                is_reduced = false;
-                // For each instruction in SCBranch, check whether its dynamic pattern matches certain patterns in SC_Pattern_opt
-                if (SC_Pattern_opt.count(BrInfo.count[0]) > 0 && BrInfo.count[0] > 0) {
-                    // New SC and existing SC have ompletely the same dynamic pattern A+B:A:B
-                    // Check all SCs in SC_Pattern_opt
-                    for (stat Info: SC_Pattern_opt[BrInfo.count[0]]) {
-                        if (BrInfo.count[1] == Info.LB || BrInfo.count[2] == Info.LB) {
-                            // Also the same operation variable 
-                            // errs() << tmp << ":"<<Info.id << "---";
+                struct stat SC_Info;
+                SC_Info.id = BrInfo.id;
+                SC_Info.LB = BrInfo.count[1];
+                SC_Info.RB = BrInfo.count[2];
+                SC_Info.SC = Inst;
+                for (size_t l = 0; l < Levels.size(); l++) {
+                    StringRef SCLevel = Levels[l].Name;
+                    // Set a flag to record whether the SC joined an existing class
+                    bool is_reduced = false;
+                    // For each instruction in SCBranch, check whether its dynamic pattern matches certain patterns in SC_Pattern_opt
+                    if (SC_Pattern_opt[l].hasTotal(BrInfo.count[0]) && BrInfo.count[0] > 0) {
+                        // New SC and existing SC have ompletely the same dynamic pattern A+B:A:B
+                        // Check all SCs in SC_Pattern_opt
+                        for (const stat &Info: SC_Pattern_opt[l].lookup(BrInfo.count[1], BrInfo.count[2])) {
+                            // Also the same operation variable
                             if (findSameSource(Inst, Info.SC, BrInfo.id, Info.id, 1, SCType, SCLevel)) {
                                 is_reduced = true;
-                                // errs() << "Same::SC:" << SC_Stat[Inst].id<<"SC:"<<SC_Stat[Info.SC].id << ":"<<SC_Stat[Inst].CostLevel1<<"-"<<SC_Stat[Inst].CostLevel2<<"---\n";
-                                if (reducedSC.count(BrInfo.id) == 0) {
-                                    optimizeCheckAway(Inst);
-                                    if (BrInfo.id == atoi(checkid) && InputSCOV == CheckFile) {
-                                        fprintf(fp_check, "This check is redundant with sanitizer checks.\n");
-                                    }
-                                    flagSC_opts -= 1;
-                                    RSC.push_back(Inst);
-                                    costflagSC_opts -= BrInfo.count[0];
-                                    reducedSC[BrInfo.id] = BrInfo.count[0];
-                                }
+                                SC_Classes[l][ClassOf[l][Info.id]].push_back(SC_Info);
+                                break;
                             }
                         }
                     }
+                    // If the SC matches no existing SC, it becomes the first SC of a new class
+                    if (!is_reduced) {
+                        SC_Pattern_opt[l].insert(SC_Info.LB, SC_Info.RB, SC_Info);
+                        ClassOf[l][SC_Info.id] = SC_Classes[l].size();
+                        SC_Classes[l].push_back(std::vector<stat>(1, SC_Info));
+                    }
                 }
-                // If the SC cannot be reduced, it should be inserted into SC_Pattern_opt, becoming one of the existing SCs.
-                if (!is_reduced) {
-                    // Insert this Instruction into SC_Pattern_opt
-                    // Including its id, LB, RB, and *Inst
-                    struct stat SC_Info;
-                    SC_Info.id = BrInfo.id;
-                    SC_Info.LB = BrInfo.count[1];
-                    SC_Info.RB = BrInfo.count[2];
-                    SC_Info.SC = Inst;
-                    SC_Pattern_opt[BrInfo.count[0]].push_back(SC_Info);
-                    if (reducedSC.count(BrInfo.id) == 0) {
-                        test1 += 1;
-                        test2 += BrInfo.count[0];
+            }
+        }
+        for (size_t l = 0; l < Levels.size(); l++) {
+            LevelDecision &L = Levels[l];
+            for (std::vector<stat> &Class: SC_Classes[l]) {
+                // Keep the cheapest check not yet reduced against a UC, the first
+                // one on ties
+                size_t Keep = Class.size();
+                for (size_t i = 0; i < Class.size(); i++) {
+                    if (L.Reduced.count(Class[i].id) == 0 && (Keep == Class.size() || SC_Cost[Class[i].SC] < SC_Cost[Class[Keep].SC])) {
+                        Keep = i;
                     }
                 }
+                for (size_t i = 0; i < Class.size(); i++) {
+                    const stat &Info = Class[i];
+                    uint64_t Count = Info.LB + Info.RB;
+                    if (i != Keep && L.Reduced.count(Info.id) == 0) {
+                        if (&L == Main && Info.id == atoi(checkid) && InputSCOV == CheckFile) {
+                            fprintf(fp_check, "This check is redundant with sanitizer checks.\n");
+                        }
+                        L.flagSC_opts -= 1;
+                        L.Removed.push_back(Info.SC);
+                        L.costflagSC_opts -= Count;
+                        L.Reduced[Info.id] = Count;
+                    }
+                }
+                if (Keep != Class.size()) {
+                    L.test1 += 1;
+                    L.test2 += Class[Keep].LB + Class[Keep].RB;
+                }
             }
         }
         fclose(fp_sc);
+
+        // With -cost-budget, the checks left at a level are dropped in order
+        // of decreasing cost until the cost left is within the budget
+        FILE *fp_budget = BudgetReport.empty() ? NULL : fopen(BudgetReport.c_str(), "ab");
+        if (CostBudget >= 0) {
+            uint64_t SumCost = 0;
+            for (auto &Entry: SC_Cost) {
+                SumCost += Entry.second;
+            }
+            uint64_t Budget = (uint64_t)(SumCost * CostBudget / 100);
+            for (LevelDecision &L: Levels) {
+                L.costLeft = SumCost;
+                for (Instruction *SC: L.Removed) {
+                    L.costLeft -= SC_Cost[SC];
+                }
+                L.flagSC_budget = L.flagSC_opts;
+                for (auto I = CostLevelRange.rbegin(); I != CostLevelRange.rend() && L.costLeft > Budget; ++I) {
+                    // Free checks do not bring the cost down
+                    if (I->first == 0) {
+                        break;
+                    }
+                    for (const coststat &C: I->second) {
+                        const info &Info = SC_Stat[C.SC];
+                        if (L.costLeft <= Budget || L.Reduced.count(Info.id) != 0) {
+                            continue;
+                        }
+                        if (&L == Main && Info.id == atoi(checkid) && InputSCOV == CheckFile) {
+                            fprintf(fp_check, "This check is dropped to meet the cost budget.\n");
+                        }
+                        L.flagSC_budget -= 1;
+                        L.costLeft -= I->first;
+                        L.Removed.push_back(C.SC);
+                        L.Dropped.push_back(C.SC);
+                        L.Reduced[Info.id] = Info.count[0];
+                        if (fp_budget) {
+                            fprintf(fp_budget, "%s %s %lu %lu %lf %lf\n", filename.c_str(), L.Name.c_str(),
+                                    Info.id, I->first, Info.CostLevel1, Info.CostLevel2);
+                        }
+                    }
+                }
+                errs() << L.Name << ":: budget " << CostBudget << "\% of " << SumCost << " :: dropped " << L.Dropped.size()
+                       << " checks, cost left " << L.costLeft << ", SC num left " << L.flagSC_budget << "\n";
+            }
+        }
+        if (fp_budget) {
+            fclose(fp_budget);
+        }
         fclose(fp_check);
-        errs() << "UC num :: " << flagUC << ";SC Num :: " << flagSC << ";SC percent after L1 :: " << flagSC_opt * 1.0 / flagSC * 100 << "\%;SC percent after L2 :: " << flagSC_opts * 1.0 / flagSC * 100 << "\%\n";
-        // errs() << "SC cost percent:: "<< costflagSC/costflagSC * 100  << ";SC cost percent after L1 :: " << costflagSC_opt * 1.0 / costflagSC * 100 << "\%;SC cost percent after L2 :: " << costflagSC_opts * 1.0 / costflagSC * 100 << "\%\n";
-        errs() <<"com:" << test1<<":"<<test2<<":"<<flagSC_opts<<":"<<costflagSC_opts<<"\n";
+
+        FILE *fp_report = LevelReport.empty() ? NULL : fopen(LevelReport.c_str(), "ab");
+        for (LevelDecision &L: Levels) {
+            errs() << L.Name << ":: UC num :: " << flagUC << ";SC Num :: " << flagSC << ";SC percent after L1 :: " << L.flagSC_opt * 1.0 / flagSC * 100 << "\%;SC percent after L2 :: " << L.flagSC_opts * 1.0 / flagSC * 100 << "\%\n";
+            // errs() << "SC cost percent:: "<< costflagSC/costflagSC * 100  << ";SC cost percent after L1 :: " << costflagSC_opt * 1.0 / costflagSC * 100 << "\%;SC cost percent after L2 :: " << costflagSC_opts * 1.0 / costflagSC * 100 << "\%\n";
+            errs() <<"com:" << L.test1<<":"<<L.test2<<":"<<L.flagSC_opts<<":"<<L.costflagSC_opts<<"\n";
+            if (fp_report) {
+                fprintf(fp_report, "%s %s %lu %lu %lu %lu %lu %lu %lu\n", filename.c_str(), L.Name.c_str(), flagUC, flagSC, L.flagSC_opt, L.flagSC_opts, costflagSC, L.costflagSC_opt, L.costflagSC_opts);
+            }
+            if (!LevelOutput.empty()) {
+                emitLevel(m, L, LevelOutput + "." + L.Name + ".bc");
+            }
+        }
+        if (fp_report) {
+            fclose(fp_report);
+        }
+        // The module itself is reduced at -san-level, or at the last level.
+        // Checks dropped to meet the budget were not shown to be redundant,
+        // so they leave no facts behind.
+        std::set<Instruction*> Dropped(Main->Dropped.begin(), Main->Dropped.end());
+        for (Instruction *SC: Main->Removed) {
+            if (Dropped.count(SC) == 0) {
+                Facts.add(SC, SCI);
+            }
+            optimizeCheckAway(SC);
+        }
     }
+    Facts.apply();
+    eraseCallbackChecks(RemovedCalls);
     return true;
 }
 bool SafePass::findSameSource(Instruction *BI1, Instruction *BI2, uint64_t id1, uint64_t id2, size_t flag, StringRef SCType, StringRef SCLevel) {
@@ -418,7 +522,7 @@ bool SafePass::SameStaticPattern(Instruction *C1, Instruction *C2) {
     bool flag = false;
     StringRef name1 = C1->getOpcodeName();
     StringRef name2 = C2->getOpcodeName();
-    if (C1 == C2) {
+    if (VN.equal(C1, C2)) {
         return true;
     }
     else if (name1 == name2 && name1 !="phi" && C1->getNumOperands() == C2->getNumOperands() && C1->getNumOperands() != 0) {
@@ -595,25 +699,69 @@ bool SafePass::SameMemoryLoc(std::set<Instruction*> Clist1, std::set<Instruction
 
 
 
+// The levels to decide: those of -san-levels, or just -san-level
+std::vector<std::string> SafePass::getRequestedLevels() {
+    std::vector<std::string> Names;
+    SmallVector<StringRef, 4> Parts;
+    StringRef(SanLevels).split(Parts, ',', -1, false);
+    for (StringRef Part: Parts) {
+        Names.push_back(Part.trim().str());
+    }
+    if (Names.empty()) {
+        Names.push_back(SanType);
+    }
+    return Names;
+}
+
+// Writes a copy of the module with the checks of one level removed
+void SafePass::emitLevel(Module &M, const LevelDecision &L, const std::string &Path) {
+    // Plan the folds on the original module, where SCI knows the checks
+    std::vector<std::pair<BranchInst*, bool>> Folds;
+    std::set<Instruction*> Calls;
+    for (Instruction *SC: L.Removed) {
+        if (isa<CallInst>(SC)) {
+            Calls.insert(SC);
+        }
+        else {
+            getSanityCheckFolds(cast<BranchInst>(SC), SCI, Folds);
+        }
+    }
+
+    ValueToValueMapTy VMap;
+    std::unique_ptr<Module> Clone = CloneModule(M, VMap);
+    for (auto &Fold: Folds) {
+        BranchInst *BI = cast<BranchInst>(VMap[Fold.first]);
+        BI->setCondition(ConstantInt::getBool(BI->getContext(), Fold.second));
+    }
+    std::set<Instruction*> ClonedCalls;
+    for (Instruction *Call: Calls) {
+        ClonedCalls.insert(cast<Instruction>(VMap[Call]));
+    }
+    eraseCallbackChecks(ClonedCalls);
+
+    std::error_code EC;
+    raw_fd_ostream OS(Path, EC);
+    if (EC) {
+        errs() << "SafePass: cannot write " << Path << ": " << EC.message() << "\n";
+        return;
+    }
+    WriteBitcodeToFile(*Clone, OS);
+}
+
 // Tries to remove a sanity check; returns true if it worked.
 void SafePass::optimizeCheckAway(Instruction *Inst) {
+    if (isa<CallInst>(Inst)) {
+        // Callback checks are erased once matching is done, since the later
+        // phases still look at the operands of removed checks.
+        RemovedCalls.insert(Inst);
+        return;
+    }
     BranchInst *BI = cast<BranchInst>(Inst);
     assert(BI->isConditional() && "Sanity check must be conditional branch.");
-    
-    unsigned int RegularBranch = getRegularBranch(BI, SCI);
-    
-    bool Changed = false;
-    if (RegularBranch == 0) {
-        BI->setCondition(ConstantInt::getTrue(Inst->getContext()));
-        Changed = true;
-    } else if (RegularBranch == 1) {
-        BI->setCondition(ConstantInt::getFalse(Inst->getContext()));
-        Changed = true;
-    } else {
-        dbgs() << "Warning: Sanity check with no regular branch found.\n";
-        dbgs() << "The sanity check has been kept intact.\n";
-    }
-    // return Changed;
+
+    // Folds every branch of the check, including the fast path in front of
+    // ASan's partial-granule slow path
+    foldSanityCheck(BI, SCI);
 }
 
 
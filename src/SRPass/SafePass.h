@@ -2,11 +2,14 @@
 // Please see LICENSE.txt for copyright and licensing information.
 
 #include "llvm/Pass.h"
+#include "ValueNumbering.h"
+#include "CheckFacts.h"
 
 #include <utility>
 #include <vector>
 #include <map>
 #include <set>
+#include <string>
 
 namespace sanitychecks {
     class GCOVFile;
@@ -14,6 +17,7 @@ namespace sanitychecks {
 
 namespace llvm {
     class BranchInst;
+    class Module;
     class raw_ostream;
     class Instruction;
     class Value;
@@ -40,6 +44,21 @@ struct SafePass : public llvm::ModulePass {
     std::set<llvm::Instruction*> TrackMemoryLoc(llvm::Instruction *Inst, llvm::StringRef type, uint64_t id, llvm::StringRef SCLevel);
     bool SameStaticPattern(llvm::Instruction *C1, llvm::Instruction *C2);
 
+    // Decisions of one reduction level
+    struct LevelDecision {
+        std::string Name;
+        std::map<uint64_t, uint64_t> Reduced;
+        std::vector<llvm::Instruction*> Removed;
+        uint64_t flagSC_opt = 0, costflagSC_opt = 0; // Number of SCs after the redundant SCs about UCs are reduced
+        uint64_t flagSC_opts = 0, costflagSC_opts = 0; // Number of SCs after the redundant SCs about SCs are reduced
+        uint64_t test1 = 0, test2 = 0;
+        // Checks dropped to meet -cost-budget, most expensive first
+        std::vector<llvm::Instruction*> Dropped;
+        uint64_t flagSC_budget = 0, costLeft = 0; // Number and cost of SCs left within the budget
+    };
+    static std::vector<std::string> getRequestedLevels();
+    void emitLevel(llvm::Module &M, const LevelDecision &L, const std::string &Path);
+
     typedef std::pair<llvm::BranchInst *, uint64_t> CheckCostPair;
     const std::vector<CheckCostPair> &getCheckCostVec() const {
         return CheckCostVec;
@@ -49,4 +68,9 @@ private:
     std::map<uint64_t, uint64_t> reducedSC;
     std::vector<CheckCostPair> CheckCostVec;
     SCIPass *SCI;
+    ValueNumbering VN;
+    // Callback checks to erase at the end of runOnModule
+    std::set<llvm::Instruction*> RemovedCalls;
+    // What the removed checks established, with -check-facts
+    CheckFacts Facts;
 };
@@ -0,0 +1,108 @@
+// This file is part of ASAP.
+// Please see LICENSE.txt for copyright and licensing information.
+
+#include "SameLocation.h"
+#include "SCIPass.h"
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Analysis/MemoryLocation.h"
+#include "llvm/Analysis/MemorySSA.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+
+using namespace llvm;
+
+Value *SameLocationOracle::getCheckedPointer(SCIPass *SCI, Instruction *Check) {
+    const SanityCheckInfo &Info = SCI->getCheckInfo(Check);
+    if (!Info.isASan() || !Info.Operand || !Info.AccessSize ||
+        !Info.Operand->getType()->isPointerTy()) {
+        return nullptr;
+    }
+    return Info.Operand;
+}
+
+bool SameLocationOracle::implies(Instruction *Kept, Instruction *Check) {
+    Function *F = Kept->getParent()->getParent();
+    if (Kept == Check || Check->getParent()->getParent() != F || !abortsOnFailure(Kept)) {
+        return false;
+    }
+    Value *KeptPtr = getCheckedPointer(SCI, Kept);
+    Value *CheckPtr = getCheckedPointer(SCI, Check);
+    if (!KeptPtr || !CheckPtr) {
+        return false;
+    }
+    uint64_t Size = SCI->getCheckInfo(Check).AccessSize;
+    if (SCI->getCheckInfo(Kept).AccessSize < Size) {
+        return false;
+    }
+
+    DominatorTree &DT = P->getAnalysis<DominatorTreeWrapperPass>(*F).getDomTree();
+    Instruction *KeptStart = getCheckStart(Kept);
+    Instruction *CheckStart = getCheckStart(Check);
+    if (!DT.dominates(KeptStart, CheckStart)) {
+        return false;
+    }
+
+    AAResults &AA = P->getAnalysis<AAResultsWrapperPass>(*F).getAAResults();
+    MemoryLocation CheckLoc(CheckPtr, LocationSize::precise(Size));
+    if (AA.alias(MemoryLocation(KeptPtr, LocationSize::precise(Size)), CheckLoc) != AliasResult::MustAlias) {
+        return false;
+    }
+
+    // The location must not be written or freed between the two checks: the
+    // nearest clobber seen from the later check has to come before the kept
+    // one. A callback check is a call and so a MemoryDef of its own, hence
+    // the state right after the kept check.
+    MemorySSA &MSSA = P->getAnalysis<MemorySSAWrapperPass>(*F).getMSSA();
+    MemoryAccess *KeptState = getMemoryState(MSSA, DT, KeptStart->getParent(), std::next(KeptStart->getIterator()));
+    MemoryAccess *CheckState = getMemoryState(MSSA, DT, CheckStart->getParent(), CheckStart->getIterator());
+    if (!KeptState || !CheckState) {
+        return false;
+    }
+    MemoryAccess *Clobber = MSSA.getWalker()->getClobberingMemoryAccess(CheckState, CheckLoc);
+    return MSSA.dominates(Clobber, KeptState);
+}
+
+Instruction *SameLocationOracle::getCheckStart(Instruction *Check) {
+    if (isa<BranchInst>(Check)) {
+        return SCI->getCheckBranches(Check).front();
+    }
+    return Check;
+}
+
+// In recovery mode (-fsanitize-recover=address) a failing check reports and
+// carries on, so it does not protect the checks after it.
+bool SameLocationOracle::abortsOnFailure(Instruction *Check) {
+    const CallInst *Report = SCI->getCheckInfo(Check).ReportCall;
+    if (!Report || !Report->getCalledFunction()) {
+        return false;
+    }
+    return !Report->getCalledFunction()->getName().endswith("_noabort");
+}
+
+MemoryAccess *SameLocationOracle::getMemoryState(MemorySSA &MSSA, DominatorTree &DT,
+                                                 BasicBlock *BB, BasicBlock::iterator It) {
+    while (It != BB->begin()) {
+        --It;
+        if (MemoryUseOrDef *MA = MSSA.getMemoryAccess(&*It)) {
+            if (isa<MemoryDef>(MA)) {
+                return MA;
+            }
+            return MA->getDefiningAccess();
+        }
+    }
+    if (MemoryPhi *Phi = MSSA.getMemoryAccess(BB)) {
+        return Phi;
+    }
+    // Without a MemoryPhi, every predecessor leaves the state that is current
+    // at the end of the immediate dominator
+    DomTreeNode *Node = DT.getNode(BB);
+    if (!Node) {
+        return nullptr;
+    }
+    if (!Node->getIDom()) {
+        return MSSA.getLiveOnEntryDef();
+    }
+    BasicBlock *IDom = Node->getIDom()->getBlock();
+    return getMemoryState(MSSA, DT, IDom, IDom->end());
+}
@@ -0,0 +1,48 @@
+// This file is part of ASAP.
+// Please see LICENSE.txt for copyright and licensing information.
+
+#ifndef SRPASS_SAMELOCATION_H
+#define SRPASS_SAMELOCATION_H
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/IR/BasicBlock.h"
+
+namespace llvm {
+    class DominatorTree;
+    class Instruction;
+    class MemoryAccess;
+    class MemorySSA;
+    class Pass;
+    class Value;
+}
+
+struct SCIPass;
+
+// Decides whether an ASan check is implied by another ASan check of the
+// same memory. This holds if the kept check aborts on failure and
+// dominates the other check, both addresses must alias, the kept check
+// covers at least as many bytes, and MemorySSA finds no write or free that
+// may clobber the location in between. Analyses are requested from the
+// owning pass per function, so queries should be grouped by function.
+class SameLocationOracle {
+public:
+    SameLocationOracle(llvm::Pass *P, SCIPass *SCI) : P(P), SCI(SCI) {}
+
+    bool implies(llvm::Instruction *Kept, llvm::Instruction *Check);
+
+    // The pointer an ASan check guards, or null if it is not known
+    static llvm::Value *getCheckedPointer(SCIPass *SCI, llvm::Instruction *Check);
+
+private:
+    llvm::Pass *P;
+    SCIPass *SCI;
+
+    // The first instruction of a check: its first branch or the callback call
+    llvm::Instruction *getCheckStart(llvm::Instruction *Check);
+    bool abortsOnFailure(llvm::Instruction *Check);
+    // The memory state that is current right before It in BB
+    llvm::MemoryAccess *getMemoryState(llvm::MemorySSA &MSSA, llvm::DominatorTree &DT,
+                                       llvm::BasicBlock *BB, llvm::BasicBlock::iterator It);
+};
+
+#endif
@@ -0,0 +1,69 @@
+// This file is part of ASAP.
+// Please see LICENSE.txt for copyright and licensing information.
+
+#include "SourceSignature.h"
+#include "llvm/ADT/Hashing.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Instructions.h"
+
+#include <algorithm>
+
+using namespace llvm;
+
+const SourceSignature &SourceSignatures::get(Instruction *Inst) {
+    auto It = Signatures.find(Inst);
+    if (It != Signatures.end()) {
+        return It->second;
+    }
+
+    SmallPtrSet<Instruction*, 16> Visited;
+    SmallVector<Instruction*, 16> Worklist;
+    SmallPtrSet<Value*, 8> Leaves;
+    Worklist.push_back(Inst);
+    while (!Worklist.empty()) {
+        Instruction *I = Worklist.pop_back_val();
+        if (!Visited.insert(I).second) {
+            continue;
+        }
+        if (isa<PHINode>(I)) {
+            Leaves.insert(I);
+        }
+        else if (isa<BranchInst>(I)) {
+            if (Instruction *Op = dyn_cast<Instruction>(I->getOperand(0))) {
+                Worklist.push_back(Op);
+            }
+        }
+        else {
+            unsigned NumConstants = 0;
+            for (Use &U: I->operands()) {
+                if (Instruction *Op = dyn_cast<Instruction>(U.get())) {
+                    Worklist.push_back(Op);
+                }
+                else if (isa<Constant>(U.get())) {
+                    NumConstants += 1;
+                }
+                else {
+                    Leaves.insert(U.get());
+                }
+            }
+            if (NumConstants == I->getNumOperands()) {
+                Leaves.insert(I);
+            }
+        }
+    }
+
+    SourceSignature &Signature = Signatures[Inst];
+    for (Value *V: Leaves) {
+        Signature.Leaves.push_back(getLeafID(V));
+    }
+    std::sort(Signature.Leaves.begin(), Signature.Leaves.end());
+    Signature.Fingerprint = hash_combine_range(Signature.Leaves.begin(), Signature.Leaves.end());
+    return Signature;
+}
+
+unsigned SourceSignatures::getLeafID(Value *V) {
+    auto It = LeafIDs.insert(std::make_pair(V, LeafIDs.size()));
+    return It.first->second;
+}
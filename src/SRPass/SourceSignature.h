@@ -0,0 +1,58 @@
+// This file is part of ASAP.
+// Please see LICENSE.txt for copyright and licensing information.
+
+#ifndef SRPASS_SOURCESIGNATURE_H
+#define SRPASS_SOURCESIGNATURE_H
+
+#include "llvm/ADT/DenseMap.h"
+
+#include <cstdint>
+#include <map>
+#include <vector>
+
+namespace llvm {
+    class Instruction;
+    class Value;
+}
+
+// The values a check or user branch is computed from: phis, arguments,
+// globals and instructions without non-constant operands, found by walking
+// the operands of the branch condition. Leaves are numbered in the order
+// they are first seen, so a signature is a sorted ID vector plus a
+// fingerprint of it, and comparing two signatures rarely looks further
+// than the fingerprint.
+struct SourceSignature {
+    std::vector<unsigned> Leaves;
+    uint64_t Fingerprint;
+
+    bool operator==(const SourceSignature &Other) const {
+        return Fingerprint == Other.Fingerprint && Leaves == Other.Leaves;
+    }
+};
+
+// Computes source signatures on demand and keeps them until the
+// instruction is changed.
+class SourceSignatures {
+public:
+    const SourceSignature &get(llvm::Instruction *Inst);
+
+    // Forgets the signature of an instruction whose operands were rewritten,
+    // such as a check branch whose condition was folded.
+    void invalidate(llvm::Instruction *Inst) {
+        Signatures.erase(Inst);
+    }
+
+    void clear() {
+        Signatures.clear();
+        LeafIDs.clear();
+    }
+
+private:
+    // std::map keeps references valid while further signatures are added
+    std::map<llvm::Instruction*, SourceSignature> Signatures;
+    llvm::DenseMap<llvm::Value*, unsigned> LeafIDs;
+
+    unsigned getLeafID(llvm::Value *V);
+};
+
+#endif
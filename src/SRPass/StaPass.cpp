@@ -3,6 +3,7 @@
 
 #include "StaPass.h"
 #include "SCIPass.h"
+#include "PatternIndex.h"
 #include "utils.h"
 #include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/IR/Constants.h"
@@ -14,7 +15,10 @@
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/Format.h"
 #include "llvm/IR/Dominators.h"
+#include "llvm/Analysis/BlockFrequencyInfo.h"
+#include "llvm/Analysis/BranchProbabilityInfo.h"
 #include "llvm/Analysis/PostDominators.h"
+#include "llvm/Analysis/ValueTracking.h"
 
 #include <algorithm>
 #include <memory>
@@ -67,7 +71,9 @@ bool StaPass::runOnModule(Module &m) {
         read = true;
     }
 
-    errs() << "StaPass on "<<filename << "\n";
+    // Without a profile the pass runs in static mode: block frequencies
+    // stand in for the counts, both in the patterns and in the statistics
+    errs() << "StaPass on "<<filename << (read ? "" : " (static)") << "\n";
 
     uint64_t flagSC = 0, costflagSC = 0; // Number of SCs
     uint64_t flagUC = 0, costflagUC = 0; // Number of UCs
@@ -78,16 +84,20 @@ bool StaPass::runOnModule(Module &m) {
 
     // Start reading and storing SC coverage records from InputSCOV
     for (Function &F: m) {
-        for (Instruction *Inst: SCI->getSCBranches(&F)) {
+        BlockFrequencyInfo *BFI = nullptr;
+        if (!read && !F.isDeclaration() && !SCI->getSanityChecks(&F).empty()) {
+            BFI = &getAnalysis<BlockFrequencyInfoWrapperPass>(F).getBFI();
+        }
+        for (Instruction *Inst: SCI->getSanityChecks(&F)) {
             assert(Inst->getParent()->getParent() == &F && "SCI must only contain instructions of the current function.");
             BranchInst *BI = dyn_cast<BranchInst>(Inst);
-            assert(BI && BI->isConditional() && "SCBranches must not contain instructions that aren't conditional branches.");
+            assert(((BI && BI->isConditional()) || isa<CallInst>(Inst)) && "Sanity checks must be conditional branches or callback checks.");
             if (read) {
                 fread(&BrInfo, sizeof(BrInfo), 1, fp_sc);
             }
             else {
-                BrInfo.count[1] = 0;
-                BrInfo.count[2] = 0;
+                BrInfo.id = flagSC;
+                getStaticCounts(Inst, BFI, BrInfo.count);
             }
             // Revise the coverage pattern of SC
             // errs() <<"SC:"<<BrInfo.id << ":"<< BrInfo.count[0] <<":"<< BrInfo.count[1] <<":"<< BrInfo.count[2] << "\n";
@@ -109,32 +119,60 @@ bool StaPass::runOnModule(Module &m) {
             costflagSC += BrInfo.count[0];
         }
     }
-    fclose(fp_sc);
+    if (read) {
+        fclose(fp_sc);
+    }
     // Finish reading and storing SC coverage records from InputSCOV
 
     // Start reading and storing UC coverage records from InputUCOV
-    // During this process, each UC will be compared with all SCs in SC_Pattern
-    // For each SC in SC_Pattern, if its coverage pattern matches that of UC
-    // And if the variable it operates is the same as that operated by UC
-    // Then, the SC can be reduced.
+    // During this process, each UC will be compared with the SCs it dominates
+    // An SC can be reduced if the condition of the UC on the edge leading to
+    // it implies that the SC passes, and if the count of that edge matches
+    // the pattern of the SC. Without a profile the counts come from BFI.
     flagSC_opt = flagSC;
     costflagSC_opt = costflagSC;
     errs() <<flagSC <<":"<<costflagSC << "----\n";
+    FILE *fp_uc = nullptr;
+    if (read) {
+        fp_uc = fopen(Twine(InputUCOV).str().c_str(), "rb");
+    }
+    // With an SC profile but no UC profile there are no UC counts to match
+    bool matchUC = !read || fp_uc != NULL;
     for (Function &F: m) {
         if (SCI->getUCBranches(&F).size() > 0) {
-            // const DominatorTree &T = getAnalysis<DominatorTreeWrapperPass>(F).getDomTree();
-            PostDominatorTree PostDT = PostDominatorTree(F);
-            DominatorTree DT = DominatorTree(F);
+            // The records of every UC are read, even where there is no SC
+            bool hasSC = matchUC && SCI->getSanityChecks(&F).size() > 0;
+            // The trees are cached by the pass manager and shared by both phases
+            const DominatorTree *DT = nullptr;
+            BlockFrequencyInfo *BFI = nullptr;
+            if (hasSC) {
+                DT = &getAnalysis<DominatorTreeWrapperPass>(F).getDomTree();
+                if (!read) {
+                    BFI = &getAnalysis<BlockFrequencyInfoWrapperPass>(F).getBFI();
+                }
+            }
             for (Instruction *UC: SCI->getUCBranches(&F)) {
+                if (fp_uc != NULL) {
+                    fread(&BrInfo, sizeof(BrInfo), 1, fp_uc);
+                }
+                else {
+                    getStaticCounts(UC, BFI, BrInfo.count);
+                }
                 flagUC += 1;
-                for (Instruction *SC: SCI->getUCBranches(&F)) {
-                    if (UC->getParent()->getParent() == SC->getParent()->getParent()) {
-                        if (DT.dominates(UC->getParent(), SC->getParent()) || PostDT.dominates(UC->getParent(), SC->getParent())) {
-                            if (findSameSource(UC, SC, 0, 0, 0)) {
+                if (!hasSC) {
+                    continue;
+                }
+                BranchInst *UCBI = cast<BranchInst>(UC);
+                for (Instruction *SC: SCI->getSanityChecks(&F)) {
+                    if (reducedSC[SC_Stat[SC][3]] == 0) {
+                        // The count of the UC edge leading to the SC must match its total
+                        for (unsigned i = 0; i < 2; i++) {
+                            if (CountTolerance::matches(BrInfo.count[1 + i], 0, SC_Stat[SC][0], 0) && impliesCheckPasses(UCBI, i, SC, *DT)) {
                                 // optimizeCheckAway(SC);
                                 reducedSC[SC_Stat[SC][3]] = 1;
                                 flagSC_opt -= 1;
                                 costflagSC_opt -= SC_Stat[SC][0];
+                                break;
                             }
                         }
                     }
@@ -142,6 +180,9 @@ bool StaPass::runOnModule(Module &m) {
             }
         }
     }
+    if (fp_uc != NULL) {
+        fclose(fp_uc);
+    }
     // Finish reading and storing UC coverage records from InputUCOV
 
     // Reduce redundant SCs among SCs
@@ -154,32 +195,22 @@ bool StaPass::runOnModule(Module &m) {
     uint64_t P = 0;
     // DominatorTree T;
     for (Function &F: m) {
-        if (SCI->getSCBranches(&F).size() > 0) {
-            // const DominatorTree &T = getAnalysis<DominatorTreeWrapperPass>(F).getDomTree();
-            PostDominatorTree PostDT = PostDominatorTree(F);
-            DominatorTree DT = DominatorTree(F);
-            for (Instruction *SC1: SCI->getSCBranches(&F)) {
+        if (SCI->getSanityChecks(&F).size() > 0) {
+            const DominatorTree &DT = getAnalysis<DominatorTreeWrapperPass>(F).getDomTree();
+            const PostDominatorTree &PostDT = getAnalysis<PostDominatorTreeWrapperPass>(F).getPostDomTree();
+            for (Instruction *SC1: SCI->getSanityChecks(&F)) {
+                // Place a multi-branch check at its first branch
                 Instruction *SC1_tmp = SC1;
-                BranchInst *BI1 = dyn_cast<BranchInst>(SC1);
-                for (Instruction *CI: SCI->getInstructionsBySanityCheck(BI1)) {
-                    if (BranchInst *BI_tmp = dyn_cast<BranchInst>(CI)) {
-                        if (CI != SC1) {
-                            SC1_tmp = BI_tmp;
-                        }
-                    }
+                if (isa<BranchInst>(SC1)) {
+                    SC1_tmp = SCI->getCheckBranches(SC1).front();
                 }
-                for (Instruction *SC2: SCI->getSCBranches(&F)) {
+                for (Instruction *SC2: SCI->getSanityChecks(&F)) {
                     Instruction *SC2_tmp = SC2;
-                    BranchInst *BI2 = dyn_cast<BranchInst>(SC2);
-                    for (Instruction *CI: SCI->getInstructionsBySanityCheck(BI2)) {
-                        if (BranchInst *BI_tmp = dyn_cast<BranchInst>(CI)) {
-                            if (CI != SC2) {
-                                SC2_tmp = BI_tmp;
-                            }
-                        }
+                    if (isa<BranchInst>(SC2)) {
+                        SC2_tmp = SCI->getCheckBranches(SC2).front();
                     }
                     if (SC1_tmp->getParent()->getParent() == SC2_tmp->getParent()->getParent()) {
-                        if (DT.dominates(SC2_tmp->getParent(), SC1_tmp->getParent()) && reducedSC[SC_Stat[SC1][3]] == 0) {
+                        if (DT.dominates(SC2_tmp, SC1_tmp) && reducedSC[SC_Stat[SC1][3]] == 0 && reducedSC[SC_Stat[SC2][3]] == 0) {
                             if (SC1 != SC2 && findSameSource(SC1, SC2, 0, 0, 1)) {
                                 // optimizeCheckAway(Inst);
                                 flagSC_opts -= 1;
@@ -187,7 +218,7 @@ bool StaPass::runOnModule(Module &m) {
                                 reducedSC[SC_Stat[SC1][3]] = 1;
                             }
                         }
-                        else if (!DT.dominates(SC1_tmp->getParent(), SC2_tmp->getParent()) && PostDT.dominates(SC2_tmp->getParent(), SC1_tmp->getParent()) && reducedSC[SC_Stat[SC1][3]] == 0) {
+                        else if (!DT.dominates(SC1_tmp->getParent(), SC2_tmp->getParent()) && PostDT.dominates(SC2_tmp->getParent(), SC1_tmp->getParent()) && reducedSC[SC_Stat[SC1][3]] == 0 && reducedSC[SC_Stat[SC2][3]] == 0) {
                             if (SC1 != SC2 && findSameSource(SC1, SC2, 0, 0, 1)) {
                                 // optimizeCheckAway(Inst);
                                 flagSC_opts -= 1;
@@ -201,7 +232,7 @@ bool StaPass::runOnModule(Module &m) {
         }
     }
     for (Function &F: m) {
-        for (Instruction *SC: SCI->getSCBranches(&F)) {
+        for (Instruction *SC: SCI->getSanityChecks(&F)) {
             if (reducedSC[SC_Stat[SC][3]] == 1) {
                 optimizeCheckAway(SC);
             }
@@ -210,6 +241,8 @@ bool StaPass::runOnModule(Module &m) {
     errs() << "UC num :: " << flagUC << ";SC Num :: " << flagSC << ";SC percent after L1 :: " << flagSC_opt * 1.0 / (flagSC+0.0001) * 100 << "\%;SC percent after L2 :: " << flagSC_opts * 1.0 / (flagSC+0.0001) * 100 << "\%\n";
     errs() << "SC cost percent:: "<< costflagSC/(costflagSC+0.0001) * 100  << ";SC cost percent after L1 :: " << costflagSC_opt * 1.0 / (costflagSC+0.0001) * 100 << "\%;SC cost percent after L2 :: " << costflagSC_opts * 1.0 / (costflagSC+0.0001) * 100 << "\%\n";
     errs() <<"com:" << test1<<":"<<test2<<":"<<flagSC_opts<<":"<<costflagSC_opts<<"\n";
+    Facts.apply();
+    eraseCallbackChecks(RemovedCalls);
     return true;
 }
 bool StaPass::findSameSource(llvm::Instruction *BI1, llvm::Instruction *BI2, uint64_t id1, uint64_t id2, uint64_t flag) {
@@ -241,15 +274,11 @@ bool StaPass::findSameSource(llvm::Instruction *BI1, llvm::Instruction *BI2, uin
 std::set<Value*> StaPass::TrackMemoryLoc(Instruction *C, uint64_t id) {
     std::set<Instruction*> Clist;
     std::set<Value*> FClist;
-    bool flag = true;
     Instruction *Inst;
     if (BranchInst *BI = dyn_cast<BranchInst>(C)) {
         if (Instruction *Op=dyn_cast<Instruction>(C->getOperand(0))) {
             Clist.insert(Op);
         }
-        else {
-            flag = false;
-        }
     }
     else {
         bool is_end = true;
@@ -261,14 +290,10 @@ std::set<Value*> StaPass::TrackMemoryLoc(Instruction *C, uint64_t id) {
         if (!is_end) {
             Clist.insert(C);
         }
-        else {
-            flag = false;
-        }
     }
 
     StringRef OpName = C->getOpcodeName();
     while (Clist.size()!=0) {
-        flag = false;
         Inst = *Clist.begin(); 
         Clist.erase(Inst);           
         OpName = Inst->getOpcodeName();
@@ -282,7 +307,6 @@ std::set<Value*> StaPass::TrackMemoryLoc(Instruction *C, uint64_t id) {
             }
         }
         if (OpName!="load" && !OpName.startswith("getelementptr") && OpName!="phi" && !is_end) {
-            flag = true;
             for (Use &U: Inst->operands()) {
                 if (Instruction *I = dyn_cast<Instruction>(U.get())) {
                     Clist.insert(I);
@@ -406,30 +430,78 @@ bool StaPass::SameMemoryLoc(std::set<Value*> FClist1, std::set<Value*> FClist2,
     return flag;
 }
 
+// Estimates the counts of a branch from block frequencies, in the units of
+// its function's BFI. A branch splits its block's frequency by edge
+// probability; a callback check is counted on its passing side.
+void StaPass::getStaticCounts(Instruction *Inst, BlockFrequencyInfo *BFI, uint64_t Count[3]) {
+    Count[0] = Count[1] = Count[2] = 0;
+    if (!BFI) {
+        return;
+    }
+    BasicBlock *BB = Inst->getParent();
+    uint64_t Freq = BFI->getBlockFreq(BB).getFrequency();
+    if (BranchInst *BI = dyn_cast<BranchInst>(Inst)) {
+        const BranchProbabilityInfo *BPI = BFI->getBPI();
+        if (BPI && BI->isConditional()) {
+            Count[1] = BPI->getEdgeProbability(BB, 0u).scale(Freq);
+            Count[2] = Freq - Count[1];
+        }
+        else {
+            Count[1] = Freq;
+        }
+    }
+    else {
+        Count[1] = Freq;
+    }
+    Count[0] = Count[1] + Count[2];
+}
+
+// Returns true if taking successor Succ of UC proves that every branch of
+// the check SC takes its regular branch. The edge must dominate each branch,
+// and the UC condition on it must imply the branch condition.
+bool StaPass::impliesCheckPasses(BranchInst *UC, unsigned Succ, Instruction *SC, const DominatorTree &DT) {
+    BranchInst *SCBI = dyn_cast<BranchInst>(SC);
+    if (!SCBI || UC->getSuccessor(0) == UC->getSuccessor(1)) {
+        return false;
+    }
+    const DataLayout &DL = UC->getModule()->getDataLayout();
+    BasicBlockEdge Edge(UC->getParent(), UC->getSuccessor(Succ));
+    for (Instruction *Inst: SCI->getCheckBranches(SCBI)) {
+        BranchInst *CheckBI = cast<BranchInst>(Inst);
+        unsigned int RegularBranch = getRegularBranch(CheckBI, SCI);
+        if (RegularBranch > 1 || !DT.dominates(Edge, CheckBI->getParent())) {
+            return false;
+        }
+        Optional<bool> Implied = isImpliedCondition(UC->getCondition(), CheckBI->getCondition(), DL, Succ == 0);
+        if (!Implied || *Implied != (RegularBranch == 0)) {
+            return false;
+        }
+    }
+    return true;
+}
+
 // Tries to remove a sanity check; returns true if it worked.
 void StaPass::optimizeCheckAway(Instruction *Inst) {
+    Facts.add(Inst, SCI);
+    if (isa<CallInst>(Inst)) {
+        // Callback checks are erased once matching is done, since the later
+        // phases still look at the operands of removed checks.
+        RemovedCalls.insert(Inst);
+        return;
+    }
     BranchInst *BI = cast<BranchInst>(Inst);
     assert(BI->isConditional() && "Sanity check must be conditional branch.");
-    
-    unsigned int RegularBranch = getRegularBranch(BI, SCI);
-    
-    bool Changed = false;
-    if (RegularBranch == 0) {
-        BI->setCondition(ConstantInt::getTrue(Inst->getContext()));
-        Changed = true;
-    } else if (RegularBranch == 1) {
-        BI->setCondition(ConstantInt::getFalse(Inst->getContext()));
-        Changed = true;
-    } else {
-        dbgs() << "Warning: Sanity check with no regular branch found.\n";
-        dbgs() << "The sanity check has been kept intact.\n";
-    }
-    // return Changed;
+
+    // Folds every branch of the check, including the fast path in front of
+    // ASan's partial-granule slow path
+    foldSanityCheck(BI, SCI);
 }
 
 void StaPass::getAnalysisUsage(AnalysisUsage& AU) const {
     AU.addRequired<SCIPass>();
     AU.addRequired<DominatorTreeWrapperPass>();
+    AU.addRequired<PostDominatorTreeWrapperPass>();
+    AU.addRequired<BlockFrequencyInfoWrapperPass>();
     AU.setPreservesAll();
 }
 
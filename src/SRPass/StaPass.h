@@ -2,6 +2,7 @@
 // Please see LICENSE.txt for copyright and licensing information.
 
 #include "llvm/Pass.h"
+#include "CheckFacts.h"
 
 #include <utility>
 #include <vector>
@@ -13,7 +14,9 @@ namespace sanitychecks {
 }
 
 namespace llvm {
+    class BlockFrequencyInfo;
     class BranchInst;
+    class DominatorTree;
     class raw_ostream;
     class Instruction;
     class Value;
@@ -35,8 +38,14 @@ struct StaPass : public llvm::ModulePass {
     bool findSameSource(llvm::Instruction *BI1, llvm::Instruction *BI2, uint64_t id1, uint64_t id2, uint64_t flag);
     std::set<llvm::Value*> TrackMemoryLoc(llvm::Instruction *C, uint64_t id);
     bool SameMemoryLoc(std::set<llvm::Value*> FClist1, std::set<llvm::Value*> FClist2, uint64_t id1, uint64_t id2);
+    void getStaticCounts(llvm::Instruction *Inst, llvm::BlockFrequencyInfo *BFI, uint64_t Count[3]);
+    bool impliesCheckPasses(llvm::BranchInst *UC, unsigned Succ, llvm::Instruction *SC, const llvm::DominatorTree &DT);
 
 private:
 
     SCIPass *SCI;
+    // Callback checks to erase at the end of runOnModule
+    std::set<llvm::Instruction*> RemovedCalls;
+    // What the removed checks established, with -check-facts
+    CheckFacts Facts;
 };
@@ -0,0 +1,113 @@
+// This file is part of ASAP.
+// Please see LICENSE.txt for copyright and licensing information.
+
+#include "ValueNumbering.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/InstrTypes.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Support/CommandLine.h"
+
+#include <algorithm>
+
+using namespace llvm;
+
+static cl::opt<bool>
+MatchVN("match-vn", cl::desc("Match check operands by value number"), cl::init(true), cl::Hidden);
+
+bool ValueNumbering::isEnabled() {
+    return MatchVN;
+}
+
+unsigned ValueNumbering::getNumber(Value *V) {
+    auto It = Numbers.find(V);
+    if (It != Numbers.end()) {
+        return It->second;
+    }
+    // Give the value a number of its own first, so that operand cycles in
+    // unreachable code end there instead of recursing forever
+    unsigned Number = NextNumber++;
+    Numbers[V] = Number;
+    if (Instruction *I = dyn_cast<Instruction>(V)) {
+        Number = numberInstruction(I);
+        Numbers[V] = Number;
+    }
+    return Number;
+}
+
+unsigned ValueNumbering::numberInstruction(Instruction *I) {
+    bool Pure = isa<BinaryOperator>(I) || isa<CmpInst>(I) || isa<CastInst>(I) ||
+        isa<GetElementPtrInst>(I) || isa<SelectInst>(I) ||
+        isa<ExtractValueInst>(I) || isa<InsertValueInst>(I);
+    if (CallInst *CI = dyn_cast<CallInst>(I)) {
+        // e.g. llvm.sadd.with.overflow in UBSan checks
+        Pure = CI->getCalledFunction() && CI->doesNotAccessMemory() &&
+            !CI->mayHaveSideEffects() && !CI->isConvergent();
+    }
+    LoadInst *LI = dyn_cast<LoadInst>(I);
+    if (LI && LI->isSimple()) {
+        Pure = true;
+    }
+    if (!Pure) {
+        return NextNumber++;
+    }
+
+    std::vector<uint64_t> Expression;
+    Expression.push_back(I->getOpcode());
+    Expression.push_back(reinterpret_cast<uintptr_t>(I->getType()));
+    for (Use &U: I->operands()) {
+        Expression.push_back(getNumber(U.get()));
+    }
+    if (I->isCommutative() && Expression[2] > Expression[3]) {
+        std::swap(Expression[2], Expression[3]);
+    }
+    if (CmpInst *Cmp = dyn_cast<CmpInst>(I)) {
+        CmpInst::Predicate Pred = Cmp->getPredicate();
+        if (Expression[2] > Expression[3]) {
+            std::swap(Expression[2], Expression[3]);
+            Pred = Cmp->getSwappedPredicate();
+        }
+        Expression.push_back(Pred);
+    }
+    else if (GetElementPtrInst *GEP = dyn_cast<GetElementPtrInst>(I)) {
+        Expression.push_back(reinterpret_cast<uintptr_t>(GEP->getSourceElementType()));
+    }
+    else if (ExtractValueInst *EVI = dyn_cast<ExtractValueInst>(I)) {
+        Expression.insert(Expression.end(), EVI->idx_begin(), EVI->idx_end());
+    }
+    else if (InsertValueInst *IVI = dyn_cast<InsertValueInst>(I)) {
+        Expression.insert(Expression.end(), IVI->idx_begin(), IVI->idx_end());
+    }
+    else if (LI) {
+        Expression.push_back(getMemoryState(LI));
+    }
+
+    auto It = Expressions.insert(std::make_pair(Expression, NextNumber));
+    if (It.second) {
+        NextNumber++;
+    }
+    return It.first->second;
+}
+
+unsigned ValueNumbering::getMemoryState(Instruction *I) {
+    auto It = MemoryStates.find(I);
+    if (It == MemoryStates.end()) {
+        numberMemoryStates(I->getParent());
+        It = MemoryStates.find(I);
+    }
+    return It->second;
+}
+
+// Each block starts in a memory state of its own, and every instruction
+// that may write to memory starts a new one.
+void ValueNumbering::numberMemoryStates(BasicBlock *BB) {
+    unsigned State = NextNumber++;
+    for (Instruction &I: *BB) {
+        if (I.mayWriteToMemory()) {
+            State = NextNumber++;
+        }
+        if (isa<LoadInst>(I)) {
+            MemoryStates[&I] = State;
+        }
+    }
+}
@@ -0,0 +1,59 @@
+// This file is part of ASAP.
+// Please see LICENSE.txt for copyright and licensing information.
+
+#ifndef SRPASS_VALUENUMBERING_H
+#define SRPASS_VALUENUMBERING_H
+
+#include "llvm/ADT/DenseMap.h"
+
+#include <cstdint>
+#include <map>
+#include <vector>
+
+namespace llvm {
+    class BasicBlock;
+    class Instruction;
+    class Value;
+}
+
+// Hash-consed expression DAG over the values that checks are computed from.
+//
+// Two values get the same number if the same side-effect free operation
+// computes them from operands with the same numbers; commutative operands
+// and compare predicates are put in a canonical order first. Loads are
+// equal if they read the same address with no write to memory in between
+// in the same block. Phis, calls with side effects, arguments, globals and
+// constants are numbered by identity. Numbers are computed on demand and
+// shared by all queries of a pass run.
+class ValueNumbering {
+public:
+    // Returns false if -match-vn is off, in which case values only compare
+    // equal by identity.
+    static bool isEnabled();
+
+    unsigned getNumber(llvm::Value *V);
+
+    bool equal(llvm::Value *V1, llvm::Value *V2) {
+        return V1 == V2 || (isEnabled() && getNumber(V1) == getNumber(V2));
+    }
+
+    void clear() {
+        Numbers.clear();
+        Expressions.clear();
+        MemoryStates.clear();
+        NextNumber = 0;
+    }
+
+private:
+    llvm::DenseMap<llvm::Value*, unsigned> Numbers;
+    std::map<std::vector<uint64_t>, unsigned> Expressions;
+    // Number of the memory state each load reads from
+    llvm::DenseMap<llvm::Instruction*, unsigned> MemoryStates;
+    unsigned NextNumber = 0;
+
+    unsigned numberInstruction(llvm::Instruction *I);
+    unsigned getMemoryState(llvm::Instruction *I);
+    void numberMemoryStates(llvm::BasicBlock *BB);
+};
+
+#endif
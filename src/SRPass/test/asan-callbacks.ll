@@ -0,0 +1,27 @@
+; ASan callback checks are the void __asan_{load,store}{1,2,4,8,16,N}
+; calls and their _noabort variants. Other runtime functions with the same
+; prefix, such as __asan_load_cxx_array_cookie, are not checks.
+; RUN: %opt_legacy -load %srpass -SCIPass -S < %s 2>/dev/null | FileCheck %s
+; RUN: %opt_legacy -load %srpass -dcc -o /dev/null < %s 2>&1 | FileCheck %s --check-prefix=DCC
+
+; DCC: <stdin> :: 3 :: 0
+
+; CHECK-LABEL: @f(
+; CHECK: call void @__asan_load4(i64 %a), !sanitycheck
+; CHECK: call void @__asan_storeN_noabort(i64 %a, i64 12), !sanitycheck
+; CHECK: call void @__asan_exp_load8(i64 %a, i32 0), !sanitycheck
+; CHECK: %n = call i64 @__asan_load_cxx_array_cookie(i64* %c){{$}}
+define i64 @f(i64* %p, i64* %c) {
+entry:
+  %a = ptrtoint i64* %p to i64
+  call void @__asan_load4(i64 %a)
+  call void @__asan_storeN_noabort(i64 %a, i64 12)
+  call void @__asan_exp_load8(i64 %a, i32 0)
+  %n = call i64 @__asan_load_cxx_array_cookie(i64* %c)
+  ret i64 %n
+}
+
+declare void @__asan_load4(i64)
+declare void @__asan_storeN_noabort(i64, i64)
+declare void @__asan_exp_load8(i64, i32)
+declare i64 @__asan_load_cxx_array_cookie(i64*)
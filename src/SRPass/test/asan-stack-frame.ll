@@ -0,0 +1,290 @@
+; ASan moves the arrays of a function into one stack frame and addresses
+; them as inttoptr(frame + offset). sr-object-bounds finds their sizes in
+; the frame description: a[i & 3] stays inside int a[4], b[i & 7] may
+; leave int b[2]. With use-after-scope poisoning, a variable of the frame
+; can be out of scope, so its checks stay.
+; The functions are the output of
+;   opt -passes=asan-function-pipeline -asan-opt-globals=false [-asan-use-after-scope]
+; RUN: %opt_legacy -load %srpass -sr-object-bounds -S < %s 2>/dev/null | FileCheck %s
+
+target datalayout = "e-m:e-p270:32:32-p271:32:32-p272:64:64-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+@__asan_option_detect_stack_use_after_return = external global i32
+@___asan_gen_ = private unnamed_addr constant [21 x i8] c"2 32 16 1 a 64 8 1 b\00", align 1
+@___asan_gen_.1 = private unnamed_addr constant [12 x i8] c"1 32 16 1 a\00", align 1
+
+; CHECK-LABEL: @stack(
+; CHECK: br i1 false, label %34, label %40
+; CHECK: br i1 false, label %39, label %40
+; CHECK: br i1 %46, label %47, label %53
+; CHECK: br i1 %51, label %52, label %53
+; CHECK: br i1 false, label %60, label %66
+; CHECK: br i1 false, label %65, label %66
+define i32 @stack(i64 %i) #0 {
+entry:
+  %asan_local_stack_base = alloca i64, align 8
+  %0 = load i32, i32* @__asan_option_detect_stack_use_after_return, align 4
+  %1 = icmp ne i32 %0, 0
+  br i1 %1, label %2, label %4
+
+2:                                                ; preds = %entry
+  %3 = call i64 @__asan_stack_malloc_1(i64 96)
+  br label %4
+
+4:                                                ; preds = %entry, %2
+  %5 = phi i64 [ 0, %entry ], [ %3, %2 ]
+  %6 = icmp eq i64 %5, 0
+  br i1 %6, label %7, label %9
+
+7:                                                ; preds = %4
+  %MyAlloca = alloca i8, i64 96, align 32
+  %8 = ptrtoint i8* %MyAlloca to i64
+  br label %9
+
+9:                                                ; preds = %4, %7
+  %10 = phi i64 [ %5, %4 ], [ %8, %7 ]
+  store i64 %10, i64* %asan_local_stack_base, align 8
+  %11 = add i64 %10, 32
+  %12 = inttoptr i64 %11 to [4 x i32]*
+  %13 = add i64 %10, 64
+  %14 = inttoptr i64 %13 to [2 x i32]*
+  %15 = inttoptr i64 %10 to i64*
+  store i64 1102416563, i64* %15, align 8
+  %16 = add i64 %10, 8
+  %17 = inttoptr i64 %16 to i64*
+  store i64 ptrtoint ([21 x i8]* @___asan_gen_ to i64), i64* %17, align 8
+  %18 = add i64 %10, 16
+  %19 = inttoptr i64 %18 to i64*
+  store i64 ptrtoint (i32 (i64)* @stack to i64), i64* %19, align 8
+  %20 = lshr i64 %10, 3
+  %21 = add i64 %20, 2147450880
+  %22 = add i64 %21, 0
+  %23 = inttoptr i64 %22 to i64*
+  store i64 -940689368107847183, i64* %23, align 1
+  %24 = add i64 %21, 9
+  %25 = inttoptr i64 %24 to i16*
+  store i16 -3085, i16* %25, align 1
+  %26 = add i64 %21, 11
+  %27 = inttoptr i64 %26 to i8*
+  store i8 -13, i8* %27, align 1
+  %j = and i64 %i, 3
+  %p = getelementptr inbounds [4 x i32], [4 x i32]* %12, i64 0, i64 %j
+  %28 = ptrtoint i32* %p to i64
+  %29 = lshr i64 %28, 3
+  %30 = add i64 %29, 2147450880
+  %31 = inttoptr i64 %30 to i8*
+  %32 = load i8, i8* %31, align 1
+  %33 = icmp ne i8 %32, 0
+  br i1 %33, label %34, label %40, !prof !0
+
+34:                                               ; preds = %9
+  %35 = and i64 %28, 7
+  %36 = add i64 %35, 3
+  %37 = trunc i64 %36 to i8
+  %38 = icmp sge i8 %37, %32
+  br i1 %38, label %39, label %40
+
+39:                                               ; preds = %34
+  call void @__asan_report_store4(i64 %28)
+  unreachable
+
+40:                                               ; preds = %34, %9
+  store i32 1, i32* %p, align 4
+  %k = and i64 %i, 7
+  %q = getelementptr inbounds [2 x i32], [2 x i32]* %14, i64 0, i64 %k
+  %41 = ptrtoint i32* %q to i64
+  %42 = lshr i64 %41, 3
+  %43 = add i64 %42, 2147450880
+  %44 = inttoptr i64 %43 to i8*
+  %45 = load i8, i8* %44, align 1
+  %46 = icmp ne i8 %45, 0
+  br i1 %46, label %47, label %53, !prof !0
+
+47:                                               ; preds = %40
+  %48 = and i64 %41, 7
+  %49 = add i64 %48, 3
+  %50 = trunc i64 %49 to i8
+  %51 = icmp sge i8 %50, %45
+  br i1 %51, label %52, label %53
+
+52:                                               ; preds = %47
+  call void @__asan_report_store4(i64 %41)
+  unreachable
+
+53:                                               ; preds = %47, %40
+  store i32 2, i32* %q, align 4
+  call void @use(i32* %p, i32* %q)
+  %54 = ptrtoint i32* %p to i64
+  %55 = lshr i64 %54, 3
+  %56 = add i64 %55, 2147450880
+  %57 = inttoptr i64 %56 to i8*
+  %58 = load i8, i8* %57, align 1
+  %59 = icmp ne i8 %58, 0
+  br i1 %59, label %60, label %66, !prof !0
+
+60:                                               ; preds = %53
+  %61 = and i64 %54, 7
+  %62 = add i64 %61, 3
+  %63 = trunc i64 %62 to i8
+  %64 = icmp sge i8 %63, %58
+  br i1 %64, label %65, label %66
+
+65:                                               ; preds = %60
+  call void @__asan_report_load4(i64 %54)
+  unreachable
+
+66:                                               ; preds = %60, %53
+  %v = load i32, i32* %p, align 4
+  store i64 1172321806, i64* %15, align 8
+  %67 = icmp ne i64 %5, 0
+  br i1 %67, label %68, label %77
+
+68:                                               ; preds = %66
+  %69 = add i64 %21, 0
+  %70 = inttoptr i64 %69 to i64*
+  store i64 -723401728380766731, i64* %70, align 1
+  %71 = add i64 %21, 8
+  %72 = inttoptr i64 %71 to i64*
+  store i64 -723401728380766731, i64* %72, align 1
+  %73 = add i64 %5, 120
+  %74 = inttoptr i64 %73 to i64*
+  %75 = load i64, i64* %74, align 8
+  %76 = inttoptr i64 %75 to i8*
+  store i8 0, i8* %76, align 1
+  br label %84
+
+77:                                               ; preds = %66
+  %78 = add i64 %21, 0
+  %79 = inttoptr i64 %78 to i64*
+  store i64 0, i64* %79, align 1
+  %80 = add i64 %21, 9
+  %81 = inttoptr i64 %80 to i16*
+  store i16 0, i16* %81, align 1
+  %82 = add i64 %21, 11
+  %83 = inttoptr i64 %82 to i8*
+  store i8 0, i8* %83, align 1
+  br label %84
+
+84:                                               ; preds = %77, %68
+  ret i32 %v
+}
+
+; CHECK-LABEL: @scoped(
+; CHECK: br i1 %29, label %30, label %36
+; CHECK: br i1 %34, label %35, label %36
+define i32 @scoped(i64 %i, i1 %c) #0 {
+entry:
+  %asan_local_stack_base = alloca i64, align 8
+  %0 = load i32, i32* @__asan_option_detect_stack_use_after_return, align 4
+  %1 = icmp ne i32 %0, 0
+  br i1 %1, label %2, label %4
+
+2:                                                ; preds = %entry
+  %3 = call i64 @__asan_stack_malloc_0(i64 64)
+  br label %4
+
+4:                                                ; preds = %entry, %2
+  %5 = phi i64 [ 0, %entry ], [ %3, %2 ]
+  %6 = icmp eq i64 %5, 0
+  br i1 %6, label %7, label %9
+
+7:                                                ; preds = %4
+  %MyAlloca = alloca i8, i64 64, align 32
+  %8 = ptrtoint i8* %MyAlloca to i64
+  br label %9
+
+9:                                                ; preds = %4, %7
+  %10 = phi i64 [ %5, %4 ], [ %8, %7 ]
+  store i64 %10, i64* %asan_local_stack_base, align 8
+  %11 = add i64 %10, 32
+  %12 = inttoptr i64 %11 to [4 x i32]*
+  %13 = inttoptr i64 %10 to i64*
+  store i64 1102416563, i64* %13, align 8
+  %14 = add i64 %10, 8
+  %15 = inttoptr i64 %14 to i64*
+  store i64 ptrtoint ([12 x i8]* @___asan_gen_.1 to i64), i64* %15, align 8
+  %16 = add i64 %10, 16
+  %17 = inttoptr i64 %16 to i64*
+  store i64 ptrtoint (i32 (i64, i1)* @scoped to i64), i64* %17, align 8
+  %18 = lshr i64 %10, 3
+  %19 = add i64 %18, 2147450880
+  %20 = add i64 %19, 0
+  %21 = inttoptr i64 %20 to i64*
+  store i64 -868076555057630735, i64* %21, align 1
+  %ac = bitcast [4 x i32]* %12 to i8*
+  br i1 %c, label %then, label %exit
+
+then:                                             ; preds = %9
+  %22 = add i64 %19, 4
+  %23 = inttoptr i64 %22 to i16*
+  store i16 0, i16* %23, align 1
+  call void @llvm.lifetime.start.p0i8(i64 16, i8* %ac)
+  %j = and i64 %i, 3
+  %p = getelementptr inbounds [4 x i32], [4 x i32]* %12, i64 0, i64 %j
+  %24 = ptrtoint i32* %p to i64
+  %25 = lshr i64 %24, 3
+  %26 = add i64 %25, 2147450880
+  %27 = inttoptr i64 %26 to i8*
+  %28 = load i8, i8* %27, align 1
+  %29 = icmp ne i8 %28, 0
+  br i1 %29, label %30, label %36, !prof !0
+
+30:                                               ; preds = %then
+  %31 = and i64 %24, 7
+  %32 = add i64 %31, 3
+  %33 = trunc i64 %32 to i8
+  %34 = icmp sge i8 %33, %28
+  br i1 %34, label %35, label %36
+
+35:                                               ; preds = %30
+  call void @__asan_report_store4(i64 %24)
+  unreachable
+
+36:                                               ; preds = %30, %then
+  store i32 1, i32* %p, align 4
+  call void @sink(i32* %p)
+  %37 = add i64 %19, 4
+  %38 = inttoptr i64 %37 to i16*
+  store i16 -1800, i16* %38, align 1
+  call void @llvm.lifetime.end.p0i8(i64 16, i8* %ac)
+  br label %exit
+
+exit:                                             ; preds = %36, %9
+  store i64 1172321806, i64* %13, align 8
+  %39 = icmp ne i64 %5, 0
+  br i1 %39, label %40, label %47
+
+40:                                               ; preds = %exit
+  %41 = add i64 %19, 0
+  %42 = inttoptr i64 %41 to i64*
+  store i64 -723401728380766731, i64* %42, align 1
+  %43 = add i64 %5, 56
+  %44 = inttoptr i64 %43 to i64*
+  %45 = load i64, i64* %44, align 8
+  %46 = inttoptr i64 %45 to i8*
+  store i8 0, i8* %46, align 1
+  br label %50
+
+47:                                               ; preds = %exit
+  %48 = add i64 %19, 0
+  %49 = inttoptr i64 %48 to i64*
+  store i64 0, i64* %49, align 1
+  br label %50
+
+50:                                               ; preds = %47, %40
+  ret i32 0
+}
+
+declare i64 @__asan_stack_malloc_0(i64)
+declare i64 @__asan_stack_malloc_1(i64)
+declare void @__asan_report_load4(i64)
+declare void @__asan_report_store4(i64)
+declare void @llvm.lifetime.end.p0i8(i64 immarg, i8* nocapture)
+declare void @llvm.lifetime.start.p0i8(i64 immarg, i8* nocapture)
+declare void @sink(i32*)
+declare void @use(i32*, i32*)
+
+attributes #0 = { sanitize_address }
+
+!0 = !{!"branch_weights", i32 1, i32 100000}
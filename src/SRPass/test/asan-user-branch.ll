@@ -0,0 +1,52 @@
+; Under ASan, "if (c) x = g[1];" leaves only check instructions on the
+; user's side of the if, so the user branch serves the check alone. It
+; must still not be grouped with the check: removing the check keeps the
+; if, and DCC counts the check at its fast path, not at the user branch.
+; The function is the output of
+;   opt -passes=asan-function-pipeline -asan-opt-globals=false
+; RUN: %opt_legacy -load %srpass -sr-object-bounds -S < %s 2>/dev/null | FileCheck %s
+; RUN: %opt_legacy -load %srpass -dcc -S < %s 2>/dev/null | FileCheck %s --check-prefix=DCC
+
+; CHECK: br i1 %tobool, label %if.then, label %if.end
+; CHECK: br i1 false, label %[[SLOW:[0-9]+]], label %[[CONT:[0-9]+]]
+; CHECK: br i1 false, label %{{[0-9]+}}, label %[[CONT]]
+
+; DCC: entry:
+; DCC-NOT: COUNTER
+; DCC: br i1 %tobool, label %if.then, label %if.end
+; DCC: if.then:
+; DCC: call void @{{"?COUNTER_calledSC[^(]*}}(i64 0, i64 0)
+; DCC-NEXT: br i1 %1,
+
+@g = global [4 x i32] zeroinitializer, align 16
+
+define i32 @f(i32 %c) sanitize_address {
+entry:
+  %tobool = icmp ne i32 %c, 0
+  br i1 %tobool, label %if.then, label %if.end
+
+if.then:                                          ; preds = %entry
+  %0 = load i8, i8* inttoptr (i64 or (i64 lshr (i64 ptrtoint (i32* getelementptr inbounds ([4 x i32], [4 x i32]* @g, i64 0, i64 1) to i64), i64 3), i64 17592186044416) to i8*), align 1
+  %1 = icmp ne i8 %0, 0
+  br i1 %1, label %2, label %5, !prof !0
+
+2:                                                ; preds = %if.then
+  %3 = icmp sge i8 trunc (i64 add (i64 and (i64 ptrtoint (i32* getelementptr inbounds ([4 x i32], [4 x i32]* @g, i64 0, i64 1) to i64), i64 7), i64 3) to i8), %0
+  br i1 %3, label %4, label %5
+
+4:                                                ; preds = %2
+  call void @__asan_report_load4(i64 ptrtoint (i32* getelementptr inbounds ([4 x i32], [4 x i32]* @g, i64 0, i64 1) to i64))
+  unreachable
+
+5:                                                ; preds = %2, %if.then
+  %6 = load i32, i32* getelementptr inbounds ([4 x i32], [4 x i32]* @g, i64 0, i64 1), align 4
+  br label %if.end
+
+if.end:                                           ; preds = %5, %entry
+  %x = phi i32 [ %6, %5 ], [ 0, %entry ]
+  ret i32 %x
+}
+
+declare void @__asan_report_load4(i64)
+
+!0 = !{!"branch_weights", i32 1, i32 100000}
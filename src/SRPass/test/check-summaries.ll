@@ -0,0 +1,138 @@
+; sr-check-summaries removes a check that another function guarantees:
+; - on entry to an internal function, when every call site has passed an
+;   aborting check of the same condition on the argument;
+; - after a call, when the callee passes an aborting check of the same
+;   condition on every path to its returns.
+; A call site without the check, or a callee whose check recovers, keeps
+; the check.
+; RUN: %opt_legacy -load %srpass -sr-check-summaries -S < %s 2>/dev/null | FileCheck %s
+
+@data = private unnamed_addr global { i32 } zeroinitializer
+
+; Every caller of @get checks i < 10 first
+; CHECK-LABEL: define internal i32 @get(
+; CHECK: br i1 true, label %cont, label %handler
+define internal i32 @get(i32* %a, i64 %i) {
+entry:
+  %p = getelementptr inbounds i32, i32* %a, i64 %i
+  %ok = icmp ult i64 %i, 10, !nosanitize !0
+  br i1 %ok, label %cont, label %handler, !prof !1, !nosanitize !0
+handler:
+  call void @__ubsan_handle_out_of_bounds_abort(i8* bitcast ({ i32 }* @data to i8*), i64 %i), !nosanitize !0
+  unreachable, !nosanitize !0
+cont:
+  %v = load i32, i32* %p, align 4
+  ret i32 %v
+}
+
+; CHECK-LABEL: @checked_caller(
+; CHECK: br i1 %ok, label %cont, label %handler
+define i32 @checked_caller(i32* %a, i64 %i) {
+entry:
+  %p = getelementptr inbounds i32, i32* %a, i64 %i
+  %ok = icmp ult i64 %i, 10, !nosanitize !0
+  br i1 %ok, label %cont, label %handler, !prof !1, !nosanitize !0
+handler:
+  call void @__ubsan_handle_out_of_bounds_abort(i8* bitcast ({ i32 }* @data to i8*), i64 %i), !nosanitize !0
+  unreachable, !nosanitize !0
+cont:
+  store i32 0, i32* %p, align 4
+  %v = call i32 @get(i32* %a, i64 %i)
+  ret i32 %v
+}
+
+; One caller of @get_unchecked passes i unchecked
+; CHECK-LABEL: define internal i32 @get_unchecked(
+; CHECK: br i1 %ok, label %cont, label %handler
+define internal i32 @get_unchecked(i32* %a, i64 %i) {
+entry:
+  %p = getelementptr inbounds i32, i32* %a, i64 %i
+  %ok = icmp ult i64 %i, 10, !nosanitize !0
+  br i1 %ok, label %cont, label %handler, !prof !1, !nosanitize !0
+handler:
+  call void @__ubsan_handle_out_of_bounds_abort(i8* bitcast ({ i32 }* @data to i8*), i64 %i), !nosanitize !0
+  unreachable, !nosanitize !0
+cont:
+  %v = load i32, i32* %p, align 4
+  ret i32 %v
+}
+
+define i32 @mixed_callers(i32* %a, i64 %i, i64 %j) {
+entry:
+  %p = getelementptr inbounds i32, i32* %a, i64 %i
+  %ok = icmp ult i64 %i, 10, !nosanitize !0
+  br i1 %ok, label %cont, label %handler, !prof !1, !nosanitize !0
+handler:
+  call void @__ubsan_handle_out_of_bounds_abort(i8* bitcast ({ i32 }* @data to i8*), i64 %i), !nosanitize !0
+  unreachable, !nosanitize !0
+cont:
+  store i32 0, i32* %p, align 4
+  %v = call i32 @get_unchecked(i32* %a, i64 %i)
+  %w = call i32 @get_unchecked(i32* %a, i64 %j)
+  %r = add i32 %v, %w
+  ret i32 %r
+}
+
+; @validate has checked i < 10 when it returns
+define void @validate(i64 %i) {
+entry:
+  %ok = icmp ult i64 %i, 10, !nosanitize !0
+  br i1 %ok, label %cont, label %handler, !prof !1, !nosanitize !0
+handler:
+  call void @__ubsan_handle_out_of_bounds_abort(i8* bitcast ({ i32 }* @data to i8*), i64 %i), !nosanitize !0
+  unreachable, !nosanitize !0
+cont:
+  ret void
+}
+
+; CHECK-LABEL: @validated(
+; CHECK: call void @validate(i64 %i)
+; CHECK: br i1 true, label %cont, label %handler
+define i32 @validated(i32* %a, i64 %i) {
+entry:
+  call void @validate(i64 %i)
+  %p = getelementptr inbounds i32, i32* %a, i64 %i
+  %ok = icmp ult i64 %i, 10, !nosanitize !0
+  br i1 %ok, label %cont, label %handler, !prof !1, !nosanitize !0
+handler:
+  call void @__ubsan_handle_out_of_bounds_abort(i8* bitcast ({ i32 }* @data to i8*), i64 %i), !nosanitize !0
+  unreachable, !nosanitize !0
+cont:
+  %v = load i32, i32* %p, align 4
+  ret i32 %v
+}
+
+; @warn reports i >= 10 and returns anyway
+define void @warn(i64 %i) {
+entry:
+  %ok = icmp ult i64 %i, 10, !nosanitize !0
+  br i1 %ok, label %cont, label %handler, !prof !1, !nosanitize !0
+handler:
+  call void @__ubsan_handle_out_of_bounds(i8* bitcast ({ i32 }* @data to i8*), i64 %i), !nosanitize !0
+  br label %cont, !nosanitize !0
+cont:
+  ret void
+}
+
+; CHECK-LABEL: @warned(
+; CHECK: call void @warn(i64 %i)
+; CHECK: br i1 %ok, label %cont, label %handler
+define i32 @warned(i32* %a, i64 %i) {
+entry:
+  call void @warn(i64 %i)
+  %p = getelementptr inbounds i32, i32* %a, i64 %i
+  %ok = icmp ult i64 %i, 10, !nosanitize !0
+  br i1 %ok, label %cont, label %handler, !prof !1, !nosanitize !0
+handler:
+  call void @__ubsan_handle_out_of_bounds_abort(i8* bitcast ({ i32 }* @data to i8*), i64 %i), !nosanitize !0
+  unreachable, !nosanitize !0
+cont:
+  %v = load i32, i32* %p, align 4
+  ret i32 %v
+}
+
+declare void @__ubsan_handle_out_of_bounds_abort(i8*, i64)
+declare void @__ubsan_handle_out_of_bounds(i8*, i64)
+
+!0 = !{}
+!1 = !{!"branch_weights", i32 1048575, i32 1}
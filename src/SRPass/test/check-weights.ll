@@ -0,0 +1,29 @@
+; -check-weights puts the profiled counts on the branch DCC counted, the
+; last branch of a partial-granule ASan check. Its fast path only learns
+; that it passes.
+; RUN: %opt_legacy -load %srpass -DynPass2 -dyn2-merged -check-weights -logg2=%t.log -S < %s 2>/dev/null | FileCheck %s
+
+; CHECK: br i1 %nz, label %slow, label %cont, !prof ![[FAST:[0-9]+]]
+; CHECK: br i1 %bad, label %report, label %cont, !prof ![[SLOW:[0-9]+]]
+; CHECK-DAG: ![[FAST]] = !{!"branch_weights", i32 1, i32 44}
+; CHECK-DAG: ![[SLOW]] = !{!"branch_weights", i32 4, i32 41}
+
+define void @f(i64 %a) {
+entry:
+  %s = inttoptr i64 %a to i8*
+  %v = load i8, i8* %s
+  %nz = icmp ne i8 %v, 0
+  br i1 %nz, label %slow, label %cont, !prof !1
+slow:
+  %l = trunc i64 %a to i8
+  %bad = icmp sge i8 %l, %v
+  br i1 %bad, label %report, label %cont, !sr.cov !2
+cont:
+  ret void
+report:
+  call void @__asan_report_load1(i64 %a)
+  unreachable
+}
+declare void @__asan_report_load1(i64)
+!1 = !{!"branch_weights", i32 1, i32 100000}
+!2 = !{i64 0, i64 3, i64 40, !"f.c"}
@@ -0,0 +1,201 @@
+; sr-coalesce-checks merges ASan's checks of p[0] and p[1] into one range
+; check when both run on straight-line code. It must not when the check
+; of p[1] is in a join that the check of p[0] does not dominate, or in a
+; loop that the walk enters through its header, since the merged check
+; would then not cover all the runs of the removed one.
+; The functions are the output of
+;   opt -passes=asan-function-pipeline -asan-opt-globals=false
+; RUN: %opt_legacy -load %srpass -sr-coalesce-checks -S < %s 2>/dev/null | FileCheck %s
+
+target datalayout = "e-m:e-p270:32:32-p271:32:32-p272:64:64-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+; CHECK-LABEL: @straight(
+; CHECK: %sr.poisoned = call i64 @__asan_region_is_poisoned(i64 %{{[0-9]+}}, i64 8)
+; CHECK: call void @__asan_report_load_n(i64 %sr.poisoned, i64 8)
+; CHECK: br i1 false,
+; CHECK: br i1 false,
+; CHECK: br i1 false,
+; CHECK: br i1 false,
+define i32 @straight(i32* %p) #0 {
+entry:
+  %0 = ptrtoint i32* %p to i64
+  %1 = lshr i64 %0, 3
+  %2 = add i64 %1, 2147450880
+  %3 = inttoptr i64 %2 to i8*
+  %4 = load i8, i8* %3, align 1
+  %5 = icmp ne i8 %4, 0
+  br i1 %5, label %6, label %12, !prof !0
+
+6:                                                ; preds = %entry
+  %7 = and i64 %0, 7
+  %8 = add i64 %7, 3
+  %9 = trunc i64 %8 to i8
+  %10 = icmp sge i8 %9, %4
+  br i1 %10, label %11, label %12
+
+11:                                               ; preds = %6
+  call void @__asan_report_load4(i64 %0)
+  unreachable
+
+12:                                               ; preds = %6, %entry
+  %a = load i32, i32* %p, align 4
+  %q = getelementptr inbounds i32, i32* %p, i64 1
+  %13 = ptrtoint i32* %q to i64
+  %14 = lshr i64 %13, 3
+  %15 = add i64 %14, 2147450880
+  %16 = inttoptr i64 %15 to i8*
+  %17 = load i8, i8* %16, align 1
+  %18 = icmp ne i8 %17, 0
+  br i1 %18, label %19, label %25, !prof !0
+
+19:                                               ; preds = %12
+  %20 = and i64 %13, 7
+  %21 = add i64 %20, 3
+  %22 = trunc i64 %21 to i8
+  %23 = icmp sge i8 %22, %17
+  br i1 %23, label %24, label %25
+
+24:                                               ; preds = %19
+  call void @__asan_report_load4(i64 %13)
+  unreachable
+
+25:                                               ; preds = %19, %12
+  %b = load i32, i32* %q, align 4
+  %r = add i32 %a, %b
+  ret i32 %r
+}
+
+; CHECK-LABEL: @join(
+; CHECK-NOT: __asan_region_is_poisoned
+; CHECK: br i1 %5, label %6, label %12
+; CHECK: br i1 %10, label %11, label %12
+; CHECK: br i1 %18, label %19, label %25
+; CHECK: br i1 %23, label %24, label %25
+define i32 @join(i32* %p, i1 %c) #0 {
+entry:
+  br i1 %c, label %left, label %join
+
+left:                                             ; preds = %entry
+  %0 = ptrtoint i32* %p to i64
+  %1 = lshr i64 %0, 3
+  %2 = add i64 %1, 2147450880
+  %3 = inttoptr i64 %2 to i8*
+  %4 = load i8, i8* %3, align 1
+  %5 = icmp ne i8 %4, 0
+  br i1 %5, label %6, label %12, !prof !0
+
+6:                                                ; preds = %left
+  %7 = and i64 %0, 7
+  %8 = add i64 %7, 3
+  %9 = trunc i64 %8 to i8
+  %10 = icmp sge i8 %9, %4
+  br i1 %10, label %11, label %12
+
+11:                                               ; preds = %6
+  call void @__asan_report_load4(i64 %0)
+  unreachable
+
+12:                                               ; preds = %6, %left
+  %a = load i32, i32* %p, align 4
+  br label %join
+
+join:                                             ; preds = %12, %entry
+  %x = phi i32 [ %a, %12 ], [ 0, %entry ]
+  %q = getelementptr inbounds i32, i32* %p, i64 1
+  %13 = ptrtoint i32* %q to i64
+  %14 = lshr i64 %13, 3
+  %15 = add i64 %14, 2147450880
+  %16 = inttoptr i64 %15 to i8*
+  %17 = load i8, i8* %16, align 1
+  %18 = icmp ne i8 %17, 0
+  br i1 %18, label %19, label %25, !prof !0
+
+19:                                               ; preds = %join
+  %20 = and i64 %13, 7
+  %21 = add i64 %20, 3
+  %22 = trunc i64 %21 to i8
+  %23 = icmp sge i8 %22, %17
+  br i1 %23, label %24, label %25
+
+24:                                               ; preds = %19
+  call void @__asan_report_load4(i64 %13)
+  unreachable
+
+25:                                               ; preds = %19, %join
+  %b = load i32, i32* %q, align 4
+  %r = add i32 %x, %b
+  ret i32 %r
+}
+
+; CHECK-LABEL: @loop(
+; CHECK-NOT: __asan_region_is_poisoned
+; CHECK: br i1 %5, label %6, label %12
+; CHECK: br i1 %10, label %11, label %12
+; CHECK: br i1 %18, label %19, label %25
+; CHECK: br i1 %23, label %24, label %25
+define void @loop(i32* %p, i64 %n) #0 {
+entry:
+  %0 = ptrtoint i32* %p to i64
+  %1 = lshr i64 %0, 3
+  %2 = add i64 %1, 2147450880
+  %3 = inttoptr i64 %2 to i8*
+  %4 = load i8, i8* %3, align 1
+  %5 = icmp ne i8 %4, 0
+  br i1 %5, label %6, label %12, !prof !0
+
+6:                                                ; preds = %entry
+  %7 = and i64 %0, 7
+  %8 = add i64 %7, 3
+  %9 = trunc i64 %8 to i8
+  %10 = icmp sge i8 %9, %4
+  br i1 %10, label %11, label %12
+
+11:                                               ; preds = %6
+  call void @__asan_report_load4(i64 %0)
+  unreachable
+
+12:                                               ; preds = %6, %entry
+  %a = load i32, i32* %p, align 4
+  br label %loop
+
+loop:                                             ; preds = %25, %12
+  %i = phi i64 [ 0, %12 ], [ %i.next, %25 ]
+  %q = getelementptr inbounds i32, i32* %p, i64 1
+  %13 = ptrtoint i32* %q to i64
+  %14 = lshr i64 %13, 3
+  %15 = add i64 %14, 2147450880
+  %16 = inttoptr i64 %15 to i8*
+  %17 = load i8, i8* %16, align 1
+  %18 = icmp ne i8 %17, 0
+  br i1 %18, label %19, label %25, !prof !0
+
+19:                                               ; preds = %loop
+  %20 = and i64 %13, 7
+  %21 = add i64 %20, 3
+  %22 = trunc i64 %21 to i8
+  %23 = icmp sge i8 %22, %17
+  br i1 %23, label %24, label %25
+
+24:                                               ; preds = %19
+  call void @__asan_report_load4(i64 %13)
+  unreachable
+
+25:                                               ; preds = %19, %loop
+  %b = load i32, i32* %q, align 4
+  call void @use(i32 %a)
+  call void @use(i32 %b)
+  %i.next = add i64 %i, 1
+  %more = icmp ult i64 %i.next, %n
+  br i1 %more, label %loop, label %exit
+
+exit:                                             ; preds = %25
+  ret void
+}
+
+declare void @use(i32)
+declare void @__asan_report_load4(i64)
+
+attributes #0 = { sanitize_address }
+
+!0 = !{!"branch_weights", i32 1, i32 100000}
@@ -0,0 +1,52 @@
+; Two partial-granule ASan checks share one report block. DCC classifies
+; the edges of each check before it splits any of them, so the fast path
+; of each check is counted as passing (type 2) and the report edge as
+; failing (type 1).
+; RUN: %opt_legacy -load %srpass -dcc -S < %s 2>/dev/null | FileCheck %s
+
+; CHECK-LABEL: entry:
+; CHECK: call void @{{"?COUNTER_calledSC[^(]*}}(i64 [[A:[0-9]+]], i64 0)
+; CHECK-NEXT: br i1 %nza, label %slowa, label %entry.conta_crit_edge
+; CHECK-LABEL: entry.conta_crit_edge:
+; CHECK-NEXT: call void @{{"?COUNTER_calledSC[^(]*}}(i64 [[A]], i64 2)
+; CHECK-LABEL: slowa.conta_crit_edge:
+; CHECK-NEXT: call void @{{"?COUNTER_calledSC[^(]*}}(i64 [[A]], i64 2)
+; CHECK-LABEL: slowa.report_crit_edge:
+; CHECK-NEXT: call void @{{"?COUNTER_calledSC[^(]*}}(i64 [[A]], i64 1)
+; CHECK-LABEL: conta:
+; CHECK: call void @{{"?COUNTER_calledSC[^(]*}}(i64 [[B:[0-9]+]], i64 0)
+; CHECK-LABEL: conta.contb_crit_edge:
+; CHECK-NEXT: call void @{{"?COUNTER_calledSC[^(]*}}(i64 [[B]], i64 2)
+; CHECK-LABEL: slowb.contb_crit_edge:
+; CHECK-NEXT: call void @{{"?COUNTER_calledSC[^(]*}}(i64 [[B]], i64 2)
+; CHECK-LABEL: slowb.report_crit_edge:
+; CHECK-NEXT: call void @{{"?COUNTER_calledSC[^(]*}}(i64 [[B]], i64 1)
+
+define void @f(i64 %a, i64 %b) {
+entry:
+  %sa = inttoptr i64 %a to i8*
+  %va = load i8, i8* %sa
+  %nza = icmp ne i8 %va, 0
+  br i1 %nza, label %slowa, label %conta, !prof !1
+slowa:
+  %la = trunc i64 %a to i8
+  %ba = icmp sge i8 %la, %va
+  br i1 %ba, label %report, label %conta
+conta:
+  %sb = inttoptr i64 %b to i8*
+  %vb = load i8, i8* %sb
+  %nzb = icmp ne i8 %vb, 0
+  br i1 %nzb, label %slowb, label %contb, !prof !1
+slowb:
+  %lb = trunc i64 %b to i8
+  %bb = icmp sge i8 %lb, %vb
+  br i1 %bb, label %report, label %contb
+contb:
+  ret void
+report:
+  %addr = phi i64 [ %a, %slowa ], [ %b, %slowb ]
+  call void @__asan_report_load1(i64 %addr)
+  unreachable
+}
+declare void @__asan_report_load1(i64)
+!1 = !{!"branch_weights", i32 1, i32 100000}
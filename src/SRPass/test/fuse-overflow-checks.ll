@@ -0,0 +1,119 @@
+; sr-fuse-overflow fuses the overflow checks of a * b + c into one branch.
+; Its slow path tests the multiplication first, so the handler that is
+; called is the one of the first overflowing operation. A store between
+; the checks, or handlers that recover, keep the checks apart.
+; RUN: %opt_legacy -load %srpass -sr-fuse-overflow -S < %s 2>/dev/null | FileCheck %s
+
+@mul = private unnamed_addr global { i32 } zeroinitializer
+@add = private unnamed_addr global { i32 } zeroinitializer
+
+; CHECK-LABEL: @fused(
+; CHECK: %[[MULOK:[0-9]+]] = xor i1 %{{[0-9]+}}, true
+; CHECK-NEXT: br i1 true, label %cont, label %handler.mul_overflow
+; CHECK: cont:
+; CHECK: %[[ADDOK:[0-9]+]] = xor i1 %{{[0-9]+}}, true
+; CHECK-NEXT: %[[MULFAIL:[0-9]+]] = xor i1 %[[MULOK]], true
+; CHECK-NEXT: %[[ADDFAIL:[0-9]+]] = xor i1 %[[ADDOK]], true
+; CHECK-NEXT: %sr.overflow = or i1 %[[MULFAIL]], %[[ADDFAIL]]
+; CHECK-NEXT: %[[OK:[0-9]+]] = xor i1 %sr.overflow, true
+; CHECK-NEXT: br i1 %[[OK]], label %cont2, label %overflow.slow
+; CHECK: overflow.slow:
+; CHECK-NEXT: br i1 %[[MULFAIL]], label %handler.mul_overflow, label %handler.add_overflow
+define i32 @fused(i32 %a, i32 %b, i32 %c) {
+entry:
+  %0 = call { i32, i1 } @llvm.smul.with.overflow.i32(i32 %a, i32 %b), !nosanitize !0
+  %1 = extractvalue { i32, i1 } %0, 0, !nosanitize !0
+  %2 = extractvalue { i32, i1 } %0, 1, !nosanitize !0
+  %3 = xor i1 %2, true, !nosanitize !0
+  br i1 %3, label %cont, label %handler.mul_overflow, !prof !1, !nosanitize !0
+handler.mul_overflow:
+  %4 = zext i32 %a to i64, !nosanitize !0
+  %5 = zext i32 %b to i64, !nosanitize !0
+  call void @__ubsan_handle_mul_overflow_abort(i8* bitcast ({ i32 }* @mul to i8*), i64 %4, i64 %5), !nosanitize !0
+  unreachable, !nosanitize !0
+cont:
+  %6 = call { i32, i1 } @llvm.sadd.with.overflow.i32(i32 %1, i32 %c), !nosanitize !0
+  %7 = extractvalue { i32, i1 } %6, 0, !nosanitize !0
+  %8 = extractvalue { i32, i1 } %6, 1, !nosanitize !0
+  %9 = xor i1 %8, true, !nosanitize !0
+  br i1 %9, label %cont2, label %handler.add_overflow, !prof !1, !nosanitize !0
+handler.add_overflow:
+  %10 = zext i32 %1 to i64, !nosanitize !0
+  %11 = zext i32 %c to i64, !nosanitize !0
+  call void @__ubsan_handle_add_overflow_abort(i8* bitcast ({ i32 }* @add to i8*), i64 %10, i64 %11), !nosanitize !0
+  unreachable, !nosanitize !0
+cont2:
+  ret i32 %7
+}
+
+; *p = a * b; return *p + c;
+; CHECK-LABEL: @stored(
+; CHECK: br i1 %3, label %cont, label %handler.mul_overflow
+; CHECK: br i1 %9, label %cont2, label %handler.add_overflow
+define i32 @stored(i32* %p, i32 %a, i32 %b, i32 %c) {
+entry:
+  %0 = call { i32, i1 } @llvm.smul.with.overflow.i32(i32 %a, i32 %b), !nosanitize !0
+  %1 = extractvalue { i32, i1 } %0, 0, !nosanitize !0
+  %2 = extractvalue { i32, i1 } %0, 1, !nosanitize !0
+  %3 = xor i1 %2, true, !nosanitize !0
+  br i1 %3, label %cont, label %handler.mul_overflow, !prof !1, !nosanitize !0
+handler.mul_overflow:
+  %4 = zext i32 %a to i64, !nosanitize !0
+  %5 = zext i32 %b to i64, !nosanitize !0
+  call void @__ubsan_handle_mul_overflow_abort(i8* bitcast ({ i32 }* @mul to i8*), i64 %4, i64 %5), !nosanitize !0
+  unreachable, !nosanitize !0
+cont:
+  store i32 %1, i32* %p, align 4
+  %6 = call { i32, i1 } @llvm.sadd.with.overflow.i32(i32 %1, i32 %c), !nosanitize !0
+  %7 = extractvalue { i32, i1 } %6, 0, !nosanitize !0
+  %8 = extractvalue { i32, i1 } %6, 1, !nosanitize !0
+  %9 = xor i1 %8, true, !nosanitize !0
+  br i1 %9, label %cont2, label %handler.add_overflow, !prof !1, !nosanitize !0
+handler.add_overflow:
+  %10 = zext i32 %1 to i64, !nosanitize !0
+  %11 = zext i32 %c to i64, !nosanitize !0
+  call void @__ubsan_handle_add_overflow_abort(i8* bitcast ({ i32 }* @add to i8*), i64 %10, i64 %11), !nosanitize !0
+  unreachable, !nosanitize !0
+cont2:
+  ret i32 %7
+}
+
+; CHECK-LABEL: @recover(
+; CHECK: br i1 %3, label %cont, label %handler.mul_overflow
+; CHECK: br i1 %9, label %cont2, label %handler.add_overflow
+define i32 @recover(i32 %a, i32 %b, i32 %c) {
+entry:
+  %0 = call { i32, i1 } @llvm.smul.with.overflow.i32(i32 %a, i32 %b), !nosanitize !0
+  %1 = extractvalue { i32, i1 } %0, 0, !nosanitize !0
+  %2 = extractvalue { i32, i1 } %0, 1, !nosanitize !0
+  %3 = xor i1 %2, true, !nosanitize !0
+  br i1 %3, label %cont, label %handler.mul_overflow, !prof !1, !nosanitize !0
+handler.mul_overflow:
+  %4 = zext i32 %a to i64, !nosanitize !0
+  %5 = zext i32 %b to i64, !nosanitize !0
+  call void @__ubsan_handle_mul_overflow(i8* bitcast ({ i32 }* @mul to i8*), i64 %4, i64 %5), !nosanitize !0
+  br label %cont, !nosanitize !0
+cont:
+  %6 = call { i32, i1 } @llvm.sadd.with.overflow.i32(i32 %1, i32 %c), !nosanitize !0
+  %7 = extractvalue { i32, i1 } %6, 0, !nosanitize !0
+  %8 = extractvalue { i32, i1 } %6, 1, !nosanitize !0
+  %9 = xor i1 %8, true, !nosanitize !0
+  br i1 %9, label %cont2, label %handler.add_overflow, !prof !1, !nosanitize !0
+handler.add_overflow:
+  %10 = zext i32 %1 to i64, !nosanitize !0
+  %11 = zext i32 %c to i64, !nosanitize !0
+  call void @__ubsan_handle_add_overflow(i8* bitcast ({ i32 }* @add to i8*), i64 %10, i64 %11), !nosanitize !0
+  br label %cont2, !nosanitize !0
+cont2:
+  ret i32 %7
+}
+
+declare { i32, i1 } @llvm.smul.with.overflow.i32(i32, i32)
+declare { i32, i1 } @llvm.sadd.with.overflow.i32(i32, i32)
+declare void @__ubsan_handle_mul_overflow_abort(i8*, i64, i64)
+declare void @__ubsan_handle_add_overflow_abort(i8*, i64, i64)
+declare void @__ubsan_handle_mul_overflow(i8*, i64, i64)
+declare void @__ubsan_handle_add_overflow(i8*, i64, i64)
+
+!0 = !{}
+!1 = !{!"branch_weights", i32 1048575, i32 1}
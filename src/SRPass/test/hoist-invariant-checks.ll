@@ -0,0 +1,121 @@
+; sr-hoist-checks moves a check of an invariant shift amount out of its loop.
+; If the loop can leave at its header before the check runs, the copy in
+; the preheader runs only when the header's exit test lets the first
+; iteration through. A loop that calls an unknown function keeps its check.
+; RUN: %opt_legacy -load %srpass -sr-hoist-checks -S < %s 2>/dev/null | FileCheck %s
+
+@data = private unnamed_addr global { i32 } zeroinitializer
+
+; do { a[i] = x << s; } while (++i < n);
+; CHECK-LABEL: @bottom_tested(
+; CHECK: ph:
+; CHECK-NEXT: %[[OK:[0-9a-z.]+]] = icmp ule i32 %s, 31
+; CHECK-NEXT: %[[FAIL:[0-9a-z.]+]] = xor i1 %[[OK]], true
+; CHECK-NEXT: br i1 %[[FAIL]], label %[[REPORT:[0-9a-z.]+]], label %[[LOOP:[0-9a-z.]+]]
+; CHECK: [[REPORT]]:
+; CHECK: call void @__ubsan_handle_shift_out_of_bounds_abort(
+; CHECK-NEXT: unreachable
+; CHECK: loop:
+; CHECK: br i1 true, label %cont, label %handler
+define void @bottom_tested(i32* %a, i32 %x, i32 %s, i64 %n) {
+entry:
+  br label %ph
+ph:
+  br label %loop
+loop:
+  %i = phi i64 [ 0, %ph ], [ %i.next, %cont ]
+  %ok = icmp ule i32 %s, 31, !nosanitize !0
+  br i1 %ok, label %cont, label %handler, !prof !1, !nosanitize !0
+handler:
+  %0 = zext i32 %x to i64, !nosanitize !0
+  %1 = zext i32 %s to i64, !nosanitize !0
+  call void @__ubsan_handle_shift_out_of_bounds_abort(i8* bitcast ({ i32 }* @data to i8*), i64 %0, i64 %1), !nosanitize !0
+  unreachable, !nosanitize !0
+cont:
+  %v = shl i32 %x, %s
+  %p = getelementptr inbounds i32, i32* %a, i64 %i
+  store i32 %v, i32* %p, align 4
+  %i.next = add nuw nsw i64 %i, 1
+  %more = icmp slt i64 %i.next, %n
+  br i1 %more, label %loop, label %exit
+exit:
+  ret void
+}
+
+; for (i = 0; i < n; i++) a[i] = x << s;
+; The copy is guarded by the header's exit test on the entry value of i,
+; so the check is not reported when the loop runs zero times.
+; CHECK-LABEL: @top_tested(
+; CHECK: ph:
+; CHECK-NEXT: %[[ENTER:[0-9a-z.]+]] = icmp slt i64 0, %n
+; CHECK-NEXT: br i1 %[[ENTER]], label %[[GUARDED:[0-9a-z.]+]], label %[[JOIN:[0-9a-z.]+]]
+; CHECK: [[GUARDED]]:
+; CHECK-NEXT: icmp ule i32 %s, 31
+; CHECK: br i1 %{{[0-9a-z.]+}}, label %[[REPORT:[0-9a-z.]+]], label %{{[0-9a-z.]+}}
+; CHECK: [[REPORT]]:
+; CHECK: call void @__ubsan_handle_shift_out_of_bounds_abort(
+; CHECK: [[JOIN]]:
+; CHECK-NEXT: br label %header
+; CHECK: header:
+; CHECK: body:
+; CHECK: br i1 true, label %cont, label %handler
+define void @top_tested(i32* %a, i32 %x, i32 %s, i64 %n) {
+entry:
+  br label %ph
+ph:
+  br label %header
+header:
+  %i = phi i64 [ 0, %ph ], [ %i.next, %cont ]
+  %more = icmp slt i64 %i, %n
+  br i1 %more, label %body, label %exit
+body:
+  %ok = icmp ule i32 %s, 31, !nosanitize !0
+  br i1 %ok, label %cont, label %handler, !prof !1, !nosanitize !0
+handler:
+  %0 = zext i32 %x to i64, !nosanitize !0
+  %1 = zext i32 %s to i64, !nosanitize !0
+  call void @__ubsan_handle_shift_out_of_bounds_abort(i8* bitcast ({ i32 }* @data to i8*), i64 %0, i64 %1), !nosanitize !0
+  unreachable, !nosanitize !0
+cont:
+  %v = shl i32 %x, %s
+  %p = getelementptr inbounds i32, i32* %a, i64 %i
+  store i32 %v, i32* %p, align 4
+  %i.next = add nuw nsw i64 %i, 1
+  br label %header
+exit:
+  ret void
+}
+
+; CHECK-LABEL: @calls(
+; CHECK: ph:
+; CHECK-NEXT: br label %loop
+; CHECK: br i1 %ok, label %cont, label %handler
+define void @calls(i32* %a, i32 %x, i32 %s, i64 %n) {
+entry:
+  br label %ph
+ph:
+  br label %loop
+loop:
+  %i = phi i64 [ 0, %ph ], [ %i.next, %cont ]
+  %ok = icmp ule i32 %s, 31, !nosanitize !0
+  br i1 %ok, label %cont, label %handler, !prof !1, !nosanitize !0
+handler:
+  %0 = zext i32 %x to i64, !nosanitize !0
+  %1 = zext i32 %s to i64, !nosanitize !0
+  call void @__ubsan_handle_shift_out_of_bounds_abort(i8* bitcast ({ i32 }* @data to i8*), i64 %0, i64 %1), !nosanitize !0
+  unreachable, !nosanitize !0
+cont:
+  %v = shl i32 %x, %s
+  call void @use(i32 %v)
+  %i.next = add nuw nsw i64 %i, 1
+  %more = icmp slt i64 %i.next, %n
+  br i1 %more, label %loop, label %exit
+exit:
+  ret void
+}
+
+declare void @use(i32)
+declare void @__ubsan_handle_shift_out_of_bounds_abort(i8*, i64, i64)
+
+!0 = !{}
+!1 = !{!"branch_weights", i32 1048575, i32 1}
@@ -0,0 +1,40 @@
+# Regression tests of the SRPass plugin. Run them with
+#   llvm-lit --param srpass=<path to SRPass.so> src/SRPass/test
+# or with "make check-srpass" in the LLVM build tree.
+
+import os
+import re
+import subprocess
+
+import lit.formats
+
+config.name = 'SRPass'
+config.test_format = lit.formats.ShTest(True)
+config.suffixes = ['.ll']
+config.test_source_root = os.path.dirname(__file__)
+
+srpass = lit_config.params.get('srpass', os.environ.get('SRPASS'))
+if not srpass:
+    lit_config.fatal('set the plugin with --param srpass=<path to SRPass.so>')
+config.substitutions.append(('%srpass', srpass))
+
+tools = lit_config.params.get('tools')
+if tools:
+    config.environment['PATH'] = os.pathsep.join([tools, config.environment['PATH']])
+
+# Legacy passes are registered with the legacy pass manager, which opt only
+# uses by default up to LLVM 12. Tests run opt as %opt_legacy.
+llvm_version = lit_config.params.get('llvm_version')
+if not llvm_version:
+    try:
+        out = subprocess.check_output(['opt', '--version'], env=config.environment,
+                                      universal_newlines=True)
+        llvm_version = re.search(r'LLVM version (\d+)', out).group(1)
+    except (OSError, subprocess.CalledProcessError, AttributeError):
+        lit_config.fatal('cannot find the LLVM version; set it with --param llvm_version=<major>')
+llvm_version = int(llvm_version)
+config.substitutions.append(('%opt_legacy', 'opt -enable-new-pm=0' if llvm_version >= 13 else 'opt'))
+
+# llvm.ubsantrap exists from LLVM 12 on
+if llvm_version >= 12:
+    config.available_features.add('ubsantrap')
@@ -0,0 +1,95 @@
+; Both copies of an inlined helper share the helper's coverage records. The
+; counts are split between the copies, so each copy's check still matches
+; the user check inlined with it. In @c, a check copied from another helper
+; has the same split count as a user check with a record of its own, but a
+; split count is never compared with a measured one.
+; RUN: %opt_legacy -load %srpass -DynPass2 -dyn2-merged -logg2=%t.log -S < %s 2>&1 | FileCheck %s --implicit-check-not=Reduced::UC:2
+
+; CHECK: Checks sharing an inlined record: 6
+; CHECK: Reduced::UC:0SC:0:3
+; CHECK: Reduced::UC:1SC:1:3
+; CHECK-LABEL: @a(
+; CHECK: br i1 false, label %trap, label %load
+; CHECK-LABEL: @b(
+; CHECK: br i1 false, label %trap, label %load
+; CHECK-LABEL: @c(
+; CHECK: br i1 %bad, label %trap, label %load
+
+define i32 @a(i32* %p, i64 %x, i64 %n) {
+entry:
+  %in = icmp slt i64 %x, %n
+  br i1 %in, label %check, label %out, !sr.cov !1
+check:
+  call void @use(i64 %x)
+  %bad = icmp sge i64 %x, %n
+  br i1 %bad, label %trap, label %load, !nosanitize !0, !sr.cov !2
+trap:
+  call void @llvm.trap(), !nosanitize !0
+  unreachable
+load:
+  %q = getelementptr i32, i32* %p, i64 %x
+  %v = load i32, i32* %q
+  ret i32 %v
+out:
+  ret i32 0
+}
+
+define i32 @b(i32* %p, i64 %x, i64 %n) {
+entry:
+  %in = icmp slt i64 %x, %n
+  br i1 %in, label %check, label %out, !sr.cov !1
+check:
+  call void @use(i64 %x)
+  %bad = icmp sge i64 %x, %n
+  br i1 %bad, label %trap, label %load, !nosanitize !0, !sr.cov !2
+trap:
+  call void @llvm.trap(), !nosanitize !0
+  unreachable
+load:
+  %q = getelementptr i32, i32* %p, i64 %x
+  %v = load i32, i32* %q
+  ret i32 %v
+out:
+  ret i32 0
+}
+
+define i32 @c(i32* %p, i64 %x, i64 %n) {
+entry:
+  %in = icmp slt i64 %x, %n
+  br i1 %in, label %check, label %out, !sr.cov !3
+check:
+  call void @use(i64 %x)
+  %bad = icmp sge i64 %x, %n
+  br i1 %bad, label %trap, label %load, !nosanitize !0, !sr.cov !4
+trap:
+  call void @llvm.trap(), !nosanitize !0
+  unreachable
+load:
+  %q = getelementptr i32, i32* %p, i64 %x
+  %v = load i32, i32* %q
+  ret i32 %v
+out:
+  ret i32 0
+}
+
+define i32 @d(i32* %p, i64 %x, i64 %n) {
+entry:
+  %bad = icmp sge i64 %x, %n
+  br i1 %bad, label %trap, label %load, !nosanitize !0, !sr.cov !4
+trap:
+  call void @llvm.trap(), !nosanitize !0
+  unreachable
+load:
+  %q = getelementptr i32, i32* %p, i64 %x
+  %v = load i32, i32* %q
+  ret i32 %v
+}
+
+declare void @use(i64)
+declare void @llvm.trap()
+
+!0 = !{}
+!1 = !{i64 3, i64 6, i64 4, !"helper.c"}
+!2 = !{i64 5, i64 0, i64 6, !"helper.c"}
+!3 = !{i64 0, i64 3, i64 2, !"c.c"}
+!4 = !{i64 1, i64 0, i64 6, !"helper2.c"}
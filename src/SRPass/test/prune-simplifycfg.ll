@@ -0,0 +1,35 @@
+; A check folded by sr-prove-checks still branches to its trap block until
+; simplifycfg deletes the dead edge; only then does DCC stop counting it.
+; RUN: %opt_legacy -load %srpass -sr-prove-checks -S < %s 2>/dev/null | %opt_legacy -load %srpass -dcc -o /dev/null 2>&1 | FileCheck %s --check-prefix=FOLDED
+; RUN: %opt_legacy -load %srpass -sr-prove-checks -simplifycfg -S < %s 2>/dev/null | %opt_legacy -load %srpass -dcc -o /dev/null 2>&1 | FileCheck %s --check-prefix=PRUNED
+
+; FOLDED: <stdin> :: 2 :: 0
+; PRUNED: <stdin> :: 1 :: 0
+
+define i32 @f(i32 %a, i32 %b) {
+entry:
+  %ma = and i32 %a, 255
+  %mb = and i32 %b, 255
+  %r = call { i32, i1 } @llvm.sadd.with.overflow.i32(i32 %ma, i32 %mb)
+  %ov = extractvalue { i32, i1 } %r, 1
+  br i1 %ov, label %trap, label %cont, !nosanitize !0
+trap:
+  call void @llvm.trap(), !nosanitize !0
+  unreachable
+cont:
+  %s = extractvalue { i32, i1 } %r, 0
+  %r2 = call { i32, i1 } @llvm.sadd.with.overflow.i32(i32 %s, i32 %b)
+  %ov2 = extractvalue { i32, i1 } %r2, 1
+  br i1 %ov2, label %trap2, label %cont2, !nosanitize !0
+trap2:
+  call void @llvm.trap(), !nosanitize !0
+  unreachable
+cont2:
+  %s2 = extractvalue { i32, i1 } %r2, 0
+  ret i32 %s2
+}
+
+declare { i32, i1 } @llvm.sadd.with.overflow.i32(i32, i32)
+declare void @llvm.trap()
+
+!0 = !{}
@@ -0,0 +1,184 @@
+; sr-range-checks replaces ASan's per-iteration check of a[i] with one
+; check of the accessed range in the preheader. A non-affine index, or a
+; check that recovers instead of aborting, keeps its check in the loop.
+; The functions are the output of
+;   opt -passes=asan-function-pipeline -asan-opt-globals=false [-asan-recover]
+; on "for (i = 0; i < n; i++) a[i] = 0;" and "a[i * i] = 0", with
+;   -asan-instrumentation-with-call-threshold=0
+; for the callback check.
+; RUN: %opt_legacy -load %srpass -sr-range-checks -S < %s 2>/dev/null | FileCheck %s
+
+target datalayout = "e-m:e-p270:32:32-p271:32:32-p272:64:64-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+; CHECK-LABEL: @affine(
+; CHECK: ph:
+; CHECK: %sr.poisoned = call i64 @__asan_region_is_poisoned(
+; CHECK: call void @__asan_report_store_n(i64 %sr.poisoned, i64 4)
+; CHECK: loop:
+; CHECK: br i1 false,
+; CHECK: br i1 false,
+define void @affine(i32* %a, i64 %n) #0 {
+entry:
+  %cmp = icmp sgt i64 %n, 0
+  br i1 %cmp, label %ph, label %exit
+
+ph:                                               ; preds = %entry
+  br label %loop
+
+loop:                                             ; preds = %12, %ph
+  %i = phi i64 [ 0, %ph ], [ %i.next, %12 ]
+  %p = getelementptr inbounds i32, i32* %a, i64 %i
+  %0 = ptrtoint i32* %p to i64
+  %1 = lshr i64 %0, 3
+  %2 = add i64 %1, 2147450880
+  %3 = inttoptr i64 %2 to i8*
+  %4 = load i8, i8* %3, align 1
+  %5 = icmp ne i8 %4, 0
+  br i1 %5, label %6, label %12, !prof !0
+
+6:                                                ; preds = %loop
+  %7 = and i64 %0, 7
+  %8 = add i64 %7, 3
+  %9 = trunc i64 %8 to i8
+  %10 = icmp sge i8 %9, %4
+  br i1 %10, label %11, label %12
+
+11:                                               ; preds = %6
+  call void @__asan_report_store4(i64 %0)
+  unreachable
+
+12:                                               ; preds = %6, %loop
+  store i32 0, i32* %p, align 4
+  %i.next = add nuw nsw i64 %i, 1
+  %more = icmp slt i64 %i.next, %n
+  br i1 %more, label %loop, label %exit
+
+exit:                                             ; preds = %12, %entry
+  ret void
+}
+
+; CHECK-LABEL: @nonaffine(
+; CHECK-NOT: __asan_region_is_poisoned
+; CHECK: br i1 %5, label %6, label %12
+; CHECK: br i1 %10, label %11, label %12
+define void @nonaffine(i32* %a, i64 %n) #0 {
+entry:
+  %cmp = icmp sgt i64 %n, 0
+  br i1 %cmp, label %ph, label %exit
+
+ph:                                               ; preds = %entry
+  br label %loop
+
+loop:                                             ; preds = %12, %ph
+  %i = phi i64 [ 0, %ph ], [ %i.next, %12 ]
+  %sq = mul nuw nsw i64 %i, %i
+  %p = getelementptr inbounds i32, i32* %a, i64 %sq
+  %0 = ptrtoint i32* %p to i64
+  %1 = lshr i64 %0, 3
+  %2 = add i64 %1, 2147450880
+  %3 = inttoptr i64 %2 to i8*
+  %4 = load i8, i8* %3, align 1
+  %5 = icmp ne i8 %4, 0
+  br i1 %5, label %6, label %12, !prof !0
+
+6:                                                ; preds = %loop
+  %7 = and i64 %0, 7
+  %8 = add i64 %7, 3
+  %9 = trunc i64 %8 to i8
+  %10 = icmp sge i8 %9, %4
+  br i1 %10, label %11, label %12
+
+11:                                               ; preds = %6
+  call void @__asan_report_store4(i64 %0)
+  unreachable
+
+12:                                               ; preds = %6, %loop
+  store i32 0, i32* %p, align 4
+  %i.next = add nuw nsw i64 %i, 1
+  %more = icmp slt i64 %i.next, %n
+  br i1 %more, label %loop, label %exit
+
+exit:                                             ; preds = %12, %entry
+  ret void
+}
+
+; CHECK-LABEL: @recover(
+; CHECK-NOT: __asan_region_is_poisoned
+; CHECK: br i1 %5, label %6, label %13
+; CHECK: br i1 %10, label %11, label %12
+define void @recover(i32* %a, i64 %n) #0 {
+entry:
+  %cmp = icmp sgt i64 %n, 0
+  br i1 %cmp, label %ph, label %exit
+
+ph:                                               ; preds = %entry
+  br label %loop
+
+loop:                                             ; preds = %13, %ph
+  %i = phi i64 [ 0, %ph ], [ %i.next, %13 ]
+  %p = getelementptr inbounds i32, i32* %a, i64 %i
+  %0 = ptrtoint i32* %p to i64
+  %1 = lshr i64 %0, 3
+  %2 = add i64 %1, 2147450880
+  %3 = inttoptr i64 %2 to i8*
+  %4 = load i8, i8* %3, align 1
+  %5 = icmp ne i8 %4, 0
+  br i1 %5, label %6, label %13, !prof !0
+
+6:                                                ; preds = %loop
+  %7 = and i64 %0, 7
+  %8 = add i64 %7, 3
+  %9 = trunc i64 %8 to i8
+  %10 = icmp sge i8 %9, %4
+  br i1 %10, label %11, label %12
+
+11:                                               ; preds = %6
+  call void @__asan_report_store4_noabort(i64 %0)
+  br label %12
+
+12:                                               ; preds = %6, %11
+  br label %13
+
+13:                                               ; preds = %loop, %12
+  store i32 0, i32* %p, align 4
+  %i.next = add nuw nsw i64 %i, 1
+  %more = icmp slt i64 %i.next, %n
+  br i1 %more, label %loop, label %exit
+
+exit:                                             ; preds = %13, %entry
+  ret void
+}
+
+; CHECK-LABEL: @recover_callback(
+; CHECK-NOT: __asan_region_is_poisoned
+; CHECK: call void @__asan_store4_noabort(i64 %0)
+define void @recover_callback(i32* %a, i64 %n) #0 {
+entry:
+  %cmp = icmp sgt i64 %n, 0
+  br i1 %cmp, label %ph, label %exit
+
+ph:                                               ; preds = %entry
+  br label %loop
+
+loop:                                             ; preds = %loop, %ph
+  %i = phi i64 [ 0, %ph ], [ %i.next, %loop ]
+  %p = getelementptr inbounds i32, i32* %a, i64 %i
+  %0 = ptrtoint i32* %p to i64
+  call void @__asan_store4_noabort(i64 %0)
+  store i32 0, i32* %p, align 4
+  %i.next = add nuw nsw i64 %i, 1
+  %more = icmp slt i64 %i.next, %n
+  br i1 %more, label %loop, label %exit
+
+exit:                                             ; preds = %loop, %entry
+  ret void
+}
+
+declare void @__asan_report_store4(i64)
+declare void @__asan_report_store4_noabort(i64)
+declare void @__asan_store4_noabort(i64)
+
+attributes #0 = { sanitize_address }
+
+!0 = !{!"branch_weights", i32 1, i32 100000}
@@ -0,0 +1,100 @@
+; In static mode StaPass removes a check only below a user branch whose
+; condition implies that the check passes, on an edge whose block frequency
+; matches the check's own.
+; RUN: %opt_legacy -load %srpass -StaPass -S < %s 2>/dev/null | FileCheck %s
+
+; if (i < 10) check(i < 16) is implied
+; CHECK-LABEL: @implied(
+; CHECK: then:
+; CHECK: %ok = icmp ult i32 %i, 16
+; CHECK-NEXT: br i1 true, label %cont, label %trap
+define void @implied(i32* %a, i32 %i) {
+entry:
+  %c = icmp ult i32 %i, 10
+  br i1 %c, label %then, label %exit
+then:
+  store i32 1, i32* %a
+  %ok = icmp ult i32 %i, 16
+  br i1 %ok, label %cont, label %trap, !nosanitize !0
+trap:
+  call void @llvm.trap(), !nosanitize !0
+  unreachable
+cont:
+  %p = getelementptr i32, i32* %a, i32 %i
+  store i32 0, i32* %p
+  br label %exit
+exit:
+  ret void
+}
+
+; if (i < 32) check(i < 16) is not
+; CHECK-LABEL: @weaker(
+; CHECK: br i1 %ok, label %cont, label %trap
+define void @weaker(i32* %a, i32 %i) {
+entry:
+  %c = icmp ult i32 %i, 32
+  br i1 %c, label %then, label %exit
+then:
+  store i32 1, i32* %a
+  %ok = icmp ult i32 %i, 16
+  br i1 %ok, label %cont, label %trap, !nosanitize !0
+trap:
+  call void @llvm.trap(), !nosanitize !0
+  unreachable
+cont:
+  %p = getelementptr i32, i32* %a, i32 %i
+  store i32 0, i32* %p
+  br label %exit
+exit:
+  ret void
+}
+
+; A user branch that only runs after the check proves nothing about it
+; CHECK-LABEL: @after(
+; CHECK: br i1 %ok, label %cont, label %trap
+define void @after(i32* %a, i32 %i) {
+entry:
+  %ok = icmp ult i32 %i, 16
+  br i1 %ok, label %cont, label %trap, !nosanitize !0
+trap:
+  call void @llvm.trap(), !nosanitize !0
+  unreachable
+cont:
+  %p = getelementptr i32, i32* %a, i32 %i
+  store i32 0, i32* %p
+  %c = icmp ult i32 %i, 16
+  br i1 %c, label %then, label %exit
+then:
+  store i32 1, i32* %p
+  br label %exit
+exit:
+  ret void
+}
+
+; The check runs once per iteration, the user branch once per call
+; CHECK-LABEL: @loop(
+; CHECK: br i1 %ok, label %cont, label %trap
+define void @loop(i32* %a, i32 %i, i32 %n) {
+entry:
+  %c = icmp ult i32 %i, 10
+  br i1 %c, label %body, label %exit
+body:
+  %k = phi i32 [ 0, %entry ], [ %k.next, %cont ]
+  %ok = icmp ult i32 %i, 16
+  br i1 %ok, label %cont, label %trap, !nosanitize !0
+trap:
+  call void @llvm.trap(), !nosanitize !0
+  unreachable
+cont:
+  %p = getelementptr i32, i32* %a, i32 %i
+  store i32 %k, i32* %p
+  %k.next = add i32 %k, 1
+  %more = icmp slt i32 %k.next, %n
+  br i1 %more, label %body, label %exit
+exit:
+  ret void
+}
+
+declare void @llvm.trap()
+
+!0 = !{}
@@ -0,0 +1,53 @@
+; Trap-mode UBSan checks branch to llvm.ubsantrap (clang 12 and later) or
+; to llvm.trap marked !nosanitize (older clang). Both are sanity checks;
+; a __builtin_trap without !nosanitize is not.
+; REQUIRES: ubsantrap
+; RUN: %opt_legacy -load %srpass -SCIPass -S < %s 2>/dev/null | FileCheck %s
+
+; CHECK-LABEL: @ubsantrap(
+; CHECK: br i1 %ov, label %trap, label %cont, !nosanitize !{{[0-9]+}}, !sanitycheck
+define i32 @ubsantrap(i32 %a, i32 %b) {
+entry:
+  %r = call { i32, i1 } @llvm.sadd.with.overflow.i32(i32 %a, i32 %b)
+  %ov = extractvalue { i32, i1 } %r, 1
+  br i1 %ov, label %trap, label %cont, !nosanitize !0
+trap:
+  call void @llvm.ubsantrap(i8 0), !nosanitize !0
+  unreachable
+cont:
+  %s = extractvalue { i32, i1 } %r, 0
+  ret i32 %s
+}
+
+; CHECK-LABEL: @trap(
+; CHECK: br i1 %ov, label %trap, label %cont, !nosanitize !{{[0-9]+}}, !sanitycheck
+define i32 @trap(i32 %a, i32 %b) {
+entry:
+  %r = call { i32, i1 } @llvm.sadd.with.overflow.i32(i32 %a, i32 %b)
+  %ov = extractvalue { i32, i1 } %r, 1
+  br i1 %ov, label %trap, label %cont, !nosanitize !0
+trap:
+  call void @llvm.trap(), !nosanitize !0
+  unreachable
+cont:
+  %s = extractvalue { i32, i1 } %r, 0
+  ret i32 %s
+}
+
+; CHECK-LABEL: @builtin_trap(
+; CHECK: br i1 %c, label %trap, label %cont{{$}}
+define void @builtin_trap(i1 %c) {
+entry:
+  br i1 %c, label %trap, label %cont
+trap:
+  call void @llvm.trap()
+  unreachable
+cont:
+  ret void
+}
+
+declare { i32, i1 } @llvm.sadd.with.overflow.i32(i32, i32)
+declare void @llvm.ubsantrap(i8)
+declare void @llvm.trap()
+
+!0 = !{}
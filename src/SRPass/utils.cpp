@@ -1,11 +1,25 @@
+#include "llvm/Config/llvm-config.h"
+#include "llvm/IR/Constants.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/Instructions.h"
+#include "llvm/IR/Intrinsics.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Transforms/Utils/Local.h"
 #include "SCIPass.h"
+#include "utils.h"
 using namespace llvm;
 
+static cl::opt<bool> CheckWeights("check-weights",
+        cl::desc("Attach profiled branch weights to checks and mark reports cold"),
+        cl::init(true), cl::Hidden);
+
 bool isAbortingCall(const CallInst *CI) {
     if (CI->getCalledFunction()) {
         StringRef name = CI->getCalledFunction()->getName();
+        // Also covers the minimal runtime's __ubsan_handle_*_minimal[_abort]
         if (name.startswith("__ubsan_handle")) {
             return true;
         }
@@ -18,15 +32,56 @@ bool isAbortingCall(const CallInst *CI) {
         // if (name == "__assert_fail" || name == "__assert_rtn") {
         //     return true;
         // }
+        // With -fsanitize-trap, UBSan checks branch to a (possibly shared)
+        // block calling llvm.ubsantrap, or llvm.trap before clang 12. Traps
+        // emitted by the sanitizer carry !nosanitize, which tells them apart
+        // from __builtin_trap; llvm.ubsantrap is only emitted by UBSan.
+        if (isUBSanTrap(CI->getCalledFunction())) {
+            return true;
+        }
+        if (CI->getCalledFunction()->getIntrinsicID() == Intrinsic::trap &&
+            CI->getMetadata("nosanitize")) {
+            return true;
+        }
     }
     return false;
 }
 
+bool isUBSanTrap(const Function *F) {
+#if LLVM_VERSION_MAJOR >= 12
+    return F && F->getIntrinsicID() == Intrinsic::ubsantrap;
+#else
+    return false;
+#endif
+}
+
+// ASan checks emitted in callback mode: the runtime function performs the
+// shadow check and reports on its own, so the call is the whole check.
+// These are exactly the void __asan_[exp_]{load,store}{1,2,4,8,16,N} and
+// their _noabort variants; other runtime functions with the same prefix,
+// such as __asan_load_cxx_array_cookie, return a value the program uses.
+bool isCallbackCheck(const CallInst *CI) {
+    const Function *Callee = CI->getCalledFunction();
+    if (!Callee || !Callee->getReturnType()->isVoidTy()) {
+        return false;
+    }
+    StringRef name = Callee->getName();
+    if (!name.consume_front("__asan_")) {
+        return false;
+    }
+    if (!name.consume_front("exp_")) {
+        name.consume_back("_noabort");
+    }
+    if (!name.consume_front("load") && !name.consume_front("store")) {
+        return false;
+    }
+    return name == "1" || name == "2" || name == "4" || name == "8" || name == "16" || name == "N";
+}
+
 unsigned int getRegularBranch(BranchInst *BI, SCIPass *SCI) {
     unsigned int RegularBranch = (unsigned)(-1);
-    Function *F = BI->getParent()->getParent();
     for (unsigned int I = 0, E = BI->getNumSuccessors(); I != E; ++I) {
-        if (!SCI->getSanityCheckBlocks(F).count(BI->getSuccessor(I))) {
+        if (!SCI->isCheckSuccessor(BI, BI->getSuccessor(I))) {
             assert(RegularBranch == (unsigned)(-1) && "More than one regular branch?");
             RegularBranch = I;
         }
@@ -50,39 +105,118 @@ unsigned int getRegularBranch(BranchInst *BI, SCIPass *SCI) {
     return RegularBranch;
 }
 
-bool getCheckType(Instruction *Inst, SCIPass *SCI) {
-    BranchInst *BI = cast<BranchInst>(Inst);
-    unsigned int RegularBranch = (unsigned)(-1);
-    Function *F = BI->getParent()->getParent();
-    for (unsigned int I = 0, E = BI->getNumSuccessors(); I != E; ++I) {
-        if (!SCI->getSanityCheckBlocks(F).count(BI->getSuccessor(I))) {
-            assert(RegularBranch == (unsigned)(-1) && "More than one regular branch?");
-            RegularBranch = I;
+// Removes a sanity check by folding the condition of each of its branches so
+// that the regular branch is always taken. Returns false if a branch without a
+// regular successor had to be kept intact.
+bool foldSanityCheck(BranchInst *BI, SCIPass *SCI) {
+    std::vector<std::pair<BranchInst*, bool>> Folds;
+    bool Changed = getSanityCheckFolds(BI, SCI, Folds);
+    for (auto &Fold: Folds) {
+        Fold.first->setCondition(ConstantInt::getBool(Fold.first->getContext(), Fold.second));
+    }
+    return Changed;
+}
+
+// Appends the condition each branch of a sanity check is folded to, without
+// changing the check. Returns false if a branch has no regular successor.
+bool getSanityCheckFolds(BranchInst *BI, SCIPass *SCI, std::vector<std::pair<BranchInst*, bool>> &Folds) {
+    bool Changed = true;
+    for (Instruction *Inst: SCI->getCheckBranches(BI)) {
+        BranchInst *CheckBI = cast<BranchInst>(Inst);
+        unsigned int RegularBranch = getRegularBranch(CheckBI, SCI);
+        if (RegularBranch == 0) {
+            Folds.push_back(std::make_pair(CheckBI, true));
+        } else if (RegularBranch == 1) {
+            Folds.push_back(std::make_pair(CheckBI, false));
+        } else {
+            dbgs() << "Warning: Sanity check with no regular branch found.\n";
+            dbgs() << "The sanity check has been kept intact.\n";
+            Changed = false;
         }
     }
-    StringRef name = "";
-    if (RegularBranch == 0) {
-        for (const Instruction &Inst: *(BI->getSuccessor(1))) {
-            if (const CallInst *CI = dyn_cast<CallInst>(&Inst)) {
-                if (CI->getCalledFunction()) {
-                    name = CI->getCalledFunction()->getName();
-                }
-            }
+    return Changed;
+}
+
+// Rewrites one predicate out of a fused check condition by replacing it with
+// the value that never fails. Once no predicate is left, the whole check is
+// folded and true is returned.
+bool removeSubCheck(BranchInst *BI, Use *Sub, SCIPass *SCI) {
+    Instruction *Op = cast<Instruction>(Sub->getUser());
+    if (Op->getOpcode() == Instruction::Or) {
+        Sub->set(ConstantInt::getFalse(BI->getContext()));
+    } else {
+        Sub->set(ConstantInt::getTrue(BI->getContext()));
+    }
+    for (Use *U: SCI->getSubChecks(BI)) {
+        if (!isa<Constant>(U->get())) {
+            return false;
         }
     }
-    else if (RegularBranch == 1) {
-        for (const Instruction &Inst: *(BI->getSuccessor(0))) {
-            if (const CallInst *CI = dyn_cast<CallInst>(&Inst)) {
-                if (CI->getCalledFunction()) {
-                    name = CI->getCalledFunction()->getName();
-                }
+    return foldSanityCheck(BI, SCI);
+}
+
+bool getCheckType(Instruction *Inst, SCIPass *SCI) {
+    return SCI->getCheckInfo(Inst).isASan();
+}
+
+// Erases removed callback checks together with the address computations
+// that only they were using.
+void eraseCallbackChecks(std::set<Instruction*> &Checks) {
+    for (Instruction *Inst: Checks) {
+        assert(Inst->use_empty() && "Callback check with a used result");
+        Value *Addr = Inst->getOperand(0);
+        Inst->eraseFromParent();
+        RecursivelyDeleteTriviallyDeadInstructions(Addr);
+    }
+    Checks.clear();
+}
+
+// Branch weights are 32 bits wide: both counts are halved until they fit.
+// One is added so that no edge looks impossible.
+static void scaleWeights(uint64_t &A, uint64_t &B) {
+    while (A >= UINT32_MAX || B >= UINT32_MAX) {
+        A >>= 1;
+        B >>= 1;
+    }
+    A += 1;
+    B += 1;
+}
+
+void setCheckWeights(Instruction *SC, uint64_t LB, uint64_t RB, SCIPass *SCI) {
+    if (!CheckWeights || !isa<BranchInst>(SC) || LB + RB == 0) {
+        return;
+    }
+    MDBuilder MDB(SC->getContext());
+    for (Instruction *Inst: SCI->getCheckBranches(SC)) {
+        BranchInst *BI = cast<BranchInst>(Inst);
+        uint64_t Weights[2];
+        if (BI == SC) {
+            Weights[0] = LB;
+            Weights[1] = RB;
+        }
+        else {
+            // The other branches, such as ASan's fast path in front of the
+            // slow path, are only known to pass far more often than not
+            unsigned RegularBranch = getRegularBranch(BI, SCI);
+            if (RegularBranch > 1) {
+                continue;
             }
+            Weights[RegularBranch] = LB + RB;
+            Weights[1 - RegularBranch] = 0;
         }
+        scaleWeights(Weights[0], Weights[1]);
+        BI->setMetadata(LLVMContext::MD_prof, MDB.createBranchWeights(Weights[0], Weights[1]));
     }
-    if (name.startswith("__asan_report")) {
-        return true;
+}
+
+void markReportsCold(Module &M) {
+    if (!CheckWeights) {
+        return;
     }
-    else {
-        return false;
+    for (Function &F: M) {
+        StringRef Name = F.getName();
+        if (F.isDeclaration() && (Name.startswith("__asan_report") || Name.startswith("__ubsan_handle"))) {
+            F.addFnAttr(Attribute::Cold);
+        }
     }
-}
\ No newline at end of file
+}
@@ -3,10 +3,19 @@
 
 #include "llvm/IR/DebugLoc.h"
 
+#include <cstdint>
+#include <set>
+#include <utility>
+#include <vector>
+
 namespace llvm {
     class BranchInst;
+    class Function;
+    class Instruction;
     class CallInst;
+    class Use;
     class LLVMContext;
+    class Module;
     class raw_ostream;
 }
 
@@ -14,8 +23,30 @@ struct SCIPass;
 
 bool isAbortingCall(const llvm::CallInst *CI);
 
+// Whether F is llvm.ubsantrap, which trapping UBSan checks call from clang
+// 12 on. Always false on older LLVM, which lacks the intrinsic.
+bool isUBSanTrap(const llvm::Function *F);
+
+bool isCallbackCheck(const llvm::CallInst *CI);
+
 unsigned int getRegularBranch(llvm::BranchInst *BI, SCIPass *SCI);
 
+bool foldSanityCheck(llvm::BranchInst *BI, SCIPass *SCI);
+
+bool getSanityCheckFolds(llvm::BranchInst *BI, SCIPass *SCI, std::vector<std::pair<llvm::BranchInst*, bool>> &Folds);
+
+bool removeSubCheck(llvm::BranchInst *BI, llvm::Use *Sub, SCIPass *SCI);
+
 bool getCheckType(llvm::Instruction *Inst, SCIPass *SCI);
 
+void eraseCallbackChecks(std::set<llvm::Instruction*> &Checks);
+
+// Attaches !prof weights to the branches of a check. LB and RB are the
+// profiled counts of the successors of SC itself, the branch DCC counts.
+void setCheckWeights(llvm::Instruction *SC, uint64_t LB, uint64_t RB, SCIPass *SCI);
+
+// Marks the sanitizer report functions cold, so that the blocks calling
+// them are laid out away from the checked code.
+void markReportsCold(llvm::Module &M);
+
 #endif	/* ETHPASS_UTILS_H */
\ No newline at end of file